@@ -0,0 +1,190 @@
+#!/usr/bin/env python3
+#
+# Latency benchmark and regression check for the pycryptsetup bindings
+#
+# Works on sparse image files, no real disks are touched. As root the
+# image is attached to a loop device and activate/deactivate are measured
+# too, otherwise only metadata operations run. PBKDF costs are pinned to
+# the minimum so the numbers reflect the binding and header I/O, not the
+# KDF calibration of the machine.
+#
+#   python3 setup.py build_ext --inplace
+#   python3 benchmarks/suite.py --output base.json
+#   ... upgrade libcryptsetup or rebuild ...
+#   python3 benchmarks/suite.py --baseline base.json --threshold 0.25
+#
+
+import argparse
+import json
+import os
+import platform
+import subprocess
+import sys
+import tempfile
+import time
+
+import pycryptsetup
+
+PASSPHRASE = b"benchmark-passphrase"
+LOW_PBKDF = {"type": pycryptsetup.CRYPT_KDF_PBKDF2, "hash": "sha256", "iterations": 1000}
+
+
+def check(op, r):
+    if isinstance(r, int) and r < 0:
+        raise OSError(-r, "%s: %s" % (op, os.strerror(-r)))
+    return r
+
+
+class Timer(object):
+    def __init__(self):
+        self.samples = {}
+
+    def run(self, op, func, *args, **kwargs):
+        start = time.perf_counter()
+        r = func(*args, **kwargs)
+        self.samples.setdefault(op, []).append(time.perf_counter() - start)
+        return check(op, r)
+
+
+def percentile(values, p):
+    values = sorted(values)
+    k = (len(values) - 1) * p
+    lo = int(k)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (k - lo)
+
+
+def summary(samples):
+    us = [s * 1e6 for s in samples]
+    return {
+        "count": len(us),
+        "min_us": min(us),
+        "mean_us": sum(us) / len(us),
+        "p50_us": percentile(us, 0.50),
+        "p90_us": percentile(us, 0.90),
+        "p99_us": percentile(us, 0.99),
+        "max_us": max(us),
+    }
+
+
+def make_image(directory, size_mib):
+    fd, path = tempfile.mkstemp(prefix="pycryptsetup-bench-", suffix=".img", dir=directory)
+    os.ftruncate(fd, size_mib * 1024 * 1024)
+    os.close(fd)
+    return path
+
+
+def attach_loop(image):
+    return subprocess.check_output(["losetup", "--find", "--show", image]).decode().strip()
+
+
+def detach_loop(device):
+    subprocess.call(["losetup", "--detach", device])
+
+
+def run_iteration(timer, device, luks_type, activate, index):
+    c = timer.run("construct", pycryptsetup.CryptSetup, device=device)
+    timer.run("luksFormat", c.luksFormat, type=luks_type, pbkdf=LOW_PBKDF)
+    timer.run("addKeyByVolumeKey", c.addKeyByVolumeKey, newPassphrase=PASSPHRASE)
+
+    # the pbkdf set by luksFormat applies to keyslots added through c
+    extra = b"extra-%d" % index
+    timer.run("addKeyByPassphrase", c.addKeyByPassphrase, passphrase=PASSPHRASE, newPassphrase=extra)
+    timer.run("removePassphrase", c.removePassphrase, passphrase=extra)
+
+    if activate:
+        name = "pycryptsetup-bench-%d-%d" % (os.getpid(), index)
+        timer.run("activate", c.activate, name=name, passphrase=PASSPHRASE)
+        timer.run("status", c.status)
+        timer.run("deactivate", c.deactivate)
+
+    # fresh object on the formatted device, as a short-lived reader sees it
+    c = timer.run("construct_luks", pycryptsetup.CryptSetup, device=device)
+    timer.run("isLuks", c.isLuks)
+    timer.run("info", c.info)
+    timer.run("info_cached", c.info)
+    timer.run("luksUUID", c.luksUUID)
+
+
+def compare(results, baseline, threshold, metric):
+    regressions = []
+    for op, current in sorted(results["ops"].items()):
+        base = baseline.get("ops", {}).get(op)
+        if not base or not base.get(metric):
+            continue
+        ratio = current[metric] / base[metric]
+        if ratio > 1 + threshold:
+            regressions.append((op, base[metric], current[metric], ratio))
+    return regressions
+
+
+def main():
+    parser = argparse.ArgumentParser(description="pycryptsetup latency benchmark")
+    parser.add_argument("--iterations", type=int, default=20)
+    parser.add_argument("--warmup", type=int, default=2)
+    parser.add_argument("--type", choices=["luks1", "luks2"], default="luks2")
+    parser.add_argument("--size", type=int, default=64, help="image size in MiB")
+    parser.add_argument("--dir", default=None, help="directory for image files")
+    parser.add_argument("--no-activate", action="store_true", help="skip activate/deactivate even as root")
+    parser.add_argument("--output", help="write JSON results to this file instead of stdout")
+    parser.add_argument("--baseline", help="JSON results to compare against")
+    parser.add_argument("--threshold", type=float, default=0.25,
+                        help="allowed slowdown against baseline, 0.25 = 25%%")
+    parser.add_argument("--metric", default="p50_us", help="summary field compared against baseline")
+    args = parser.parse_args()
+
+    activate = os.geteuid() == 0 and not args.no_activate
+    image = make_image(args.dir, args.size)
+    loop = None
+    timer = Timer()
+
+    try:
+        device = image
+        if activate:
+            loop = attach_loop(image)
+            device = loop
+
+        for i in range(args.warmup):
+            run_iteration(Timer(), device, args.type, activate, i)
+        for i in range(args.iterations):
+            run_iteration(timer, device, args.type, activate, args.warmup + i)
+    finally:
+        if loop:
+            detach_loop(loop)
+        os.unlink(image)
+
+    results = {
+        "meta": {
+            "timestamp": time.strftime("%Y-%m-%dT%H:%M:%SZ", time.gmtime()),
+            "python": platform.python_version(),
+            "machine": platform.machine(),
+            "kernel": platform.release(),
+            "type": args.type,
+            "iterations": args.iterations,
+            "pbkdf": LOW_PBKDF,
+            "device": "loop" if loop else "file",
+            "activate": activate,
+        },
+        "ops": dict((op, summary(samples)) for op, samples in timer.samples.items()),
+    }
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+            f.write("\n")
+    else:
+        json.dump(results, sys.stdout, indent=2, sort_keys=True)
+        print()
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)
+        regressions = compare(results, baseline, args.threshold, args.metric)
+        for op, base, current, ratio in regressions:
+            sys.stderr.write("REGRESSION %s: %s %.1f -> %.1f (x%.2f)\n" % (op, args.metric, base, current, ratio))
+        if regressions:
+            sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+#
+# Compare CryptSetup.wipe() with zeroing a device through a Python write() loop
+#
+# Runs on a sparse image file, or on a loop device over it with --loop
+# (needs root). Usage: python3 benchmarks/wipe.py --size 512 --repeat 3
+#
+
+import argparse
+import json
+import os
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+import pycryptsetup
+
+
+def write_loop(path, length, block_size):
+    block = b"\0" * block_size
+    with open(path, "r+b", buffering=0) as f:
+        done = 0
+        while done < length:
+            done += f.write(block[:min(block_size, length - done)])
+        os.fsync(f.fileno())
+
+
+def crypt_wipe(ctx, path, length, block_size, flags):
+    r = ctx.wipe(pattern=pycryptsetup.CRYPT_WIPE_ZERO, length=length,
+                 blockSize=block_size, flags=flags, device=path)
+    if r < 0:
+        raise OSError(-r, os.strerror(-r), path)
+
+
+def measure(func, repeat):
+    times = []
+    for _ in range(repeat):
+        start = time.monotonic()
+        func()
+        times.append(time.monotonic() - start)
+    return times
+
+
+def report(name, times, length):
+    mib = length / (1024 * 1024)
+    return {
+        "method": name,
+        "runs": len(times),
+        "best_s": min(times),
+        "median_s": statistics.median(times),
+        "best_mibps": mib / min(times),
+        "median_mibps": mib / statistics.median(times),
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Compare CryptSetup.wipe() with a Python write() loop")
+    parser.add_argument("--size", type=int, default=256, help="image size in MiB")
+    parser.add_argument("--block-size", type=int, default=1024 * 1024, help="bytes per write")
+    parser.add_argument("--repeat", type=int, default=3)
+    parser.add_argument("--dir", default=".", help="directory for the image file")
+    parser.add_argument("--loop", action="store_true", help="wipe a loop device over the image")
+    parser.add_argument("--no-direct-io", action="store_true", help="pass CRYPT_WIPE_NO_DIRECT_IO")
+    parser.add_argument("--json", action="store_true", help="print results as JSON")
+    args = parser.parse_args()
+
+    length = args.size * 1024 * 1024
+    flags = pycryptsetup.CRYPT_WIPE_NO_DIRECT_IO if args.no_direct_io else 0
+
+    fd, image = tempfile.mkstemp(prefix="pycryptsetup-wipe-", suffix=".img", dir=args.dir)
+    os.ftruncate(fd, length)
+    os.close(fd)
+
+    loop = None
+    try:
+        target = image
+        if args.loop:
+            loop = subprocess.check_output(["losetup", "--find", "--show", image]).decode().strip()
+            target = loop
+
+        ctx = pycryptsetup.CryptSetup(device=target)
+        results = [
+            report("write_loop", measure(lambda: write_loop(target, length, args.block_size), args.repeat), length),
+            report("crypt_wipe", measure(lambda: crypt_wipe(ctx, target, length, args.block_size, flags), args.repeat), length),
+        ]
+    finally:
+        if loop:
+            subprocess.call(["losetup", "--detach", loop])
+        os.unlink(image)
+
+    if args.json:
+        json.dump({"size": length, "block_size": args.block_size, "target": "loop" if args.loop else "file",
+                   "results": results}, sys.stdout, indent=2)
+        print()
+    else:
+        for r in results:
+            print("%-10s best %8.1f MiB/s  median %8.1f MiB/s" % (r["method"], r["best_mibps"], r["median_mibps"]))
+
+
+if __name__ == "__main__":
+    main()
@@ -22,19 +22,29 @@
 #include <Python.h>
 #include <structmember.h>
 #include <errno.h>
-
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <libdevmapper.h>
 #include "libcryptsetup.h"
 
 /* Python API use char* where const char* should be used... */
 #define CONST_CAST(x) (x)(uintptr_t)
 
 #if PY_MAJOR_VERSION < 3
+  #define BUFFER_FMT "s*"
   #define MOD_ERROR_VAL
   #define MOD_SUCCESS_VAL(val)
   #define MOD_INIT(name) void init##name(void)
   #define MOD_DEF(ob, name, doc, methods) \
           ob = Py_InitModule3(name, methods, doc);
 #else
+  #define BUFFER_FMT "y*"
   #define PyInt_AsLong PyLong_AsLong
   #define PyInt_Check PyLong_Check
   #define MOD_ERROR_VAL NULL
@@ -46,8 +56,49 @@
           ob = PyModule_Create(&moduledef);
 #endif
 
+#if PY_VERSION_HEX >= 0x030D0000
+  #define PyEval_CallObject PyObject_CallObject
+#endif
+
+/*
+ * From 3.11 on (PyType_GetModuleByDef) the module uses multi-phase init
+ * with heap types kept in per-module state, so it can be imported into
+ * subinterpreters and declares that it runs without the GIL. Older
+ * versions keep single-phase init and static types.
+ */
+#if PY_VERSION_HEX >= 0x030B0000
+  #define MULTI_PHASE_INIT
+#endif
+
 MOD_INIT(pycryptsetup);
 
+/*
+ * libcryptsetup log messages are queued in a per-object ring and handed
+ * to the Python log callback in batches. Only the thread holding the
+ * object lock produces, so the producer side needs no lock. Consumers
+ * take the consume mutex: without the GIL two threads may drain at once.
+ */
+#define LOG_RING_SIZE 1024 /* power of two */
+
+/* levels start at CRYPT_LOG_DEBUG_JSON (-2) */
+#define LOG_LEVEL_BIT(level) (1U << ((level) + 2))
+#define LOG_LEVEL_ALL (~0U)
+
+typedef struct {
+	int level;
+	double timestamp;
+	char *msg;
+} LogRecord;
+
+typedef struct {
+	LogRecord records[LOG_RING_SIZE];
+	pthread_mutex_t consume;
+	unsigned int head;
+	unsigned int tail;
+	unsigned int dropped;
+	unsigned int filter;
+} LogRing;
+
 typedef struct {
 	PyObject_HEAD
 
@@ -55,307 +106,5389 @@ typedef struct {
 	struct crypt_device *device;
 	char *activated_as;
 
-	/* Callbacks */
+	/* Serializes use of device between threads */
+	PyThread_type_lock lock;
+	long lock_owner;
+
+	/* Callbacks, replaced under callback_mutex as workers may read them */
+	pthread_mutex_t callback_mutex;
 	PyObject *yesDialogCB;
 	PyObject *cmdLineLogCB;
+	int log_batch;
+	LogRing *log;
+
+	/* info() result, rebuilt after a mutating method ran */
+	PyObject *info;
+	int info_valid;
+
+	/* header is read on first use, see CryptSetup_load_header() */
+	int header_loaded;
+	/* the header was read by the current lock holder */
+	int header_fresh;
+
+	/* context pool key, context is only pooled while nothing changed it */
+	char *pool_key;
+	int pool_clean;
+
+	/* iterationTime(), unreadable from cd until a pbkdf type is set */
+	uint32_t iteration_time;
+
+#ifdef MULTI_PHASE_INIT
+	/* interpreter the callbacks have to run in */
+	PyInterpreterState *interp;
+#endif
 } CryptSetupObject;
 
+typedef struct {
+	PyTypeObject *CryptSetupType;
+	PyTypeObject *VolumeKeyType;
+	PyTypeObject *InfoType;
+	PyObject *complete_cb;
+
+	/* worker pool jobs of this interpreter, guarded by pool.mutex */
+	int jobs;
+	int closing;
+} ModuleState;
+
+#ifdef MULTI_PHASE_INIT
+static struct PyModuleDef pycryptsetup_module;
+
+static ModuleState *pycryptsetup_state(PyObject *m)
+{
+	return PyModule_GetState(m);
+}
+
+static ModuleState *module_state(CryptSetupObject *self)
+{
+	return pycryptsetup_state(PyType_GetModuleByDef(Py_TYPE(self), &pycryptsetup_module));
+}
+#else
+static ModuleState legacy_state;
+
+static ModuleState *pycryptsetup_state(PyObject *m)
+{
+	return &legacy_state;
+}
+
+static ModuleState *module_state(CryptSetupObject *self)
+{
+	return &legacy_state;
+}
+#endif
+
+/*
+ * Native threads calling back into Python. PyGILState_Ensure() only knows
+ * one thread state per thread, which belongs to the main interpreter
+ * unless the thread was started from a subinterpreter. When it is not the
+ * interpreter of the object a thread state is made for the callback.
+ */
+typedef struct {
+	PyGILState_STATE gstate;
+	PyThreadState *ts;
+} CallbackState;
+
+static void callback_enter(CallbackState *state, PyInterpreterState *interp)
+{
+#ifdef MULTI_PHASE_INIT
+	PyThreadState *ts = PyGILState_GetThisThreadState();
+
+	if (!ts || PyThreadState_GetInterpreter(ts) != interp) {
+		state->ts = PyThreadState_New(interp);
+		PyEval_RestoreThread(state->ts);
+		return;
+	}
+#endif
+	state->ts = NULL;
+	state->gstate = PyGILState_Ensure();
+}
+
+static void callback_leave(CallbackState *state)
+{
+	if (state->ts) {
+		PyThreadState_Clear(state->ts);
+		PyThreadState_DeleteCurrent();
+	} else
+		PyGILState_Release(state->gstate);
+}
+
+#ifdef MULTI_PHASE_INIT
+  #define CALLBACK_INTERP(x) ((x)->interp)
+#else
+  #define CALLBACK_INTERP(x) NULL
+#endif
+
+/*
+ * Strong reference to a callback, NULL when unset. Without a GIL the
+ * attribute can be replaced by another thread at any time, so it is only
+ * read and swapped under callback_mutex and called through its own
+ * reference.
+ */
+static PyObject *CryptSetup_get_callback(CryptSetupObject *self, PyObject **callback)
+{
+	PyObject *cb;
+
+	pthread_mutex_lock(&self->callback_mutex);
+	cb = *callback;
+	Py_XINCREF(cb);
+	pthread_mutex_unlock(&self->callback_mutex);
+
+	return cb;
+}
+
+static void CryptSetup_set_callback(CryptSetupObject *self, PyObject **callback, PyObject *cb)
+{
+	PyObject *old;
+
+	Py_XINCREF(cb);
+	pthread_mutex_lock(&self->callback_mutex);
+	old = *callback;
+	*callback = cb;
+	pthread_mutex_unlock(&self->callback_mutex);
+	Py_XDECREF(old);
+}
+
+/*
+ * libcryptsetup calls the callbacks below from inside blocking calls,
+ * which run with the GIL released, so they have to take it back first.
+ * Python exceptions cannot propagate through libcryptsetup; they are
+ * reported as unraisable and turned into an error code instead.
+ */
 static int yesDialog(const char *msg, void *this)
 {
 	CryptSetupObject *self = this;
-	PyObject *result, *arglist;
-	int r;
+	PyObject *cb, *result, *arglist;
+	CallbackState cbstate;
+	int r = 1;
 
-	if (self->yesDialogCB){
+	callback_enter(&cbstate, CALLBACK_INTERP(self));
+
+	cb = CryptSetup_get_callback(self, &self->yesDialogCB);
+	if (cb) {
 		arglist = Py_BuildValue("(s)", msg);
-		if (!arglist)
-			return -ENOMEM;
+		if (!arglist) {
+			r = -ENOMEM;
+			goto out;
+		}
 
-		result = PyEval_CallObject(self->yesDialogCB, arglist);
+		result = PyEval_CallObject(cb, arglist);
 		Py_DECREF(arglist);
 
-		if (!result)
-			return -EINVAL;
+		if (!result) {
+			r = -EINVAL;
+			goto out;
+		}
 
 		if (!PyArg_Parse(result, "i", &r))
 			r = -EINVAL;
 
 		Py_DECREF(result);
-		return r;
 	}
-
-	return 1;
+out:
+	if (PyErr_Occurred())
+		PyErr_WriteUnraisable(cb);
+	Py_XDECREF(cb);
+	callback_leave(&cbstate);
+	return r;
 }
 
+/* Runs without the GIL, messages are only queued here. */
 static void cmdLineLog(int cls, const char *msg, void *this)
 {
 	CryptSetupObject *self = this;
-	PyObject *result, *arglist;
-
-	if(self->cmdLineLogCB) {
-		arglist = Py_BuildValue("(is)", cls, msg);
-		if(!arglist)
-			return;
+	LogRing *ring = self->log;
+	LogRecord *rec;
+	struct timespec ts;
+	unsigned int head, tail;
+
+	if (!(__atomic_load_n(&ring->filter, __ATOMIC_RELAXED) & LOG_LEVEL_BIT(cls)))
+		return;
+
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+	if (tail - head >= LOG_RING_SIZE) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
+	}
 
-		result = PyEval_CallObject(self->cmdLineLogCB, arglist);
-		Py_DECREF(arglist);
-		Py_XDECREF(result);
+	rec = &ring->records[tail & (LOG_RING_SIZE - 1)];
+	rec->msg = strdup(msg);
+	if (!rec->msg) {
+		__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+		return;
 	}
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec->level = cls;
+	rec->timestamp = ts.tv_sec + ts.tv_nsec / 1e9;
+
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
 }
 
-static void CryptSetup_dealloc(CryptSetupObject* self)
+static PyObject *LogRecord_build(LogRecord *rec, int batch)
 {
-	/* free the callbacks */
-	Py_XDECREF(self->yesDialogCB);
-	Py_XDECREF(self->cmdLineLogCB);
-
-	free(self->activated_as);
-
-	crypt_free(self->device);
+	if (batch)
+		return Py_BuildValue("(ids)", rec->level, rec->timestamp, rec->msg);
 
-	/* free self */
-	Py_TYPE(self)->tp_free((PyObject*)self);
+	return Py_BuildValue("(is)", rec->level, rec->msg);
 }
 
-static PyObject *CryptSetup_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+/*
+ * Delivers queued log messages to the log callback, either one call per
+ * message with (level, text) or, in batch mode, one call with a list of
+ * (level, timestamp, text) tuples. Needs the GIL; a pending exception is
+ * kept so this can run on error paths. Returns the number delivered.
+ */
+static Py_ssize_t CryptSetup_drain_log(CryptSetupObject *self)
 {
-	CryptSetupObject *self = (CryptSetupObject *)type->tp_alloc(type, 0);
+	PyObject *type, *value, *traceback, *records, *record, *result, *cb;
+	LogRing *ring = self->log;
+	LogRecord *batch;
+	unsigned int head, tail, dropped;
+	Py_ssize_t i, count;
+
+	if (!ring)
+		return 0;
+
+	if (__atomic_load_n(&ring->head, __ATOMIC_RELAXED) == __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) &&
+	    !__atomic_load_n(&ring->dropped, __ATOMIC_RELAXED))
+		return 0;
+
+	pthread_mutex_lock(&ring->consume);
+	head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+	count = tail - head;
+
+	/* take the records out first, the callback may let another thread in */
+	batch = malloc((count + 1) * sizeof(*batch));
+	if (!batch) {
+		pthread_mutex_unlock(&ring->consume);
+		return 0;
+	}
+	for (i = 0; i < count; i++)
+		batch[i] = ring->records[(head + i) & (LOG_RING_SIZE - 1)];
+	__atomic_store_n(&ring->head, tail, __ATOMIC_RELEASE);
+	dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&ring->consume);
+
+	if (!count && !dropped) {
+		free(batch);
+		return 0;
+	}
 
-	if (self) {
-		self->yesDialogCB = NULL;
-		self->cmdLineLogCB = NULL;
-		self->activated_as = NULL;
+	if (dropped) {
+		batch[count].level = CRYPT_LOG_ERROR;
+		batch[count].timestamp = count ? batch[count - 1].timestamp : 0;
+		batch[count].msg = malloc(64);
+		if (batch[count].msg) {
+			snprintf(batch[count].msg, 64, "%u log messages dropped", dropped);
+			count++;
+		}
 	}
 
-	return (PyObject *)self;
-}
+	PyErr_Fetch(&type, &value, &traceback);
 
-static PyObject *PyObjectResult(int is)
-{
-	PyObject *result = Py_BuildValue("i", is);
+	cb = CryptSetup_get_callback(self, &self->cmdLineLogCB);
+	records = self->log_batch && cb ? PyList_New(count) : NULL;
+	for (i = 0; i < count && cb; i++) {
+		record = LogRecord_build(&batch[i], self->log_batch);
+		if (!record)
+			break;
 
-	if (!result)
-		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for return value");
+		if (records) {
+			PyList_SET_ITEM(records, i, record);
+			continue;
+		}
 
-	return result;
+		result = PyEval_CallObject(cb, record);
+		Py_DECREF(record);
+		Py_XDECREF(result);
+		if (!result)
+			PyErr_WriteUnraisable(cb);
+	}
+
+	if (records && i == count) {
+		result = PyObject_CallFunctionObjArgs(cb, records, NULL);
+		Py_XDECREF(result);
+		if (!result)
+			PyErr_WriteUnraisable(cb);
+	}
+	Py_XDECREF(records);
+
+	if (PyErr_Occurred())
+		PyErr_WriteUnraisable(cb);
+	Py_XDECREF(cb);
+	PyErr_Restore(type, value, traceback);
+
+	for (i = 0; i < count; i++)
+		free(batch[i].msg);
+	free(batch);
+
+	return count;
 }
 
-static char
-CryptSetup_HELP[] =
-"CryptSetup object\n\n\
-constructor takes one to four arguments:\n\
-  __init__(device, name, yesDialog, logFunc)\n\n\
-  yesDialog - python function with func(text) signature, \n\
-              which asks the user question text and returns 1\n\
-              of the answer was positive or 0 if not\n\
-  logFunc   - python function with func(level, text) signature to log stuff somewhere";
+/*
+ * A crypt_device context must not be used by two threads at once. The
+ * lock is only ever waited for with the GIL released, so the holder can
+ * still run the callbacks above while others are queued behind it.
+ */
+static int CryptSetup_load_header(CryptSetupObject *self);
 
-static int CryptSetup_init(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static void CryptSetup_unlock_nogil(CryptSetupObject *self);
+
+/*
+ * Returns the header load error, or -ENODEV when close() released the
+ * context while we waited; the lock is not held then.
+ */
+static int CryptSetup_lock_nogil(CryptSetupObject *self)
 {
-	static const char *kwlist[] = {"device", "name", "yesDialog", "logFunc", NULL};
-	PyObject *yesDialogCB = NULL,
-		 *cmdLineLogCB = NULL,
-		 *tmp = NULL;
-	char *device = NULL, *deviceName = NULL;
 	int r;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zzOO", CONST_CAST(char**)kwlist, &device, &deviceName,
-					 &yesDialogCB, &cmdLineLogCB))
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	__atomic_store_n(&self->lock_owner, PyThread_get_thread_ident(), __ATOMIC_RELAXED);
+	r = self->device ? CryptSetup_load_header(self) : -ENODEV;
+	if (r < 0)
+		CryptSetup_unlock_nogil(self);
+
+	return r;
+}
+
+static int CryptSetup_lock(CryptSetupObject *self)
+{
+	long me = PyThread_get_thread_ident();
+	int r = 0;
+
+	if (!self->device) {
+		PyErr_SetString(PyExc_RuntimeError, "Device context is not initialized");
 		return -1;
+	}
 
-	if (device) {
-		if (crypt_init(&(self->device), device)) {
-			PyErr_SetString(PyExc_IOError, "Device cannot be opened");
-			return -1;
-		}
-		/* Try to load header form device */
-		r = crypt_load(self->device, NULL, NULL);
-		if (r && r != -EINVAL) {
-			PyErr_SetString(PyExc_RuntimeError, "Cannot initialize device context");
-			return -1;
-		}
-	} else if (deviceName) {
-		if (crypt_init_by_name(&(self->device), deviceName)) {
-			PyErr_SetString(PyExc_IOError, "Device cannot be opened");
-			return -1;
-		}
-		/* Context is initialized automatically from active device */
-	} else {
-		PyErr_SetString(PyExc_RuntimeError, "Either device file or luks name has to be specified");
+	if (__atomic_load_n(&self->lock_owner, __ATOMIC_RELAXED) == me) {
+		PyErr_SetString(PyExc_RuntimeError, "Device context is already in use by this thread");
 		return -1;
 	}
 
-	if(deviceName)
-		self->activated_as = strdup(deviceName);
+	if (PyThread_acquire_lock(self->lock, NOWAIT_LOCK)) {
+		__atomic_store_n(&self->lock_owner, me, __ATOMIC_RELAXED);
+		/* close() from another thread may have won the race for the lock */
+		if (!self->device) {
+			r = -ENODEV;
+			CryptSetup_unlock_nogil(self);
+		} else if (!self->header_loaded) {
+			Py_BEGIN_ALLOW_THREADS
+			r = CryptSetup_load_header(self);
+			if (r < 0)
+				CryptSetup_unlock_nogil(self);
+			Py_END_ALLOW_THREADS
+		}
+	} else {
+		Py_BEGIN_ALLOW_THREADS
+		r = CryptSetup_lock_nogil(self);
+		Py_END_ALLOW_THREADS
+	}
 
-	if (yesDialogCB) {
-		tmp = self->yesDialogCB;
-		Py_INCREF(yesDialogCB);
-		self->yesDialogCB = yesDialogCB;
-		Py_XDECREF(tmp);
-		crypt_set_confirm_callback(self->device, yesDialog, self);
+	if (r == -ENODEV && !self->device) {
+		PyErr_SetString(PyExc_RuntimeError, "Device context is not initialized");
+		return -1;
 	}
 
-	if (cmdLineLogCB) {
-		tmp = self->cmdLineLogCB;
-		Py_INCREF(cmdLineLogCB);
-		self->cmdLineLogCB = cmdLineLogCB;
-		Py_XDECREF(tmp);
-		crypt_set_log_callback(self->device, cmdLineLog, self);
+	/* same error __init__ raised while it still read the header */
+	if (r < 0) {
+		PyErr_SetString(PyExc_RuntimeError, "Cannot initialize device context");
+		return -1;
 	}
 
 	return 0;
 }
 
-static char
-CryptSetup_activate_HELP[] =
-"Activate LUKS device\n\n\
-  activate(name)";
-
-static PyObject *CryptSetup_activate(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static void CryptSetup_unlock_nogil(CryptSetupObject *self)
 {
-	static const char *kwlist[] = {"name", "passphrase", NULL};
-	char *name = NULL, *passphrase = NULL;
-	int is;
+	self->header_fresh = 0;
+	__atomic_store_n(&self->lock_owner, 0, __ATOMIC_RELAXED);
+	PyThread_release_lock(self->lock);
+}
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|s", CONST_CAST(char**)kwlist, &name, &passphrase))
-		return NULL;
+/* Operation is over, this is when its log messages are delivered. */
+static void CryptSetup_unlock(CryptSetupObject *self)
+{
+	CryptSetup_unlock_nogil(self);
+	CryptSetup_drain_log(self);
+}
 
-	// FIXME: allow keyfile and \0 in passphrase
-	is = crypt_activate_by_passphrase(self->device, name, CRYPT_ANY_SLOT,
-					  passphrase, passphrase ? strlen(passphrase) : 0, 0);
+/* Needs the object lock, the GIL is not required. */
+static void CryptSetup_invalidate(CryptSetupObject *self)
+{
+	self->info_valid = 0;
+	self->pool_clean = 0;
+}
 
-	if (is >= 0) {
-		free(self->activated_as);
-		self->activated_as = strdup(name);
+/*
+ * Pool of idle crypt_device contexts keyed by device path or mapping
+ * name (and detached header). Only contexts of objects that never ran a
+ * mutating method are pooled, so no volume key or half-done change is
+ * handed to the next user. A pooled context is reused only while the
+ * first block of its header device is unchanged; LUKS2 bumps the header
+ * sequence number and LUKS1 rewrites the keyslot table there on every
+ * update.
+ */
+typedef struct {
+	char *key;
+	struct crypt_device *cd;
+	uint64_t generation;
+	int header_loaded;
+} PooledContext;
+
+static struct {
+	pthread_mutex_t mutex;
+	int size;
+	PooledContext *entries;
+	int count;
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned long long stale;
+} context_pool = { PTHREAD_MUTEX_INITIALIZER, 0, NULL, 0, 0, 0, 0 };
+
+/* FNV-1a of the first block of the header device, 0 if unreadable */
+static uint64_t context_generation(struct crypt_device *cd)
+{
+	const char *path = crypt_get_metadata_device_name(cd) ?: crypt_get_device_name(cd);
+	unsigned char block[4096];
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	ssize_t len, i;
+	int fd;
+
+	if (!path)
+		return 0;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	do
+		len = pread(fd, block, sizeof(block), 0);
+	while (len < 0 && errno == EINTR);
+	close(fd);
+
+	if (len <= 0)
+		return 0;
+
+	for (i = 0; i < len; i++) {
+		hash ^= block[i];
+		hash *= 0x100000001b3ULL;
 	}
 
-	return PyObjectResult(is);
+	return hash ?: 1;
 }
 
-static char
-CryptSetup_deactivate_HELP[] =
-"Dectivate LUKS device\n\n\
-  deactivate()";
-
-static PyObject *CryptSetup_deactivate(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static char *context_pool_key(const char *kind, const char *what, const char *header)
 {
-	int is = crypt_deactivate(self->device, self->activated_as);
+	char *key;
 
-	if (!is) {
-		free(self->activated_as);
-		self->activated_as = NULL;
-	}
+	if (asprintf(&key, "%s\t%s\t%s", kind, what, header ?: "") < 0)
+		return NULL;
 
-	return PyObjectResult(is);
+	return key;
 }
 
-static char
-CryptSetup_askyes_HELP[] =
-"Asks a question using the configured dialog CB\n\n\
-  int askyes(message)";
-
-static PyObject *CryptSetup_askyes(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+/* Returns an idle context for key, NULL if there is none or it is stale. */
+static struct crypt_device *context_pool_take(const char *key, int *header_loaded)
 {
-	static const char *kwlist[] = {"message", NULL};
-	PyObject *message = NULL, *result, *arglist;
+	PooledContext e = { NULL };
+	int i;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", CONST_CAST(char**)kwlist, &message))
+	if (!key)
 		return NULL;
 
-	Py_INCREF(message);
+	pthread_mutex_lock(&context_pool.mutex);
+	for (i = context_pool.count - 1; i >= 0; i--)
+		if (!strcmp(context_pool.entries[i].key, key)) {
+			e = context_pool.entries[i];
+			context_pool.entries[i] = context_pool.entries[--context_pool.count];
+			break;
+		}
+	if (!e.cd && context_pool.size)
+		context_pool.misses++;
+	pthread_mutex_unlock(&context_pool.mutex);
 
-	arglist = Py_BuildValue("(O)", message);
-	if (!arglist){
-		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for internal call");
+	if (!e.cd)
+		return NULL;
+
+	free(e.key);
+	if (!e.generation || e.generation != context_generation(e.cd)) {
+		crypt_free(e.cd);
+		pthread_mutex_lock(&context_pool.mutex);
+		context_pool.stale++;
+		pthread_mutex_unlock(&context_pool.mutex);
 		return NULL;
 	}
 
-	result = PyEval_CallObject(self->yesDialogCB, arglist);
-	Py_DECREF(arglist);
-	Py_DECREF(message);
+	pthread_mutex_lock(&context_pool.mutex);
+	context_pool.hits++;
+	pthread_mutex_unlock(&context_pool.mutex);
 
-	return result;
+	*header_loaded = e.header_loaded;
+	return e.cd;
 }
 
-static char
-CryptSetup_log_HELP[] =
-"Logs a string using the configured log CB\n\n\
-  log(int level, message)";
-
-static PyObject *CryptSetup_log(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+/* Takes over cd, frees it when it cannot be pooled. */
+static void context_pool_put(const char *key, struct crypt_device *cd, int header_loaded)
 {
-	static const char *kwlist[] = {"priority", "message", NULL};
-	PyObject *message = NULL, *priority = NULL, *result, *arglist;
-
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO", CONST_CAST(char**)kwlist, &message, &priority))
-		return NULL;
-
-	Py_INCREF(message);
-	Py_INCREF(priority);
-
-	arglist = Py_BuildValue("(OO)", message, priority);
-	if (!arglist){
-		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for internal call");
-		return NULL;
+	PooledContext *entries, e;
+
+	e.key = key ? strdup(key) : NULL;
+	e.cd = cd;
+	e.header_loaded = header_loaded;
+
+	if (e.key && __atomic_load_n(&context_pool.size, __ATOMIC_RELAXED)) {
+		/* back to the defaults, the callbacks point to the old object */
+		crypt_set_confirm_callback(cd, NULL, NULL);
+		crypt_set_log_callback(cd, NULL, NULL);
+		e.generation = context_generation(cd);
+
+		pthread_mutex_lock(&context_pool.mutex);
+		if (e.generation && context_pool.count < context_pool.size) {
+			entries = realloc(context_pool.entries, (context_pool.count + 1) * sizeof(*entries));
+			if (entries) {
+				context_pool.entries = entries;
+				entries[context_pool.count++] = e;
+				e.cd = NULL;
+				e.key = NULL;
+			}
+		}
+		pthread_mutex_unlock(&context_pool.mutex);
 	}
 
-	result = PyEval_CallObject(self->cmdLineLogCB, arglist);
-	Py_DECREF(arglist);
-	Py_DECREF(priority);
-	Py_DECREF(message);
-
-	return result;
+	crypt_free(e.cd);
+	free(e.key);
 }
 
-static char
-CryptSetup_luksUUID_HELP[] =
-"Get UUID of the LUKS device\n\n\
-  luksUUID()";
-
-static PyObject *CryptSetup_luksUUID(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+/* Gives the context back to the pool (or frees it), the object is closed. */
+static void CryptSetup_release_context(CryptSetupObject *self)
 {
-	PyObject *result;
+	struct crypt_device *cd = self->device;
 
-	result = Py_BuildValue("s", crypt_get_uuid(self->device));
-	if (!result)
-		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for return value");
+	self->device = NULL;
+	if (!cd)
+		return;
 
-	return result;
-}
+	if (self->pool_clean)
+		context_pool_put(self->pool_key, cd, self->header_loaded);
+	else
+		crypt_free(cd);
 
-static char
-CryptSetup_isLuks_HELP[] =
-"Is the device LUKS?\n\n\
-  isLuks()";
+	free(self->pool_key);
+	self->pool_key = NULL;
+}
 
-static PyObject *CryptSetup_isLuks(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static int CryptSetup_traverse(CryptSetupObject *self, visitproc visit, void *arg)
 {
-	return PyObjectResult(crypt_load(self->device, CRYPT_LUKS1, NULL));
+	Py_VISIT(self->yesDialogCB);
+	Py_VISIT(self->cmdLineLogCB);
+	Py_VISIT(self->info);
+#ifdef MULTI_PHASE_INIT
+	Py_VISIT(Py_TYPE(self));
+#endif
+	return 0;
+}
+
+/* Only runs for unreachable objects, no job or worker refers to them. */
+static int CryptSetup_clear(CryptSetupObject *self)
+{
+	CryptSetup_set_callback(self, &self->yesDialogCB, NULL);
+	CryptSetup_set_callback(self, &self->cmdLineLogCB, NULL);
+	Py_CLEAR(self->info);
+	return 0;
+}
+
+static void CryptSetup_dealloc(CryptSetupObject* self)
+{
+	PyTypeObject *type = Py_TYPE(self);
+
+	PyObject_GC_UnTrack(self);
+
+	/* free the callbacks */
+	CryptSetup_clear(self);
+	pthread_mutex_destroy(&self->callback_mutex);
+
+	free(self->activated_as);
+
+	Py_BEGIN_ALLOW_THREADS
+	CryptSetup_release_context(self);
+	Py_END_ALLOW_THREADS
+	free(self->pool_key);
+
+	if (self->log) {
+		while (self->log->head != self->log->tail)
+			free(self->log->records[self->log->head++ & (LOG_RING_SIZE - 1)].msg);
+		pthread_mutex_destroy(&self->log->consume);
+		free(self->log);
+	}
+
+	if (self->lock)
+		PyThread_free_lock(self->lock);
+
+	/* free self */
+	type->tp_free((PyObject*)self);
+#ifdef MULTI_PHASE_INIT
+	/* instances of heap types own a reference to it */
+	Py_DECREF(type);
+#endif
+}
+
+static PyObject *CryptSetup_new(PyTypeObject *type, PyObject *args, PyObject *kwds)
+{
+	CryptSetupObject *self = (CryptSetupObject *)type->tp_alloc(type, 0);
+
+	if (self) {
+		pthread_mutex_init(&self->callback_mutex, NULL);
+		self->yesDialogCB = NULL;
+		self->cmdLineLogCB = NULL;
+		self->activated_as = NULL;
+		self->lock_owner = 0;
+		self->info = NULL;
+		self->info_valid = 0;
+		self->log_batch = 0;
+		self->log = calloc(1, sizeof(*self->log));
+		self->lock = PyThread_allocate_lock();
+		if (!self->lock || !self->log) {
+			free(self->log);
+			self->log = NULL;
+			Py_DECREF(self);
+			return PyErr_NoMemory();
+		}
+		pthread_mutex_init(&self->log->consume, NULL);
+		self->log->filter = LOG_LEVEL_ALL;
+#ifdef MULTI_PHASE_INIT
+		self->interp = PyInterpreterState_Get();
+#endif
+	}
+
+	return (PyObject *)self;
+}
+
+/*
+ * Optional latency and error accounting of libcryptsetup calls, updated
+ * with atomics only so it can stay on in production. Latencies go to
+ * log-linear buckets (four per power of two nanoseconds, i.e. within
+ * 19%), which is what the percentiles are computed from. Every call that
+ * touches a device, the keyring or the KDF is timed; getters and setters
+ * of in-memory context state (crypt_get_*, crypt_set_*, keyslot status,
+ * priority and pbkdf queries) are not.
+ */
+#define STAT_OPS(X) \
+	X(INIT,			"crypt_init") \
+	X(INIT_BY_NAME,		"crypt_init_by_name") \
+	X(LOAD,			"crypt_load") \
+	X(FORMAT,		"crypt_format") \
+	X(ACTIVATE_PASSPHRASE,	"crypt_activate_by_passphrase") \
+	X(ACTIVATE_KEYFILE,	"crypt_activate_by_keyfile_offset") \
+	X(ACTIVATE_VOLUME_KEY,	"crypt_activate_by_volume_key") \
+	X(ACTIVATE_KEYRING,	"crypt_activate_by_keyring") \
+	X(ACTIVATE_TOKEN,	"crypt_activate_by_token") \
+	X(DEACTIVATE,		"crypt_deactivate") \
+	X(KEYSLOT_ADD_PASSPHRASE, "crypt_keyslot_add_by_passphrase") \
+	X(KEYSLOT_ADD_KEYFILE,	"crypt_keyslot_add_by_keyfile_offset") \
+	X(KEYSLOT_ADD_VOLUME_KEY, "crypt_keyslot_add_by_volume_key") \
+	X(KEYSLOT_DESTROY,	"crypt_keyslot_destroy") \
+	X(VOLUME_KEY_GET,	"crypt_volume_key_get") \
+	X(RESUME_PASSPHRASE,	"crypt_resume_by_passphrase") \
+	X(RESUME_VOLUME_KEY,	"crypt_resume_by_volume_key") \
+	X(SUSPEND,		"crypt_suspend") \
+	X(STATUS,		"crypt_status") \
+	X(BENCHMARK,		"crypt_benchmark") \
+	X(BENCHMARK_PBKDF,	"crypt_benchmark_pbkdf") \
+	X(HEADER_BACKUP,	"crypt_header_backup") \
+	X(HEADER_RESTORE,	"crypt_header_restore") \
+	X(RESIZE,		"crypt_resize") \
+	X(KEYSLOT_ADD_KEY,	"crypt_keyslot_add_by_key") \
+	X(REENCRYPT_INIT,	"crypt_reencrypt_init_by_passphrase") \
+	X(REENCRYPT_RUN,	"crypt_reencrypt_run") \
+	X(WIPE,			"crypt_wipe") \
+	X(KEYSLOT_CHANGE,	"crypt_keyslot_change_by_passphrase") \
+	X(PERSISTENT_FLAGS_SET,	"crypt_persistent_flags_set") \
+	X(PERSISTENT_FLAGS_GET,	"crypt_persistent_flags_get") \
+	X(TOKEN_KEYRING_SET,	"crypt_token_luks2_keyring_set") \
+	X(TOKEN_ASSIGN_KEYSLOT,	"crypt_token_assign_keyslot") \
+	X(VOLUME_KEY_KEYRING,	"crypt_volume_key_keyring")
+
+#define STAT_ENUM(op, name) STAT_##op,
+#define STAT_NAME(op, name) name,
+
+enum { STAT_OPS(STAT_ENUM) STAT_COUNT };
+
+static const char *stat_names[] = { STAT_OPS(STAT_NAME) };
+
+#define STAT_BUCKETS 252
+#define STAT_ERRNOS 256 /* last one counts everything larger */
+
+/* uint64_t counters only, reset_stats() relies on it */
+typedef struct {
+	uint64_t total_ns;
+	uint64_t max_ns;
+	uint64_t buckets[STAT_BUCKETS];
+	uint64_t errors[STAT_ERRNOS];
+} StatOp;
+
+static int stats_enabled;
+static StatOp stats[STAT_COUNT];
+
+static int stat_bucket(uint64_t ns)
+{
+	int msb;
+
+	if (ns < 4)
+		return ns;
+
+	msb = 63 - __builtin_clzll(ns);
+	return 4 * (msb - 1) + ((ns >> (msb - 2)) & 3);
+}
+
+/* upper bound of a bucket */
+static uint64_t stat_bucket_ns(int bucket)
+{
+	int msb = bucket / 4 + 1;
+
+	if (bucket < 4)
+		return bucket;
+
+	return ((uint64_t)(4 + bucket % 4 + 1) << (msb - 2)) - 1;
+}
+
+static uint64_t stat_now(void)
+{
+	struct timespec ts;
+
+	if (!__atomic_load_n(&stats_enabled, __ATOMIC_RELAXED))
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int stat_record(int op, uint64_t start, int r)
+{
+	StatOp *stat = &stats[op];
+	uint64_t ns, max;
+
+	if (!start)
+		return r;
+
+	ns = stat_now();
+	if (!ns)
+		return r;
+	ns -= start;
+
+	__atomic_fetch_add(&stat->total_ns, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&stat->buckets[stat_bucket(ns)], 1, __ATOMIC_RELAXED);
+	if (r < 0)
+		__atomic_fetch_add(&stat->errors[-r < STAT_ERRNOS ? -r : STAT_ERRNOS - 1], 1, __ATOMIC_RELAXED);
+
+	max = __atomic_load_n(&stat->max_ns, __ATOMIC_RELAXED);
+	while (ns > max && !__atomic_compare_exchange_n(&stat->max_ns, &max, ns, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+
+	return r;
+}
+
+/* Evaluates a libcryptsetup call, accounting it under STAT_<op>. */
+#define TIMED(op, call) ({ uint64_t _start = stat_now(); stat_record(STAT_##op, _start, (call)); })
+
+/*
+ * Needs the object lock. Headers are read on first use, not in __init__;
+ * a failed read is retried by the next call.
+ */
+static int CryptSetup_load_header(CryptSetupObject *self)
+{
+	int r = 0;
+
+	if (self->header_loaded || !self->device)
+		return 0;
+
+	if (!crypt_get_type(self->device)) {
+		r = TIMED(LOAD, crypt_load(self->device, NULL, NULL));
+		self->header_fresh = 1;
+	}
+
+	/* no LUKS header (-EINVAL) is fine, the device may get formatted */
+	if (r < 0 && r != -EINVAL)
+		return r;
+
+	self->header_loaded = 1;
+	return 0;
+}
+
+static PyObject *PyObjectResult(int is)
+{
+	PyObject *result = Py_BuildValue("i", is);
+
+	if (!result)
+		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for return value");
+
+	return result;
+}
+
+/* Raises OSError for a negative errno returned by libcryptsetup. */
+static PyObject *PyObjectError(int r)
+{
+	errno = -r;
+	return PyErr_SetFromErrno(PyExc_OSError);
+}
+
+/*
+ * Arguments and result of one blocking libcryptsetup operation. The same
+ * job is either run inline with the GIL released or handed to the worker
+ * pool by the *_async methods, so parsing and execution are shared.
+ * Strings are copies owned by the job. Secrets are buffers exported by
+ * the caller's objects (bytes, bytearray, mmap, VolumeKey...) and held,
+ * not copied, until the job is freed.
+ */
+typedef struct CryptSetupJob {
+	struct CryptSetupJob *next;
+	int (*run)(struct CryptSetupJob *job);
+	CryptSetupObject *self;
+	int result;
+
+	/* asyncio completion, NULL for synchronous calls */
+	PyObject *loop;
+	PyObject *future;
+	ModuleState *state;
+
+	char *name;
+	char *cipher;
+	char *cipher_mode;
+	Py_buffer passphrase;
+	Py_buffer new_passphrase;
+	char *keyfile;
+	size_t keyfile_size;
+	size_t keyfile_offset;
+	char *new_keyfile;
+	size_t new_keyfile_size;
+	size_t new_keyfile_offset;
+	char *key_description;
+	int keysize;
+	int slot;
+	int token;
+	uint32_t flags;
+	int parallel_slots;
+
+	/* luksFormat */
+	const char *type;
+	uint32_t sector_size;
+	size_t data_alignment;
+	int has_pbkdf;
+	struct crypt_pbkdf_type pbkdf;
+	char *pbkdf_type;
+	char *pbkdf_hash;
+} CryptSetupJob;
+
+typedef int (*CryptSetupJobParser)(CryptSetupJob *job, PyObject *args, PyObject *kwds);
+
+static int job_strdup(char **dst, const char *src)
+{
+	if (!src)
+		return 0;
+
+	*dst = strdup(src);
+	if (!*dst) {
+		PyErr_NoMemory();
+		return -1;
+	}
+
+	return 0;
+}
+
+static int job_size(size_t *dst, Py_ssize_t src, const char *what)
+{
+	if (src < 0) {
+		PyErr_Format(PyExc_ValueError, "%s must not be negative", what);
+		return -1;
+	}
+
+	*dst = src;
+	return 0;
+}
+
+/* Maps user supplied device type names to libcryptsetup ones. */
+static const struct {
+	const char *name;
+	const char *type;
+} crypt_types[] = {
+	{ "luks1", CRYPT_LUKS1 },
+	{ "luks2", CRYPT_LUKS2 },
+	{ "plain", CRYPT_PLAIN },
+	{ "tcrypt", CRYPT_TCRYPT },
+	{ "bitlk", CRYPT_BITLK },
+	{ "integrity", CRYPT_INTEGRITY },
+	{ NULL, NULL }
+};
+
+static const char *job_type(const char *name)
+{
+	int i;
+
+	for (i = 0; crypt_types[i].name; i++)
+		if (!strcasecmp(crypt_types[i].name, name))
+			return crypt_types[i].type;
+
+	PyErr_Format(PyExc_ValueError, "Unknown device type %s", name);
+	return NULL;
+}
+
+static int job_dict_uint32(PyObject *dict, const char *key, uint32_t *value)
+{
+	PyObject *item = PyDict_GetItemString(dict, key);
+	unsigned long v;
+
+	if (!item || item == Py_None)
+		return 0;
+
+	v = PyLong_AsUnsignedLong(item);
+	if (PyErr_Occurred())
+		return -1;
+
+	if (v > UINT32_MAX) {
+		PyErr_Format(PyExc_OverflowError, "%s is too big", key);
+		return -1;
+	}
+
+	*value = v;
+	return 0;
+}
+
+static int job_dict_uint64(PyObject *dict, const char *key, uint64_t *value)
+{
+	PyObject *item = PyDict_GetItemString(dict, key);
+	unsigned long long v;
+
+	if (!item || item == Py_None)
+		return 0;
+
+	v = PyLong_AsUnsignedLongLong(item);
+	if (PyErr_Occurred())
+		return -1;
+
+	*value = v;
+	return 0;
+}
+
+static int job_dict_string(PyObject *dict, const char *key, char **value)
+{
+	PyObject *item = PyDict_GetItemString(dict, key);
+	const char *v;
+
+	if (!item || item == Py_None)
+		return 0;
+
+#if PY_MAJOR_VERSION >= 3
+	v = PyUnicode_AsUTF8(item);
+#else
+	v = PyString_AsString(item);
+#endif
+	if (!v)
+		return -1;
+
+	return job_strdup(value, v);
+}
+
+/*
+ * pbkdf is either a name ("argon2id", "pbkdf2") or a dictionary with the
+ * keys returned by benchmark_pbkdf(): type, hash, time_ms, iterations,
+ * max_memory_kb and parallel_threads. Explicit iterations skip the
+ * benchmark libcryptsetup otherwise runs before writing a keyslot.
+ */
+static int job_pbkdf(CryptSetupJob *job, PyObject *pbkdf)
+{
+	const char *type;
+
+	if (!pbkdf || pbkdf == Py_None)
+		return 0;
+
+	if (PyDict_Check(pbkdf)) {
+		if (job_dict_string(pbkdf, "type", &job->pbkdf_type) ||
+		    job_dict_string(pbkdf, "hash", &job->pbkdf_hash) ||
+		    job_dict_uint32(pbkdf, "time_ms", &job->pbkdf.time_ms) ||
+		    job_dict_uint32(pbkdf, "iterations", &job->pbkdf.iterations) ||
+		    job_dict_uint32(pbkdf, "max_memory_kb", &job->pbkdf.max_memory_kb) ||
+		    job_dict_uint32(pbkdf, "parallel_threads", &job->pbkdf.parallel_threads))
+			return -1;
+	} else {
+#if PY_MAJOR_VERSION >= 3
+		type = PyUnicode_Check(pbkdf) ? PyUnicode_AsUTF8(pbkdf) : NULL;
+#else
+		type = PyString_Check(pbkdf) ? PyString_AsString(pbkdf) : NULL;
+#endif
+		if (!type) {
+			if (!PyErr_Occurred())
+				PyErr_SetString(PyExc_TypeError, "pbkdf must be a string or a dictionary");
+			return -1;
+		}
+		if (job_strdup(&job->pbkdf_type, type))
+			return -1;
+	}
+
+	if (!job->pbkdf_type) {
+		PyErr_SetString(PyExc_ValueError, "pbkdf type has to be specified");
+		return -1;
+	}
+
+	job->pbkdf.type = job->pbkdf_type;
+	job->pbkdf.hash = job->pbkdf_hash ?: "sha256";
+	if (job->pbkdf.iterations)
+		job->pbkdf.flags |= CRYPT_PBKDF_NO_BENCHMARK;
+	job->has_pbkdf = 1;
+
+	return 0;
+}
+
+/* Needs the GIL, the job may hold references to Python objects. */
+static void CryptSetupJob_free(CryptSetupJob *job)
+{
+	free(job->name);
+	free(job->cipher);
+	free(job->cipher_mode);
+	free(job->pbkdf_type);
+	free(job->pbkdf_hash);
+	free(job->keyfile);
+	free(job->new_keyfile);
+	free(job->key_description);
+	PyBuffer_Release(&job->passphrase);
+	PyBuffer_Release(&job->new_passphrase);
+
+	Py_XDECREF(job->loop);
+	Py_XDECREF(job->future);
+	Py_XDECREF(job->self);
+	free(job);
+}
+
+static CryptSetupJob *CryptSetupJob_new(CryptSetupObject *self, PyObject *args, PyObject *kwds,
+					CryptSetupJobParser parse)
+{
+	CryptSetupJob *job;
+
+	if (!self->device) {
+		PyErr_SetString(PyExc_RuntimeError, "Device context is not initialized");
+		return NULL;
+	}
+
+	job = calloc(1, sizeof(*job));
+	if (!job) {
+		PyErr_NoMemory();
+		return NULL;
+	}
+
+	Py_INCREF(self);
+	job->self = self;
+	job->slot = CRYPT_ANY_SLOT;
+	job->token = CRYPT_ANY_TOKEN;
+
+	if (parse(job, args, kwds)) {
+		CryptSetupJob_free(job);
+		return NULL;
+	}
+
+	return job;
+}
+
+/*
+ * Opt-in cache of the last keyslot that opened a device, keyed by header
+ * UUID. Operations called without an explicit slot try the cached one
+ * first and only fall back to CRYPT_ANY_SLOT (one KDF run per active
+ * slot) when it does not match.
+ */
+typedef struct {
+	char uuid[40];
+	int slot;
+} SlotCacheEntry;
+
+static struct {
+	pthread_mutex_t mutex;
+	int enabled;
+	SlotCacheEntry *entries;
+	int count;
+	unsigned long long hits;
+	unsigned long long misses;
+} slot_cache = { PTHREAD_MUTEX_INITIALIZER, 0, NULL, 0, 0, 0 };
+
+/* Needs slot_cache.mutex */
+static SlotCacheEntry *slot_cache_find(const char *uuid)
+{
+	int i;
+
+	for (i = 0; i < slot_cache.count; i++)
+		if (!strcmp(slot_cache.entries[i].uuid, uuid))
+			return &slot_cache.entries[i];
+
+	return NULL;
+}
+
+static int slot_cache_lookup(const char *uuid)
+{
+	SlotCacheEntry *e;
+	int slot = CRYPT_ANY_SLOT;
+
+	pthread_mutex_lock(&slot_cache.mutex);
+	e = slot_cache_find(uuid);
+	if (e)
+		slot = e->slot;
+	pthread_mutex_unlock(&slot_cache.mutex);
+
+	return slot;
+}
+
+static void slot_cache_store(const char *uuid, int slot)
+{
+	SlotCacheEntry *e, *entries;
+
+	pthread_mutex_lock(&slot_cache.mutex);
+	e = slot_cache_find(uuid);
+	if (!e) {
+		/* the cache is only an optimization, just skip it when out of memory */
+		entries = realloc(slot_cache.entries, (slot_cache.count + 1) * sizeof(*entries));
+		if (entries) {
+			slot_cache.entries = entries;
+			e = &entries[slot_cache.count++];
+			snprintf(e->uuid, sizeof(e->uuid), "%s", uuid);
+		}
+	}
+	if (e)
+		e->slot = slot;
+	pthread_mutex_unlock(&slot_cache.mutex);
+}
+
+static void slot_cache_forget(const char *uuid, int slot)
+{
+	SlotCacheEntry *e;
+
+	pthread_mutex_lock(&slot_cache.mutex);
+	e = slot_cache_find(uuid);
+	if (e && e->slot == slot)
+		*e = slot_cache.entries[--slot_cache.count];
+	pthread_mutex_unlock(&slot_cache.mutex);
+}
+
+static void slot_cache_count(int hit)
+{
+	pthread_mutex_lock(&slot_cache.mutex);
+	if (hit)
+		slot_cache.hits++;
+	else
+		slot_cache.misses++;
+	pthread_mutex_unlock(&slot_cache.mutex);
+}
+
+/*
+ * Opt-in persistent cache of PBKDF calibrations. libcryptsetup benchmarks
+ * the KDF before every keyslot it writes; with the cache enabled the
+ * first calibration per (CPU model, KDF, hash, target time, memory,
+ * threads, key size) is stored in a small text file and later operations
+ * pass the cached costs with CRYPT_PBKDF_NO_BENCHMARK. Entries expire
+ * after max_age seconds, other CPU models never match.
+ */
+#define PBKDF_CACHE_MAX_AGE (30 * 24 * 3600)
+
+typedef struct {
+	char cpu[128];
+	char type[16];
+	char hash[32];
+	uint32_t time_ms;
+	uint32_t max_memory_kb;
+	uint32_t parallel_threads;
+	uint32_t key_size;
+	/* calibrated costs */
+	uint32_t iterations;
+	uint32_t memory_kb;
+	uint32_t threads;
+	long long created;
+} PbkdfCacheEntry;
+
+static struct {
+	pthread_mutex_t mutex;
+	/* held across a calibration, lookups only take mutex */
+	pthread_mutex_t calibrate;
+	char *path;
+	long long max_age;
+	char cpu[128];
+	PbkdfCacheEntry *entries;
+	int count;
+	unsigned long long hits;
+	unsigned long long misses;
+} pbkdf_cache = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_MUTEX_INITIALIZER, NULL, PBKDF_CACHE_MAX_AGE, "", NULL, 0, 0, 0 };
+
+/* "model name x online CPUs", argon2 costs depend on both */
+static void pbkdf_cache_cpu(char *cpu, size_t size)
+{
+	char line[256], *value, *end;
+	FILE *f;
+
+	snprintf(cpu, size, "unknown");
+
+	f = fopen("/proc/cpuinfo", "re");
+	if (f) {
+		while (fgets(line, sizeof(line), f)) {
+			value = strchr(line, ':');
+			if (!value || (strncmp(line, "model name", 10) && strncmp(line, "cpu model", 9) &&
+				       strncmp(line, "Processor", 9)))
+				continue;
+			for (value++; *value == ' '; value++);
+			end = value + strcspn(value, "\t\n");
+			*end = '\0';
+			if (*value) {
+				snprintf(cpu, size, "%s", value);
+				break;
+			}
+		}
+		fclose(f);
+	}
+
+	snprintf(cpu + strlen(cpu), size - strlen(cpu), " x %ld", sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+/* Needs pbkdf_cache.mutex */
+static void pbkdf_cache_read(void)
+{
+	PbkdfCacheEntry e, *entries;
+	char line[512];
+	FILE *f;
+
+	f = fopen(pbkdf_cache.path, "re");
+	if (!f)
+		return;
+
+	while (fgets(line, sizeof(line), f)) {
+		memset(&e, 0, sizeof(e));
+		if (sscanf(line, "%127[^\t]\t%15[^\t]\t%31[^\t]\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%lld",
+			   e.cpu, e.type, e.hash, &e.time_ms, &e.max_memory_kb, &e.parallel_threads,
+			   &e.key_size, &e.iterations, &e.memory_kb, &e.threads, &e.created) != 11)
+			continue;
+
+		entries = realloc(pbkdf_cache.entries, (pbkdf_cache.count + 1) * sizeof(*entries));
+		if (!entries)
+			break;
+		pbkdf_cache.entries = entries;
+		entries[pbkdf_cache.count++] = e;
+	}
+
+	fclose(f);
+}
+
+/* Needs pbkdf_cache.mutex, replaces the file atomically */
+static int pbkdf_cache_write(void)
+{
+	PbkdfCacheEntry *e;
+	char *tmp;
+	FILE *f;
+	int i, r = 0;
+
+	if (asprintf(&tmp, "%s.%d.tmp", pbkdf_cache.path, (int)getpid()) < 0)
+		return -ENOMEM;
+
+	f = fopen(tmp, "we");
+	if (!f) {
+		r = -errno;
+		free(tmp);
+		return r;
+	}
+
+	for (i = 0; i < pbkdf_cache.count; i++) {
+		e = &pbkdf_cache.entries[i];
+		fprintf(f, "%s\t%s\t%s\t%u\t%u\t%u\t%u\t%u\t%u\t%u\t%lld\n",
+			e->cpu, e->type, e->hash, e->time_ms, e->max_memory_kb, e->parallel_threads,
+			e->key_size, e->iterations, e->memory_kb, e->threads, e->created);
+	}
+
+	if (fclose(f) || rename(tmp, pbkdf_cache.path))
+		r = -errno;
+	if (r)
+		unlink(tmp);
+	free(tmp);
+
+	return r;
+}
+
+/* Needs pbkdf_cache.mutex */
+static PbkdfCacheEntry *pbkdf_cache_find(const PbkdfCacheEntry *key, long long now)
+{
+	PbkdfCacheEntry *e;
+	int i;
+
+	for (i = 0; i < pbkdf_cache.count; i++) {
+		e = &pbkdf_cache.entries[i];
+		if (!strcmp(e->cpu, key->cpu) && !strcmp(e->type, key->type) &&
+		    !strcmp(e->hash, key->hash) && e->time_ms == key->time_ms &&
+		    e->max_memory_kb == key->max_memory_kb &&
+		    e->parallel_threads == key->parallel_threads &&
+		    e->key_size == key->key_size) {
+			if (now - e->created <= pbkdf_cache.max_age)
+				return e;
+			/* expired, drop it so it gets recalibrated */
+			*e = pbkdf_cache.entries[--pbkdf_cache.count];
+			return NULL;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Sets calibrated PBKDF costs on the context before a keyslot is written.
+ * type is the device type when no header is loaded yet (luksFormat). Any
+ * failure just leaves libcryptsetup to calibrate on its own.
+ */
+static void pbkdf_cache_apply(CryptSetupObject *self, const char *type, size_t key_size)
+{
+	struct crypt_device *cd = self->device;
+	const struct crypt_pbkdf_type *current;
+	struct crypt_pbkdf_type pbkdf;
+	PbkdfCacheEntry key, found, *e, *entries;
+	long long now = time(NULL);
+	int hit = 0;
+
+	if (!__atomic_load_n(&pbkdf_cache.path, __ATOMIC_RELAXED))
+		return;
+
+	current = crypt_get_pbkdf_type(cd);
+	if (!current)
+		current = crypt_get_pbkdf_default(type ?: crypt_get_type(cd));
+	if (!current || !current->type || (current->flags & CRYPT_PBKDF_NO_BENCHMARK))
+		return;
+
+	/* current points into cd, which crypt_set_pbkdf_type() frees */
+	memset(&key, 0, sizeof(key));
+	snprintf(key.type, sizeof(key.type), "%s", current->type);
+	snprintf(key.hash, sizeof(key.hash), "%s", current->hash ?: "");
+	key.time_ms = current->time_ms;
+	key.max_memory_kb = current->max_memory_kb;
+	key.parallel_threads = current->parallel_threads;
+	key.key_size = key_size;
+	/* the defaults do not know about iterationTime() */
+	if (!crypt_get_pbkdf_type(cd) && self->iteration_time)
+		key.time_ms = self->iteration_time;
+
+	pthread_mutex_lock(&pbkdf_cache.mutex);
+	if (!pbkdf_cache.path) {
+		pthread_mutex_unlock(&pbkdf_cache.mutex);
+		return;
+	}
+	snprintf(key.cpu, sizeof(key.cpu), "%s", pbkdf_cache.cpu);
+
+	e = pbkdf_cache_find(&key, now);
+	if (e) {
+		pbkdf_cache.hits++;
+		found = *e;
+		hit = 1;
+	} else
+		pbkdf_cache.misses++;
+	pthread_mutex_unlock(&pbkdf_cache.mutex);
+
+	if (!hit) {
+		/* calibrations run one at a time, parallel ones skew each other */
+		pthread_mutex_lock(&pbkdf_cache.calibrate);
+
+		/* someone else may have calibrated the same while we waited */
+		pthread_mutex_lock(&pbkdf_cache.mutex);
+		e = pbkdf_cache_find(&key, now);
+		if (e) {
+			found = *e;
+			hit = 1;
+		}
+		pthread_mutex_unlock(&pbkdf_cache.mutex);
+
+		if (!hit) {
+			memset(&pbkdf, 0, sizeof(pbkdf));
+			pbkdf.type = key.type;
+			pbkdf.hash = key.hash;
+			pbkdf.time_ms = key.time_ms;
+			pbkdf.max_memory_kb = key.max_memory_kb;
+			pbkdf.parallel_threads = key.parallel_threads;
+			if (TIMED(BENCHMARK_PBKDF, crypt_benchmark_pbkdf(cd, &pbkdf, "foobarfo", 8,
+					"0123456789abcdef0123456789abcdef", 32, key_size, NULL, NULL)) >= 0) {
+				key.iterations = pbkdf.iterations;
+				key.memory_kb = pbkdf.max_memory_kb;
+				key.threads = pbkdf.parallel_threads;
+				key.created = now;
+				found = key;
+				hit = 1;
+
+				pthread_mutex_lock(&pbkdf_cache.mutex);
+				entries = pbkdf_cache.path ?
+					realloc(pbkdf_cache.entries, (pbkdf_cache.count + 1) * sizeof(*entries)) : NULL;
+				if (entries) {
+					pbkdf_cache.entries = entries;
+					entries[pbkdf_cache.count++] = key;
+					pbkdf_cache_write();
+				}
+				pthread_mutex_unlock(&pbkdf_cache.mutex);
+			}
+		}
+
+		pthread_mutex_unlock(&pbkdf_cache.calibrate);
+	}
+
+	if (!hit)
+		return;
+
+	memset(&pbkdf, 0, sizeof(pbkdf));
+	pbkdf.type = found.type;
+	pbkdf.hash = found.hash;
+	pbkdf.time_ms = found.time_ms;
+	pbkdf.iterations = found.iterations;
+	pbkdf.max_memory_kb = found.memory_kb;
+	pbkdf.parallel_threads = found.threads;
+	pbkdf.flags = CRYPT_PBKDF_NO_BENCHMARK;
+	crypt_set_pbkdf_type(cd, &pbkdf);
+}
+
+/*
+ * Parallel keyslot trial. Without a slot libcryptsetup runs the KDF of
+ * every active keyslot one after another; here each native thread opens
+ * its own context on the header and checks the passphrase against one
+ * candidate slot at a time. Threads stop picking candidates once one
+ * matched. A KDF already running cannot be interrupted, so the trial
+ * returns when the checks in flight are done, about one KDF time.
+ */
+typedef struct {
+	pthread_mutex_t mutex;
+	const char *header;
+	const char *type;
+	const char *passphrase;
+	size_t passphrase_len;
+	int *slots;
+	int count;
+	int next;
+	int found;
+	int error;
+} SlotTrial;
+
+static void *slot_trial_worker(void *arg)
+{
+	SlotTrial *trial = arg;
+	struct crypt_device *cd = NULL;
+	int i, r;
+
+	r = TIMED(INIT, crypt_init(&cd, trial->header));
+	if (!r)
+		r = TIMED(LOAD, crypt_load(cd, trial->type, NULL));
+
+	for (;;) {
+		pthread_mutex_lock(&trial->mutex);
+		if (r < 0 && r != -EPERM && r != -ENOENT)
+			trial->error = r;
+		if (r < 0 || trial->found != CRYPT_ANY_SLOT || trial->next >= trial->count) {
+			pthread_mutex_unlock(&trial->mutex);
+			break;
+		}
+		i = trial->next++;
+		pthread_mutex_unlock(&trial->mutex);
+
+		r = TIMED(ACTIVATE_PASSPHRASE, crypt_activate_by_passphrase(cd, NULL, trial->slots[i],
+				trial->passphrase, trial->passphrase_len, 0));
+
+		pthread_mutex_lock(&trial->mutex);
+		if (r >= 0 && trial->found == CRYPT_ANY_SLOT)
+			trial->found = r;
+		pthread_mutex_unlock(&trial->mutex);
+
+		/* a wrong passphrase for this slot is no reason to stop */
+		if (r == -EPERM || r == -ENOENT)
+			r = 0;
+	}
+
+	crypt_free(cd);
+	return NULL;
+}
+
+/*
+ * Returns the keyslot the passphrase of job opens, -EPERM if none does,
+ * or CRYPT_ANY_SLOT when a parallel trial is not worth it or not possible
+ * and the caller should let libcryptsetup try the slots itself.
+ */
+static int CryptSetupJob_trial_slots(CryptSetupJob *job)
+{
+	struct crypt_device *cd = job->self->device;
+	SlotTrial trial = { PTHREAD_MUTEX_INITIALIZER };
+	pthread_t *threads;
+	crypt_keyslot_info status;
+	int i, n, workers, started = 0;
+
+	trial.type = crypt_get_type(cd);
+	trial.header = crypt_get_metadata_device_name(cd) ?: crypt_get_device_name(cd);
+	if (!trial.type || !trial.header || !job->passphrase.buf || job->key_description)
+		return CRYPT_ANY_SLOT;
+
+	n = crypt_keyslot_max(trial.type);
+	trial.slots = n > 0 ? calloc(n, sizeof(*trial.slots)) : NULL;
+	if (!trial.slots)
+		return CRYPT_ANY_SLOT;
+
+	/* the same candidates CRYPT_ANY_SLOT would try */
+	for (i = 0; i < n; i++) {
+		status = crypt_keyslot_status(cd, i);
+		if ((status == CRYPT_SLOT_ACTIVE || status == CRYPT_SLOT_ACTIVE_LAST) &&
+		    crypt_keyslot_get_priority(cd, i) != CRYPT_SLOT_PRIORITY_IGNORE)
+			trial.slots[trial.count++] = i;
+	}
+
+	workers = sysconf(_SC_NPROCESSORS_ONLN);
+	if (workers > trial.count)
+		workers = trial.count;
+
+	threads = workers > 1 ? calloc(workers, sizeof(*threads)) : NULL;
+	if (!threads) {
+		free(trial.slots);
+		return CRYPT_ANY_SLOT;
+	}
+
+	trial.passphrase = job->passphrase.buf;
+	trial.passphrase_len = job->passphrase.len;
+	trial.found = CRYPT_ANY_SLOT;
+
+	for (started = 0; started < workers; started++)
+		if (pthread_create(&threads[started], NULL, slot_trial_worker, &trial))
+			break;
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+	free(trial.slots);
+
+	if (!started)
+		return CRYPT_ANY_SLOT;
+	if (trial.found != CRYPT_ANY_SLOT)
+		return trial.found;
+	/* could not check every slot, let libcryptsetup decide */
+	if (trial.error || trial.next < trial.count)
+		return CRYPT_ANY_SLOT;
+
+	return -EPERM;
+}
+
+/*
+ * Runs try_slot with the slot requested by the caller or, without one,
+ * with the cached slot first. Returns the result of try_slot, which is
+ * the keyslot used on success.
+ */
+static int CryptSetupJob_run_slot(CryptSetupJob *job, int (*try_slot)(CryptSetupJob *job, int slot))
+{
+	const char *uuid = NULL;
+	int slot = CRYPT_ANY_SLOT, r;
+
+	if (job->slot != CRYPT_ANY_SLOT)
+		return try_slot(job, job->slot);
+
+	if (__atomic_load_n(&slot_cache.enabled, __ATOMIC_RELAXED))
+		uuid = crypt_get_uuid(job->self->device);
+
+	if (uuid)
+		slot = slot_cache_lookup(uuid);
+
+	if (slot != CRYPT_ANY_SLOT) {
+		r = try_slot(job, slot);
+		/* anything but a wrong or stale slot is final */
+		if (r >= 0 || (r != -EPERM && r != -ENOENT && r != -EINVAL)) {
+			slot_cache_count(r >= 0);
+			return r;
+		}
+	}
+
+	if (uuid)
+		slot_cache_count(0);
+
+	if (job->parallel_slots) {
+		slot = CryptSetupJob_trial_slots(job);
+		if (slot < 0 && slot != CRYPT_ANY_SLOT)
+			return slot;
+	} else
+		slot = CRYPT_ANY_SLOT;
+
+	r = try_slot(job, slot);
+	if (r >= 0 && uuid)
+		slot_cache_store(uuid, r);
+
+	return r;
+}
+
+static PyObject *CryptSetup_execute(CryptSetupObject *self, PyObject *args, PyObject *kwds,
+				    CryptSetupJobParser parse)
+{
+	CryptSetupJob *job;
+	int is;
+
+	job = CryptSetupJob_new(self, args, kwds, parse);
+	if (!job)
+		return NULL;
+
+	if (CryptSetup_lock(self)) {
+		CryptSetupJob_free(job);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = job->run(job);
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+	CryptSetupJob_free(job);
+
+	return PyObjectResult(is);
+}
+
+/*
+ * Native worker pool for the *_async methods. Workers are plain pthreads
+ * started on demand up to pool.max_threads; they never hold the GIL while
+ * libcryptsetup runs and only take it to post the result back to the
+ * event loop with call_soon_threadsafe. Jobs of all interpreters share
+ * the pool, a worker attaches to the interpreter of the job it ran.
+ *
+ * At exit each interpreter drains its jobs (see pool_drain()), the
+ * workers stop once no interpreter uses the pool any more.
+ */
+static struct {
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	/* signalled when a job of a closing interpreter or a worker is done */
+	pthread_cond_t done;
+	CryptSetupJob *head, *tail;
+	int queued;
+	int threads;
+	int idle;
+	int max_threads;
+	int users;
+	int stopping;
+} pool = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+	   NULL, NULL, 0, 0, 0, 0, 0, 0 };
+
+/* Nothing can be posted to a closed loop, nobody awaits its futures. */
+static int CryptSetupJob_loop_open(CryptSetupJob *job)
+{
+	PyObject *closed = PyObject_CallMethod(job->loop, CONST_CAST(char*)"is_closed", NULL);
+	int open = closed == Py_False;
+
+	if (!closed)
+		PyErr_WriteUnraisable(job->loop);
+	Py_XDECREF(closed);
+
+	return open;
+}
+
+static void CryptSetupJob_complete(CryptSetupJob *job)
+{
+	PyObject *result;
+
+	if (!CryptSetupJob_loop_open(job))
+		return;
+
+	result = PyObject_CallMethod(job->loop, CONST_CAST(char*)"call_soon_threadsafe",
+				     CONST_CAST(char*)"OOi", job->state->complete_cb, job->future, job->result);
+	if (!result)
+		PyErr_WriteUnraisable(job->future);
+	Py_XDECREF(result);
+}
+
+/* The job never ran, its future is cancelled from the loop's thread. */
+static void CryptSetupJob_cancel(CryptSetupJob *job)
+{
+	PyObject *cancel, *result;
+
+	if (!CryptSetupJob_loop_open(job))
+		return;
+
+	cancel = PyObject_GetAttrString(job->future, "cancel");
+	result = cancel ? PyObject_CallMethod(job->loop, CONST_CAST(char*)"call_soon_threadsafe",
+					      CONST_CAST(char*)"O", cancel) : NULL;
+	if (!result)
+		PyErr_WriteUnraisable(job->future);
+	Py_XDECREF(result);
+	Py_XDECREF(cancel);
+}
+
+static void *pool_worker(void *unused)
+{
+	CryptSetupJob *job;
+	ModuleState *state;
+	CallbackState cbstate;
+
+	pthread_mutex_lock(&pool.mutex);
+	for (;;) {
+		while (!pool.head && pool.threads <= pool.max_threads && !pool.stopping) {
+			pool.idle++;
+			pthread_cond_wait(&pool.cond, &pool.mutex);
+			pool.idle--;
+		}
+
+		/* pool was shrunk or is shut down */
+		if (pool.threads > pool.max_threads || !pool.head)
+			break;
+
+		job = pool.head;
+		pool.head = job->next;
+		if (!pool.head)
+			pool.tail = NULL;
+		pool.queued--;
+		pthread_mutex_unlock(&pool.mutex);
+
+		job->result = CryptSetup_lock_nogil(job->self);
+		if (!job->result) {
+			job->result = job->run(job);
+			CryptSetup_invalidate(job->self);
+			CryptSetup_unlock_nogil(job->self);
+		}
+
+		state = job->state;
+		callback_enter(&cbstate, CALLBACK_INTERP(job->self));
+		CryptSetup_drain_log(job->self);
+		CryptSetupJob_complete(job);
+		CryptSetupJob_free(job);
+		callback_leave(&cbstate);
+
+		/* the interpreter may go away once its count drops to zero */
+		pthread_mutex_lock(&pool.mutex);
+		if (!--state->jobs && state->closing)
+			pthread_cond_broadcast(&pool.done);
+	}
+	pool.threads--;
+	if (pool.stopping)
+		pthread_cond_broadcast(&pool.done);
+	pthread_mutex_unlock(&pool.mutex);
+
+	return NULL;
+}
+
+static int pool_default_size(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return n > 0 ? (int)n : 1;
+}
+
+static int pool_push(CryptSetupJob *job)
+{
+	pthread_attr_t attr;
+	pthread_t thread;
+	int r = 0;
+
+	pthread_mutex_lock(&pool.mutex);
+	if (job->state->closing) {
+		pthread_mutex_unlock(&pool.mutex);
+		return -ESHUTDOWN;
+	}
+
+	if (!pool.max_threads)
+		pool.max_threads = pool_default_size();
+
+	/* idle workers that were signalled may not have picked their job yet */
+	if (pool.queued >= pool.idle && pool.threads < pool.max_threads) {
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		r = pthread_create(&thread, &attr, pool_worker, NULL);
+		pthread_attr_destroy(&attr);
+		if (!r)
+			pool.threads++;
+		else if (pool.threads)
+			r = 0; /* running workers will get to it */
+	}
+
+	if (!r) {
+		job->next = NULL;
+		if (pool.tail)
+			pool.tail->next = job;
+		else
+			pool.head = job;
+		pool.tail = job;
+		pool.queued++;
+		job->state->jobs++;
+		pthread_cond_signal(&pool.cond);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+
+	return -r;
+}
+
+#if PY_MAJOR_VERSION >= 3
+static PyObject *pool_complete(PyObject *unused, PyObject *args)
+{
+	PyObject *future, *value, *cancelled;
+
+	if (!PyArg_ParseTuple(args, "OO", &future, &value))
+		return NULL;
+
+	cancelled = PyObject_CallMethod(future, "cancelled", NULL);
+	if (!cancelled)
+		return NULL;
+
+	if (cancelled == Py_False) {
+		Py_DECREF(cancelled);
+		return PyObject_CallMethod(future, "set_result", "O", value);
+	}
+
+	Py_DECREF(cancelled);
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef pool_complete_def = {
+	"_complete", (PyCFunction)pool_complete, METH_VARARGS, NULL
+};
+
+static PyObject *CryptSetup_submit(CryptSetupObject *self, PyObject *args, PyObject *kwds,
+				   CryptSetupJobParser parse)
+{
+	CryptSetupJob *job;
+	PyObject *asyncio, *future;
+	int r;
+
+	job = CryptSetupJob_new(self, args, kwds, parse);
+	if (!job)
+		return NULL;
+
+	asyncio = PyImport_ImportModule("asyncio");
+	if (!asyncio)
+		goto err;
+
+	if (PyObject_HasAttrString(asyncio, "get_running_loop"))
+		job->loop = PyObject_CallMethod(asyncio, "get_running_loop", NULL);
+	else
+		job->loop = PyObject_CallMethod(asyncio, "get_event_loop", NULL);
+	Py_DECREF(asyncio);
+	if (!job->loop)
+		goto err;
+
+	job->future = PyObject_CallMethod(job->loop, "create_future", NULL);
+	if (!job->future)
+		goto err;
+
+	future = job->future;
+	Py_INCREF(future);
+
+	job->state = module_state(self);
+	r = pool_push(job);
+	if (r == -ESHUTDOWN) {
+		Py_DECREF(future);
+		PyErr_SetString(PyExc_RuntimeError, "Worker pool is shut down");
+		goto err;
+	} else if (r) {
+		Py_DECREF(future);
+		PyObjectError(r);
+		goto err;
+	}
+
+	return future;
+err:
+	CryptSetupJob_free(job);
+	return NULL;
+}
+
+/* A module instance starts using the pool. */
+static void pool_attach(ModuleState *state)
+{
+	pthread_mutex_lock(&pool.mutex);
+	state->closing = 0;
+	pool.users++;
+	pool.stopping = 0;
+	pthread_mutex_unlock(&pool.mutex);
+}
+
+/*
+ * Registered with atexit, so it runs before the interpreter is finalized
+ * and workers can still attach to it: refuses new jobs of the module,
+ * cancels its queued ones and waits for the running ones to post their
+ * result. The last user also stops the workers.
+ */
+static PyObject *pool_drain(PyObject *m, PyObject *unused)
+{
+	ModuleState *state = pycryptsetup_state(m);
+	CryptSetupJob *job, **link, *cancelled = NULL;
+
+	pthread_mutex_lock(&pool.mutex);
+	if (state->closing) {
+		pthread_mutex_unlock(&pool.mutex);
+		Py_RETURN_NONE;
+	}
+	state->closing = 1;
+
+	for (link = &pool.head; (job = *link); ) {
+		if (job->state != state) {
+			pool.tail = job;
+			link = &job->next;
+			continue;
+		}
+		*link = job->next;
+		job->next = cancelled;
+		cancelled = job;
+		pool.queued--;
+		state->jobs--;
+	}
+	if (!pool.head)
+		pool.tail = NULL;
+	pthread_mutex_unlock(&pool.mutex);
+
+	while ((job = cancelled)) {
+		cancelled = job->next;
+		CryptSetupJob_cancel(job);
+		CryptSetupJob_free(job);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&pool.mutex);
+	while (state->jobs)
+		pthread_cond_wait(&pool.done, &pool.mutex);
+
+	if (!--pool.users) {
+		pool.stopping = 1;
+		pthread_cond_broadcast(&pool.cond);
+		while (pool.threads)
+			pthread_cond_wait(&pool.done, &pool.mutex);
+	}
+	pthread_mutex_unlock(&pool.mutex);
+	Py_END_ALLOW_THREADS
+
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef pool_drain_def = {
+	"_drain", (PyCFunction)pool_drain, METH_NOARGS, NULL
+};
+
+static int pool_register_drain(PyObject *m)
+{
+	PyObject *atexit, *drain, *result = NULL;
+
+	atexit = PyImport_ImportModule("atexit");
+	if (!atexit)
+		return -1;
+
+	drain = PyCFunction_NewEx(&pool_drain_def, m, NULL);
+	if (drain)
+		result = PyObject_CallMethod(atexit, "register", "O", drain);
+
+	Py_XDECREF(drain);
+	Py_DECREF(atexit);
+	if (!result)
+		return -1;
+
+	Py_DECREF(result);
+	pool_attach(pycryptsetup_state(m));
+	return 0;
+}
+#endif
+
+/*
+ * Volume key handed out by getVolumeKey(). The key lives in memory locked
+ * against swapping and is wiped when the object goes away (or on wipe()),
+ * it is only reachable through the read-only buffer protocol.
+ *
+ * Every key gets its own anonymous mapping: mlock() and munlock() work on
+ * whole pages, so a key sharing a page with other data would be unlocked
+ * along with it, and the pages can be kept out of core dumps.
+ */
+typedef struct {
+	PyObject_HEAD
+
+	char *key;
+	size_t key_len;
+	size_t map_len;
+	int exports;
+	char locked;
+} VolumeKeyObject;
+
+static VolumeKeyObject *VolumeKey_alloc(PyTypeObject *type, size_t key_len)
+{
+	VolumeKeyObject *self = PyObject_New(VolumeKeyObject, type);
+	long page = sysconf(_SC_PAGESIZE);
+	void *map;
+
+	if (!self)
+		return NULL;
+
+	if (page <= 0)
+		page = 4096;
+
+	self->key = NULL;
+	self->key_len = 0;
+	self->exports = 0;
+	self->locked = 0;
+	self->map_len = ((key_len ?: 1) + page - 1) / page * page;
+
+	map = mmap(NULL, self->map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		self->map_len = 0;
+		Py_DECREF(self);
+		return (VolumeKeyObject *)PyErr_NoMemory();
+	}
+
+	self->key = map;
+	self->key_len = key_len;
+#ifdef MADV_DONTDUMP
+	madvise(map, self->map_len, MADV_DONTDUMP);
+#endif
+	/* best effort, unprivileged processes may be over RLIMIT_MEMLOCK */
+	self->locked = !mlock(map, self->map_len);
+
+	return self;
+}
+
+static void VolumeKey_wipe_key(VolumeKeyObject *self)
+{
+	if (!self->key)
+		return;
+
+	crypt_safe_memzero(self->key, self->map_len);
+	if (self->locked)
+		munlock(self->key, self->map_len);
+	munmap(self->key, self->map_len);
+	self->key = NULL;
+	self->key_len = 0;
+	self->map_len = 0;
+	self->locked = 0;
+}
+
+static void VolumeKey_dealloc(VolumeKeyObject *self)
+{
+	PyTypeObject *type = Py_TYPE(self);
+
+	VolumeKey_wipe_key(self);
+	type->tp_free((PyObject *)self);
+#ifdef MULTI_PHASE_INIT
+	Py_DECREF(type);
+#endif
+}
+
+/*
+ * Without the GIL buffers can be exported while another thread wipes the key,
+ * exports is -1 for the duration of the wipe and blocks new exports.
+ */
+static int VolumeKey_getbuffer(VolumeKeyObject *self, Py_buffer *view, int flags)
+{
+	int exports = __atomic_load_n(&self->exports, __ATOMIC_RELAXED);
+	int r;
+
+	do {
+		if (exports < 0)
+			goto wiped;
+	} while (!__atomic_compare_exchange_n(&self->exports, &exports, exports + 1, 1,
+					      __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	if (!self->key) {
+		__atomic_fetch_sub(&self->exports, 1, __ATOMIC_RELEASE);
+		goto wiped;
+	}
+
+	r = PyBuffer_FillInfo(view, (PyObject *)self, self->key, self->key_len, 1, flags);
+	if (r)
+		__atomic_fetch_sub(&self->exports, 1, __ATOMIC_RELEASE);
+
+	return r;
+wiped:
+	PyErr_SetString(PyExc_ValueError, "Volume key has been wiped");
+	view->obj = NULL;
+	return -1;
+}
+
+static void VolumeKey_releasebuffer(VolumeKeyObject *self, Py_buffer *view)
+{
+	__atomic_fetch_sub(&self->exports, 1, __ATOMIC_RELEASE);
+}
+
+static Py_ssize_t VolumeKey_length(VolumeKeyObject *self)
+{
+	return self->key_len;
+}
+
+static char
+VolumeKey_wipe_HELP[] =
+"Wipe the key now instead of when the object is released\n\n\
+  wipe()";
+
+static PyObject *VolumeKey_wipe(VolumeKeyObject *self, PyObject *args)
+{
+	int exports = 0;
+
+	if (!__atomic_compare_exchange_n(&self->exports, &exports, -1, 0,
+					 __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+		/* another thread is wiping it right now */
+		if (exports < 0)
+			Py_RETURN_NONE;
+		PyErr_SetString(PyExc_BufferError, "Volume key is still in use by a buffer");
+		return NULL;
+	}
+
+	VolumeKey_wipe_key(self);
+	__atomic_store_n(&self->exports, 0, __ATOMIC_RELEASE);
+
+	Py_RETURN_NONE;
+}
+
+static PyMethodDef VolumeKey_methods[] = {
+	{"wipe", (PyCFunction)VolumeKey_wipe, METH_NOARGS, VolumeKey_wipe_HELP},
+	{NULL} /* Sentinel */
+};
+
+static PyMemberDef VolumeKey_members[] = {
+	{CONST_CAST(char*)"locked", T_BOOL, offsetof(VolumeKeyObject, locked), READONLY, CONST_CAST(char*)"whether mlock() kept the key out of swap"},
+	{NULL}
+};
+
+#ifndef MULTI_PHASE_INIT
+static PySequenceMethods VolumeKey_as_sequence = {
+	(lenfunc)VolumeKey_length, /* sq_length */
+};
+
+static PyBufferProcs VolumeKey_as_buffer = {
+#if PY_MAJOR_VERSION < 3
+	0, /* bf_getreadbuffer */
+	0, /* bf_getwritebuffer */
+	0, /* bf_getsegcount */
+	0, /* bf_getcharbuffer */
+#endif
+	(getbufferproc)VolumeKey_getbuffer, /* bf_getbuffer */
+	(releasebufferproc)VolumeKey_releasebuffer, /* bf_releasebuffer */
+};
+#endif
+
+static char
+VolumeKey_HELP[] =
+"Volume key returned by CryptSetup.getVolumeKey()\n\n\
+  Kept in locked memory and wiped on release, readable through\n\
+  the buffer protocol (bytes(key), memoryview(key)). locked is False\n\
+  when mlock() failed, e.g. over RLIMIT_MEMLOCK, and the key may be\n\
+  swapped out.";
+
+#ifdef MULTI_PHASE_INIT
+static PyType_Slot VolumeKey_slots[] = {
+	{Py_tp_dealloc, (void *)VolumeKey_dealloc},
+	{Py_tp_doc, VolumeKey_HELP},
+	{Py_tp_methods, VolumeKey_methods},
+	{Py_tp_members, VolumeKey_members},
+	{Py_sq_length, (void *)VolumeKey_length},
+	{Py_bf_getbuffer, (void *)VolumeKey_getbuffer},
+	{Py_bf_releasebuffer, (void *)VolumeKey_releasebuffer},
+	{0, NULL}
+};
+
+static PyType_Spec VolumeKey_spec = {
+	"pycryptsetup.VolumeKey",
+	sizeof(VolumeKeyObject),
+	0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_DISALLOW_INSTANTIATION,
+	VolumeKey_slots
+};
+#else
+static PyTypeObject VolumeKeyType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"pycryptsetup.VolumeKey", /*tp_name*/
+	sizeof(VolumeKeyObject), /*tp_basicsize*/
+	0, /*tp_itemsize*/
+	(destructor)VolumeKey_dealloc, /*tp_dealloc*/
+	0, /*tp_print*/
+	0, /*tp_getattr*/
+	0, /*tp_setattr*/
+	0, /*tp_compare*/
+	0, /*tp_repr*/
+	0, /*tp_as_number*/
+	&VolumeKey_as_sequence, /*tp_as_sequence*/
+	0, /*tp_as_mapping*/
+	0, /*tp_hash */
+	0, /*tp_call*/
+	0, /*tp_str*/
+	0, /*tp_getattro*/
+	0, /*tp_setattro*/
+	&VolumeKey_as_buffer, /*tp_as_buffer*/
+#if PY_MAJOR_VERSION < 3
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_NEWBUFFER, /*tp_flags*/
+#else
+	Py_TPFLAGS_DEFAULT, /*tp_flags*/
+#endif
+	VolumeKey_HELP, /* tp_doc */
+	0, /* tp_traverse */
+	0, /* tp_clear */
+	0, /* tp_richcompare */
+	0, /* tp_weaklistoffset */
+	0, /* tp_iter */
+	0, /* tp_iternext */
+	VolumeKey_methods, /* tp_methods */
+	VolumeKey_members, /* tp_members */
+};
+#endif
+
+static char
+CryptSetup_HELP[] =
+"CryptSetup object\n\n\
+constructor takes one to six arguments:\n\
+  __init__(device, name, yesDialog, logFunc, logBatch, header)\n\n\
+  yesDialog - python function with func(text) signature, \n\
+              which asks the user question text and returns 1\n\
+              of the answer was positive or 0 if not\n\
+  logFunc   - python function with func(level, text) signature to log stuff somewhere,\n\
+              called when an operation returns or on drainLog()\n\
+  logBatch  - call logFunc once per batch with a list of\n\
+              (level, timestamp, text) tuples instead\n\
+  header    - detached LUKS header (file or device), device is then\n\
+              the data device only and metadata operations touch\n\
+              just the header\n\n\
+The header is read on first use. Objects are context managers, leaving\n\
+the with block calls close().";
+
+static int CryptSetup_init(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"device", "name", "yesDialog", "logFunc", "logBatch", "header", NULL};
+	PyObject *yesDialogCB = NULL,
+		 *cmdLineLogCB = NULL;
+	char *device = NULL, *deviceName = NULL, *header = NULL;
+	int r;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zzOOiz", CONST_CAST(char**)kwlist, &device, &deviceName,
+					 &yesDialogCB, &cmdLineLogCB, &self->log_batch, &header))
+		return -1;
+
+	if (self->device) {
+		PyErr_SetString(PyExc_RuntimeError, "Device context is already initialized");
+		return -1;
+	}
+
+	if (device || deviceName) {
+		self->pool_key = device ? context_pool_key("device", device, header) :
+					  context_pool_key("name", deviceName, header);
+		self->pool_clean = 1;
+	}
+
+	if (device) {
+		Py_BEGIN_ALLOW_THREADS
+		self->device = context_pool_take(self->pool_key, &self->header_loaded);
+		/* the header itself is loaded on first use */
+		if (self->device)
+			r = 0;
+		else if (header)
+			r = TIMED(INIT, crypt_init_data_device(&(self->device), header, device));
+		else
+			r = TIMED(INIT, crypt_init(&(self->device), device));
+		Py_END_ALLOW_THREADS
+		if (!self->device) {
+			PyErr_SetString(PyExc_IOError, "Device cannot be opened");
+			return -1;
+		}
+		if (r) {
+			PyErr_SetString(PyExc_RuntimeError, "Cannot initialize device context");
+			return -1;
+		}
+	} else if (deviceName) {
+		Py_BEGIN_ALLOW_THREADS
+		self->device = context_pool_take(self->pool_key, &self->header_loaded);
+		if (self->device)
+			r = 0;
+		else if (header)
+			r = TIMED(INIT_BY_NAME, crypt_init_by_name_and_header(&(self->device), deviceName, header));
+		else
+			r = TIMED(INIT_BY_NAME, crypt_init_by_name(&(self->device), deviceName));
+		/* crypt_init_by_name() loads the header of the active device */
+		self->header_loaded = 1;
+		Py_END_ALLOW_THREADS
+		if (r) {
+			PyErr_SetString(PyExc_IOError, "Device cannot be opened");
+			return -1;
+		}
+		/* Context is initialized automatically from active device */
+	} else {
+		PyErr_SetString(PyExc_RuntimeError, "Either device file or luks name has to be specified");
+		return -1;
+	}
+
+	if(deviceName)
+		self->activated_as = strdup(deviceName);
+
+	if (yesDialogCB) {
+		CryptSetup_set_callback(self, &self->yesDialogCB, yesDialogCB);
+		crypt_set_confirm_callback(self->device, yesDialog, self);
+	}
+
+	if (cmdLineLogCB) {
+		CryptSetup_set_callback(self, &self->cmdLineLogCB, cmdLineLogCB);
+		crypt_set_log_callback(self->device, cmdLineLog, self);
+	}
+
+	return 0;
+}
+
+static char
+CryptSetup_activate_HELP[] =
+"Activate LUKS device\n\n\
+  activate(name, passphrase, slot, flags, keyDescription, parallel_slots)\n\n\
+  passphrase - string or bytes-like object, used without copying\n\
+  slot - which slot to try (optional, default is all active slots)\n\
+  flags - CRYPT_ACTIVATE_* flags, e.g. CRYPT_ACTIVATE_ALLOW_DISCARDS\n\
+  keyDescription - description of a kernel keyring user key holding\n\
+                   the passphrase, used instead of passphrase\n\
+  parallel_slots - without slot, check the passphrase against all\n\
+                   active keyslots concurrently on separate threads";
+
+static int CryptSetup_activate_slot(CryptSetupJob *job, int slot)
+{
+	if (job->key_description)
+		return TIMED(ACTIVATE_KEYRING, crypt_activate_by_keyring(job->self->device, job->name,
+						 job->key_description, slot, job->flags));
+
+	return TIMED(ACTIVATE_PASSPHRASE, crypt_activate_by_passphrase(job->self->device, job->name, slot,
+					    job->passphrase.buf, job->passphrase.len, job->flags));
+}
+
+static int CryptSetup_activate_run(CryptSetupJob *job)
+{
+	CryptSetupObject *self = job->self;
+	int is;
+
+	is = CryptSetupJob_run_slot(job, CryptSetup_activate_slot);
+
+	if (is >= 0) {
+		free(self->activated_as);
+		self->activated_as = strdup(job->name);
+	}
+
+	return is;
+}
+
+static int CryptSetup_activate_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"name", "passphrase", "slot", "flags", "keyDescription",
+				       "parallel_slots", NULL};
+	char *name = NULL, *key_description = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|z*iIzi", CONST_CAST(char**)kwlist, &name, &job->passphrase,
+					 &job->slot, &job->flags, &key_description, &job->parallel_slots))
+		return -1;
+
+	if (key_description && job->passphrase.buf) {
+		PyErr_SetString(PyExc_ValueError, "Only one of passphrase and keyDescription can be specified");
+		return -1;
+	}
+
+	job->run = CryptSetup_activate_run;
+	if (job_strdup(&job->name, name) ||
+	    job_strdup(&job->key_description, key_description))
+		return -1;
+
+	return 0;
+}
+
+static PyObject *CryptSetup_activate(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_activate_parse);
+}
+
+static char
+CryptSetup_activateByKeyfile_HELP[] =
+"Activate LUKS device using keyfile\n\n\
+  activateByKeyfile(name, keyfile, keyfileSize, keyfileOffset, slot, flags)\n\n\
+  keyfile - path to the keyfile, read by libcryptsetup directly\n\
+  keyfileSize - number of bytes to read, 0 for the whole file\n\
+  keyfileOffset - number of bytes to skip at the start of the file\n\
+  slot - which slot to try (optional, default is all active slots)\n\
+  flags - CRYPT_ACTIVATE_* flags (optional)";
+
+static int CryptSetup_activateByKeyfile_slot(CryptSetupJob *job, int slot)
+{
+	return TIMED(ACTIVATE_KEYFILE, crypt_activate_by_keyfile_offset(job->self->device, job->name, slot,
+						job->keyfile, job->keyfile_size, job->keyfile_offset, job->flags));
+}
+
+static int CryptSetup_activateByKeyfile_run(CryptSetupJob *job)
+{
+	CryptSetupObject *self = job->self;
+	int is;
+
+	is = CryptSetupJob_run_slot(job, CryptSetup_activateByKeyfile_slot);
+
+	if (is >= 0) {
+		free(self->activated_as);
+		self->activated_as = strdup(job->name);
+	}
+
+	return is;
+}
+
+static int CryptSetup_activateByKeyfile_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"name", "keyfile", "keyfileSize", "keyfileOffset", "slot", "flags", NULL};
+	char *name = NULL, *keyfile = NULL;
+	Py_ssize_t keyfile_size = 0, keyfile_offset = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|nniI", CONST_CAST(char**)kwlist, &name, &keyfile,
+					 &keyfile_size, &keyfile_offset, &job->slot, &job->flags))
+		return -1;
+
+	job->run = CryptSetup_activateByKeyfile_run;
+	if (job_strdup(&job->name, name) ||
+	    job_strdup(&job->keyfile, keyfile) ||
+	    job_size(&job->keyfile_size, keyfile_size, "keyfileSize") ||
+	    job_size(&job->keyfile_offset, keyfile_offset, "keyfileOffset"))
+		return -1;
+
+	return 0;
+}
+
+static PyObject *CryptSetup_activateByKeyfile(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_activateByKeyfile_parse);
+}
+
+static char
+CryptSetup_activateByToken_HELP[] =
+"Activate LUKS2 device using a token, e.g. a kernel keyring token\n\n\
+  activateByToken(name, token, flags)\n\n\
+  token - which token to use (optional, default is all tokens)\n\
+  flags - CRYPT_ACTIVATE_* flags (optional)";
+
+static int CryptSetup_activateByToken_run(CryptSetupJob *job)
+{
+	CryptSetupObject *self = job->self;
+	int is;
+
+	is = TIMED(ACTIVATE_TOKEN, crypt_activate_by_token(self->device, job->name, job->token, NULL, job->flags));
+
+	if (is >= 0) {
+		free(self->activated_as);
+		self->activated_as = strdup(job->name);
+	}
+
+	return is;
+}
+
+static int CryptSetup_activateByToken_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"name", "token", "flags", NULL};
+	char *name = NULL;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|iI", CONST_CAST(char**)kwlist, &name,
+					 &job->token, &job->flags))
+		return -1;
+
+	job->run = CryptSetup_activateByToken_run;
+	return job_strdup(&job->name, name);
+}
+
+static PyObject *CryptSetup_activateByToken(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_activateByToken_parse);
+}
+
+static char
+CryptSetup_addKeyringToken_HELP[] =
+"Add LUKS2 kernel keyring token for a keyslot\n\n\
+  addKeyringToken(keyDescription, slot, token)\n\n\
+  keyDescription - description of the kernel keyring user key\n\
+                   holding the passphrase of the keyslot\n\
+  slot - keyslot the token unlocks\n\
+  token - which token to use (optional)\n\n\
+  returns the token id";
+
+static PyObject *CryptSetup_addKeyringToken(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"keyDescription", "slot", "token", NULL};
+	struct crypt_token_params_luks2_keyring params;
+	char *key_description = NULL;
+	int slot, token = CRYPT_ANY_TOKEN, is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "si|i", CONST_CAST(char**)kwlist,
+					 &key_description, &slot, &token))
+		return NULL;
+
+	params.key_description = key_description;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(TOKEN_KEYRING_SET, crypt_token_luks2_keyring_set(self->device, token, &params));
+	if (is >= 0) {
+		token = is;
+		is = TIMED(TOKEN_ASSIGN_KEYSLOT, crypt_token_assign_keyslot(self->device, token, slot));
+	}
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is < 0 ? is : token);
+}
+
+static char
+CryptSetup_volumeKeyKeyring_HELP[] =
+"Enable or disable loading volume keys via the kernel keyring\n\n\
+  volumeKeyKeyring(enable)\n\n\
+  enable - pass the volume key to dm-crypt through the kernel keyring\n\
+           instead of the device-mapper table (LUKS2 default)";
+
+static PyObject *CryptSetup_volumeKeyKeyring(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"enable", NULL};
+	int enable = 0, is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &enable))
+		return NULL;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	is = TIMED(VOLUME_KEY_KEYRING, crypt_volume_key_keyring(self->device, enable));
+	/* like iterationTime(), a pooled context must not carry it over */
+	self->pool_clean = 0;
+
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_deactivate_HELP[] =
+"Dectivate LUKS device\n\n\
+  deactivate()";
+
+static PyObject *CryptSetup_deactivate(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	int is;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(DEACTIVATE, crypt_deactivate(self->device, self->activated_as));
+	Py_END_ALLOW_THREADS
+
+	if (!is) {
+		free(self->activated_as);
+		self->activated_as = NULL;
+	}
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_askyes_HELP[] =
+"Asks a question using the configured dialog CB\n\n\
+  int askyes(message)";
+
+static PyObject *CryptSetup_askyes(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"message", NULL};
+	PyObject *message = NULL, *result, *arglist, *cb;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", CONST_CAST(char**)kwlist, &message))
+		return NULL;
+
+	cb = CryptSetup_get_callback(self, &self->yesDialogCB);
+	if (!cb) {
+		PyErr_SetString(PyExc_RuntimeError, "No dialog callback set");
+		return NULL;
+	}
+
+	Py_INCREF(message);
+
+	arglist = Py_BuildValue("(O)", message);
+	if (!arglist){
+		Py_DECREF(message);
+		Py_DECREF(cb);
+		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for internal call");
+		return NULL;
+	}
+
+	result = PyEval_CallObject(cb, arglist);
+	Py_DECREF(arglist);
+	Py_DECREF(message);
+	Py_DECREF(cb);
+
+	return result;
+}
+
+static char
+CryptSetup_log_HELP[] =
+"Logs a string using the configured log CB\n\n\
+  log(int level, message)";
+
+static PyObject *CryptSetup_log(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"priority", "message", NULL};
+	PyObject *message = NULL, *priority = NULL, *result, *arglist, *cb;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "OO", CONST_CAST(char**)kwlist, &message, &priority))
+		return NULL;
+
+	cb = CryptSetup_get_callback(self, &self->cmdLineLogCB);
+	if (!cb) {
+		PyErr_SetString(PyExc_RuntimeError, "No log callback set");
+		return NULL;
+	}
+
+	Py_INCREF(message);
+	Py_INCREF(priority);
+
+	arglist = Py_BuildValue("(OO)", message, priority);
+	if (!arglist){
+		Py_DECREF(priority);
+		Py_DECREF(message);
+		Py_DECREF(cb);
+		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for internal call");
+		return NULL;
+	}
+
+	result = PyEval_CallObject(cb, arglist);
+	Py_DECREF(arglist);
+	Py_DECREF(priority);
+	Py_DECREF(message);
+	Py_DECREF(cb);
+
+	return result;
+}
+
+static char
+CryptSetup_drainLog_HELP[] =
+"Deliver queued log messages to the log callback now\n\n\
+  drainLog()\n\n\
+  returns the number of messages delivered";
+
+static PyObject *CryptSetup_drainLog(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return PyLong_FromSsize_t(CryptSetup_drain_log(self));
+}
+
+static char
+CryptSetup_setLogFilter_HELP[] =
+"Select log levels queued for the log callback\n\n\
+  setLogFilter(levels)\n\n\
+  levels - sequence of CRYPT_LOG_* levels to keep, None for all;\n\
+           other messages are dropped without calling into Python";
+
+static PyObject *CryptSetup_setLogFilter(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"levels", NULL};
+	PyObject *levels = NULL, *seq;
+	unsigned int filter = 0;
+	Py_ssize_t i;
+	long level;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O", CONST_CAST(char**)kwlist, &levels))
+		return NULL;
+
+	if (levels == Py_None)
+		filter = LOG_LEVEL_ALL;
+	else {
+		seq = PySequence_Fast(levels, "levels must be a sequence");
+		if (!seq)
+			return NULL;
+
+		for (i = 0; i < PySequence_Fast_GET_SIZE(seq); i++) {
+			level = PyInt_AsLong(PySequence_Fast_GET_ITEM(seq, i));
+			if (level == -1 && PyErr_Occurred()) {
+				Py_DECREF(seq);
+				return NULL;
+			}
+			if (level < -2 || level > 29) {
+				Py_DECREF(seq);
+				PyErr_SetString(PyExc_ValueError, "Invalid log level");
+				return NULL;
+			}
+			filter |= LOG_LEVEL_BIT(level);
+		}
+		Py_DECREF(seq);
+	}
+
+	__atomic_store_n(&self->log->filter, filter, __ATOMIC_RELAXED);
+
+	Py_RETURN_NONE;
+}
+
+static char
+CryptSetup_luksUUID_HELP[] =
+"Get UUID of the LUKS device\n\n\
+  luksUUID()";
+
+static PyObject *CryptSetup_luksUUID(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	PyObject *result;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	result = Py_BuildValue("s", crypt_get_uuid(self->device));
+	if (!result)
+		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for return value");
+
+	CryptSetup_unlock(self);
+
+	return result;
+}
+
+static char
+CryptSetup_isLuks_HELP[] =
+"Is the device LUKS?\n\n\
+  isLuks()\n\n\
+  answered from the loaded header, the device is only read\n\
+  when no header has been loaded yet";
+
+static int CryptSetup_is_luks(CryptSetupObject *self)
+{
+	const char *type = crypt_get_type(self->device);
+
+	return type && (!strcmp(type, CRYPT_LUKS1) || !strcmp(type, CRYPT_LUKS2));
+}
+
+static PyObject *CryptSetup_isLuks(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	int is = 0;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	/* the lazy load may just have probed every type, no need to read again */
+	if (!CryptSetup_is_luks(self) && self->header_fresh)
+		is = -EINVAL;
+	else if (!CryptSetup_is_luks(self)) {
+		Py_BEGIN_ALLOW_THREADS
+		is = TIMED(LOAD, crypt_load(self->device, CRYPT_LUKS, NULL));
+		Py_END_ALLOW_THREADS
+		CryptSetup_invalidate(self);
+	}
+
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+/*
+ * Device types with an on-disk signature, checked by probe() against
+ * the first block of the metadata device. TCRYPT headers are encrypted
+ * and PLAIN has no header, those cannot be recognized.
+ */
+#define PROBE_SIZE 4096
+
+static const struct {
+	const char *type;
+	size_t offset;
+	const char *magic;
+	size_t magic_len;
+	int version;
+} crypt_signatures[] = {
+	{ CRYPT_LUKS1,		0, "LUKS\xba\xbe", 6, 1 },
+	{ CRYPT_LUKS2,		0, "LUKS\xba\xbe", 6, 2 },
+	{ CRYPT_BITLK,		3, "-FVE-FS-", 8, 0 },
+	{ CRYPT_INTEGRITY,	0, "integrt", 8, 0 },
+	{ NULL }
+};
+
+static const char *crypt_probe(struct crypt_device *cd, int *error)
+{
+	const char *path = crypt_get_metadata_device_name(cd) ?: crypt_get_device_name(cd);
+	unsigned char block[PROBE_SIZE];
+	ssize_t len;
+	int fd, i, version;
+
+	*error = 0;
+	if (!path) {
+		*error = -EINVAL;
+		return NULL;
+	}
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		*error = -errno;
+		return NULL;
+	}
+
+	do
+		len = pread(fd, block, sizeof(block), 0);
+	while (len < 0 && errno == EINTR);
+	if (len < 0)
+		*error = -errno;
+	close(fd);
+
+	for (i = 0; len > 0 && crypt_signatures[i].type; i++) {
+		if (crypt_signatures[i].offset + crypt_signatures[i].magic_len > (size_t)len ||
+		    memcmp(block + crypt_signatures[i].offset, crypt_signatures[i].magic,
+			   crypt_signatures[i].magic_len))
+			continue;
+
+		/* LUKS version is a big endian 16-bit number after the magic */
+		version = (block[6] << 8) | block[7];
+		if (!crypt_signatures[i].version || crypt_signatures[i].version == version)
+			return crypt_signatures[i].type;
+	}
+
+	return NULL;
+}
+
+static char
+CryptSetup_probe_HELP[] =
+"Detect device type from its on-disk signature\n\n\
+  probe()\n\n\
+  reads the first block of the header device once and returns\n\
+  CRYPT_LUKS1, CRYPT_LUKS2, CRYPT_BITLK, CRYPT_INTEGRITY or None;\n\
+  TCRYPT and PLAIN devices have no signature";
+
+static PyObject *CryptSetup_probe(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	const char *type;
+	int error;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	type = crypt_probe(self->device, &error);
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_unlock(self);
+
+	if (error < 0)
+		return PyObjectError(error);
+
+	return Py_BuildValue("z", type);
+}
+
+/* Parameters of load(), strings and buffers are owned by the struct. */
+typedef struct {
+	const char *type;
+	void *params;
+	struct crypt_params_tcrypt tcrypt;
+	struct crypt_params_integrity integrity;
+	Py_buffer passphrase;
+	char **keyfiles;
+	unsigned int keyfiles_count;
+	char *hash;
+	char *cipher;
+	char *mode;
+	char *integrity_alg;
+	char *journal_integrity;
+	char *journal_crypt;
+} LoadParams;
+
+static void load_params_free(LoadParams *lp)
+{
+	unsigned int i;
+
+	for (i = 0; i < lp->keyfiles_count; i++)
+		free(lp->keyfiles[i]);
+	free(lp->keyfiles);
+	free(lp->hash);
+	free(lp->cipher);
+	free(lp->mode);
+	free(lp->integrity_alg);
+	free(lp->journal_integrity);
+	free(lp->journal_crypt);
+	PyBuffer_Release(&lp->passphrase);
+}
+
+static int load_params_tcrypt(LoadParams *lp, PyObject *dict)
+{
+	PyObject *item, *seq;
+	Py_ssize_t i, n;
+	const char *keyfile;
+
+	item = PyDict_GetItemString(dict, "passphrase");
+	if (item && item != Py_None && !PyArg_Parse(item, "s*", &lp->passphrase))
+		return -1;
+
+	item = PyDict_GetItemString(dict, "keyfiles");
+	if (item && item != Py_None) {
+		seq = PySequence_Fast(item, "keyfiles must be a sequence");
+		if (!seq)
+			return -1;
+
+		n = PySequence_Fast_GET_SIZE(seq);
+		lp->keyfiles = calloc(n ?: 1, sizeof(*lp->keyfiles));
+		if (!lp->keyfiles) {
+			Py_DECREF(seq);
+			PyErr_NoMemory();
+			return -1;
+		}
+
+		for (i = 0; i < n; i++) {
+			if (!PyArg_Parse(PySequence_Fast_GET_ITEM(seq, i), "s;keyfile must be a path", &keyfile) ||
+			    job_strdup(&lp->keyfiles[i], keyfile)) {
+				Py_DECREF(seq);
+				return -1;
+			}
+			lp->keyfiles_count++;
+		}
+		Py_DECREF(seq);
+	}
+
+	if (job_dict_string(dict, "hash", &lp->hash) ||
+	    job_dict_string(dict, "cipher", &lp->cipher) ||
+	    job_dict_string(dict, "mode", &lp->mode) ||
+	    job_dict_uint32(dict, "flags", &lp->tcrypt.flags) ||
+	    job_dict_uint32(dict, "veracrypt_pim", &lp->tcrypt.veracrypt_pim))
+		return -1;
+
+	lp->tcrypt.passphrase = lp->passphrase.buf;
+	lp->tcrypt.passphrase_size = lp->passphrase.len;
+	lp->tcrypt.keyfiles = CONST_CAST(const char **)lp->keyfiles;
+	lp->tcrypt.keyfiles_count = lp->keyfiles_count;
+	lp->tcrypt.hash_name = lp->hash;
+	lp->tcrypt.cipher = lp->cipher;
+	lp->tcrypt.mode = lp->mode;
+	lp->params = &lp->tcrypt;
+
+	return 0;
+}
+
+static int load_params_integrity(LoadParams *lp, PyObject *dict)
+{
+	if (job_dict_string(dict, "integrity", &lp->integrity_alg) ||
+	    job_dict_string(dict, "journal_integrity", &lp->journal_integrity) ||
+	    job_dict_string(dict, "journal_crypt", &lp->journal_crypt) ||
+	    job_dict_uint64(dict, "journal_size", &lp->integrity.journal_size) ||
+	    job_dict_uint32(dict, "journal_watermark", &lp->integrity.journal_watermark) ||
+	    job_dict_uint32(dict, "journal_commit_time", &lp->integrity.journal_commit_time) ||
+	    job_dict_uint32(dict, "interleave_sectors", &lp->integrity.interleave_sectors) ||
+	    job_dict_uint32(dict, "tag_size", &lp->integrity.tag_size) ||
+	    job_dict_uint32(dict, "sector_size", &lp->integrity.sector_size) ||
+	    job_dict_uint32(dict, "buffer_sectors", &lp->integrity.buffer_sectors))
+		return -1;
+
+	lp->integrity.integrity = lp->integrity_alg;
+	lp->integrity.journal_integrity = lp->journal_integrity;
+	lp->integrity.journal_crypt = lp->journal_crypt;
+	lp->params = &lp->integrity;
+
+	return 0;
+}
+
+static char
+CryptSetup_load_HELP[] =
+"Load device header\n\n\
+  load(type, params)\n\n\
+  type   - luks1, luks2, tcrypt, bitlk or integrity; default is the\n\
+           type found by probe(), falling back to any LUKS version\n\
+  params - dictionary with type specific parameters:\n\
+           tcrypt: passphrase, keyfiles, hash, cipher, mode, flags\n\
+                   (CRYPT_TCRYPT_*), veracrypt_pim\n\
+           integrity: integrity, tag_size, sector_size, journal_size,\n\
+                   journal_watermark, journal_commit_time,\n\
+                   interleave_sectors, buffer_sectors,\n\
+                   journal_integrity, journal_crypt\n\n\
+  BITLK devices are then activated by activate(), TCRYPT and INTEGRITY\n\
+  ones by activateByVolumeKey(name, None)";
+
+static PyObject *CryptSetup_load(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"type", "params", NULL};
+	PyObject *params = NULL;
+	LoadParams lp;
+	char *type = NULL;
+	int is = 0;
+
+	memset(&lp, 0, sizeof(lp));
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zO", CONST_CAST(char**)kwlist, &type, &params))
+		return NULL;
+
+	if (params == Py_None)
+		params = NULL;
+
+	if (params && !PyDict_Check(params)) {
+		PyErr_SetString(PyExc_TypeError, "params must be a dictionary");
+		return NULL;
+	}
+
+	if (type) {
+		lp.type = job_type(type);
+		if (!lp.type)
+			return NULL;
+
+		if (!strcmp(lp.type, CRYPT_PLAIN)) {
+			PyErr_SetString(PyExc_ValueError, "PLAIN devices have no header, use setupPlain()");
+			return NULL;
+		}
+	}
+
+	if (lp.type && params && !strcmp(lp.type, CRYPT_TCRYPT))
+		is = load_params_tcrypt(&lp, params);
+	else if (lp.type && params && !strcmp(lp.type, CRYPT_INTEGRITY))
+		is = load_params_integrity(&lp, params);
+	else if (params) {
+		PyErr_SetString(PyExc_ValueError, "params are supported for tcrypt and integrity only");
+		return NULL;
+	}
+
+	if (is || CryptSetup_lock(self)) {
+		load_params_free(&lp);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	if (!lp.type)
+		lp.type = crypt_probe(self->device, &is);
+	is = TIMED(LOAD, crypt_load(self->device, lp.type, lp.params));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+	load_params_free(&lp);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_setupPlain_HELP[] =
+"Set up context for a PLAIN dm-crypt device, nothing is written\n\n\
+  setupPlain(cipher = 'aes', cipherMode = 'cbc-essiv:sha256', keysize = 256,\n\
+             hash = 'ripemd160', offset = 0, skip = 0, size = 0, sectorSize = 0)\n\n\
+  hash - passphrase hash, e.g. sha256, ripemd160 or plain\n\
+  offset, skip, size - data offset, IV offset and size in 512-byte sectors\n\
+  sectorSize - encryption sector size in bytes, 0 for 512\n\n\
+  the device is then activated by activate(name, passphrase)";
+
+static PyObject *CryptSetup_setupPlain(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"cipher", "cipherMode", "keysize", "hash", "offset",
+				       "skip", "size", "sectorSize", NULL};
+	struct crypt_params_plain params = { .hash = "ripemd160" };
+	char *cipher = NULL, *cipher_mode = NULL;
+	unsigned long long offset = 0, skip = 0, size = 0;
+	unsigned int sector_size = 0;
+	int keysize = 256, is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zzizKKKI", CONST_CAST(char**)kwlist,
+					 &cipher, &cipher_mode, &keysize, &params.hash,
+					 &offset, &skip, &size, &sector_size))
+		return NULL;
+
+	if (keysize <= 0 || keysize % 8) {
+		PyErr_SetString(PyExc_TypeError, "keysize must be positive number dividable by 8");
+		return NULL;
+	}
+
+	params.offset = offset;
+	params.skip = skip;
+	params.size = size;
+	params.sector_size = sector_size;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(FORMAT, crypt_format(self->device, CRYPT_PLAIN, cipher ?: "aes",
+			    cipher_mode ?: "cbc-essiv:sha256", NULL, NULL, keysize / 8, &params));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+static PyStructSequence_Field Info_fields[] = {
+	{CONST_CAST(char*)"dir", CONST_CAST(char*)"device-mapper directory"},
+	{CONST_CAST(char*)"device", CONST_CAST(char*)"underlying device"},
+	{CONST_CAST(char*)"name", CONST_CAST(char*)"active mapping name or None"},
+	{CONST_CAST(char*)"uuid", CONST_CAST(char*)"header UUID"},
+	{CONST_CAST(char*)"type", CONST_CAST(char*)"device type, e.g. LUKS1, LUKS2"},
+	{CONST_CAST(char*)"cipher", CONST_CAST(char*)"cipher"},
+	{CONST_CAST(char*)"cipher_mode", CONST_CAST(char*)"cipher mode"},
+	{CONST_CAST(char*)"keysize", CONST_CAST(char*)"volume key size in bits"},
+	{CONST_CAST(char*)"offset", CONST_CAST(char*)"data offset in 512-byte sectors"},
+	{CONST_CAST(char*)"sector_size", CONST_CAST(char*)"encryption sector size in bytes"},
+	{CONST_CAST(char*)"size", CONST_CAST(char*)"active size in 512-byte sectors or None"},
+	{CONST_CAST(char*)"iv_offset", CONST_CAST(char*)"active IV offset or None"},
+	{CONST_CAST(char*)"flags", CONST_CAST(char*)"active CRYPT_ACTIVATE_* flags or None"},
+	{CONST_CAST(char*)"readonly", CONST_CAST(char*)"active read-only"},
+	{CONST_CAST(char*)"discards", CONST_CAST(char*)"active with discards allowed"},
+	{CONST_CAST(char*)"keyslots", CONST_CAST(char*)"tuple of CRYPT_SLOT_* states"},
+	{CONST_CAST(char*)"header", CONST_CAST(char*)"detached header device or None"},
+	{NULL}
+};
+
+static PyStructSequence_Desc Info_desc = {
+	CONST_CAST(char*)"pycryptsetup.Info",
+	CONST_CAST(char*)"Information about an opened device, see CryptSetup.info()",
+	Info_fields,
+	17
+};
+
+#ifndef MULTI_PHASE_INIT
+static PyTypeObject InfoType;
+#endif
+
+static PyObject *CryptSetup_build_info(CryptSetupObject *self)
+{
+	struct crypt_active_device cad;
+	PyObject *info, *keyslots;
+	const char *type = crypt_get_type(self->device);
+	const char *header = crypt_get_metadata_device_name(self->device);
+	int i, n = type ? crypt_keyslot_max(type) : 0, active = 0;
+
+	/* same as the data device unless the header is detached */
+	if (header && crypt_get_device_name(self->device) &&
+	    !strcmp(header, crypt_get_device_name(self->device)))
+		header = NULL;
+
+	if (self->activated_as)
+		active = !crypt_get_active_device(self->device, self->activated_as, &cad);
+
+	keyslots = PyTuple_New(n > 0 ? n : 0);
+	if (!keyslots)
+		return NULL;
+
+	for (i = 0; i < n; i++)
+		PyTuple_SET_ITEM(keyslots, i, Py_BuildValue("i", crypt_keyslot_status(self->device, i)));
+
+	info = PyStructSequence_New(module_state(self)->InfoType);
+	if (!info) {
+		Py_DECREF(keyslots);
+		return NULL;
+	}
+
+	PyStructSequence_SET_ITEM(info, 0, Py_BuildValue("s", crypt_get_dir()));
+	PyStructSequence_SET_ITEM(info, 1, Py_BuildValue("z", crypt_get_device_name(self->device)));
+	PyStructSequence_SET_ITEM(info, 2, Py_BuildValue("z", self->activated_as));
+	PyStructSequence_SET_ITEM(info, 3, Py_BuildValue("z", crypt_get_uuid(self->device)));
+	PyStructSequence_SET_ITEM(info, 4, Py_BuildValue("z", type));
+	PyStructSequence_SET_ITEM(info, 5, Py_BuildValue("z", crypt_get_cipher(self->device)));
+	PyStructSequence_SET_ITEM(info, 6, Py_BuildValue("z", crypt_get_cipher_mode(self->device)));
+	PyStructSequence_SET_ITEM(info, 7, Py_BuildValue("i", crypt_get_volume_key_size(self->device) * 8));
+	PyStructSequence_SET_ITEM(info, 8, Py_BuildValue("K", crypt_get_data_offset(self->device)));
+	PyStructSequence_SET_ITEM(info, 9, Py_BuildValue("i", crypt_get_sector_size(self->device)));
+	if (active) {
+		PyStructSequence_SET_ITEM(info, 10, Py_BuildValue("K", cad.size));
+		PyStructSequence_SET_ITEM(info, 11, Py_BuildValue("K", cad.iv_offset));
+		PyStructSequence_SET_ITEM(info, 12, Py_BuildValue("I", cad.flags));
+	} else {
+		PyStructSequence_SET_ITEM(info, 10, Py_BuildValue(""));
+		PyStructSequence_SET_ITEM(info, 11, Py_BuildValue(""));
+		PyStructSequence_SET_ITEM(info, 12, Py_BuildValue(""));
+	}
+	PyStructSequence_SET_ITEM(info, 13, PyBool_FromLong(active && (cad.flags & CRYPT_ACTIVATE_READONLY)));
+	PyStructSequence_SET_ITEM(info, 14, PyBool_FromLong(active && (cad.flags & CRYPT_ACTIVATE_ALLOW_DISCARDS)));
+	PyStructSequence_SET_ITEM(info, 15, keyslots);
+	PyStructSequence_SET_ITEM(info, 16, Py_BuildValue("z", header));
+
+	for (i = 0; i < Info_desc.n_in_sequence; i++)
+		if (!PyStructSequence_GET_ITEM(info, i)) {
+			Py_DECREF(info);
+			return NULL;
+		}
+
+	for (i = 0; i < n; i++)
+		if (!PyTuple_GET_ITEM(keyslots, i)) {
+			Py_DECREF(info);
+			return NULL;
+		}
+
+	return info;
+}
+
+static char
+CryptSetup_Info_HELP[] =
+"Returns immutable Info structure about opened device\n\n\
+  info()\n\n\
+  The result is cached until a method changing the device runs.\n\
+Fields:\n\
+  dir\n  device\n  name\n  uuid\n  type\n  cipher\n  cipher_mode\n  keysize\n\
+  offset\n  sector_size\n  size\n  iv_offset\n  flags\n  readonly\n  discards\n\
+  keyslots\n  header\n";
+
+static PyObject *CryptSetup_Info(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	PyObject *result;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	if (!self->info_valid) {
+		Py_CLEAR(self->info);
+		self->info = CryptSetup_build_info(self);
+		self->info_valid = self->info != NULL;
+	}
+
+	result = self->info;
+	Py_XINCREF(result);
+	if (!result && !PyErr_Occurred())
+		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for return value");
+
+	CryptSetup_unlock(self);
+
+	return result;
+}
+
+static char
+CryptSetup_luksFormat_HELP[] =
+"Format device to enable LUKS\n\n\
+  luksFormat(cipher = 'aes', cipherMode = 'cbc-essiv:sha256', keysize = 256,\n\
+             type = 'luks1', sectorSize = 512, dataAlignment = 0, pbkdf = None)\n\n\
+  cipher - cipher specification, e.g. aes, serpent\n\
+  cipherMode - cipher mode specification, e.g. cbc-essiv:sha256, xts-plain64\n\
+               (default for luks2 is xts-plain64)\n\
+  keysize - key size in bits (default for luks2 is 512)\n\
+  type - luks1 or luks2\n\
+  sectorSize - encryption sector size in bytes, luks2 only\n\
+  dataAlignment - data alignment in 512-byte sectors, 0 for default\n\
+  pbkdf - pbkdf name (argon2id, argon2i, pbkdf2) or dictionary with keys\n\
+          type, hash, time_ms, iterations, max_memory_kb, parallel_threads\n\
+          as returned by benchmark_pbkdf()";
+
+static int CryptSetup_luksFormat_run(CryptSetupJob *job)
+{
+	struct crypt_params_luks1 luks1 = {
+		.data_alignment = job->data_alignment,
+	};
+	struct crypt_params_luks2 luks2 = {
+		.data_alignment = job->data_alignment,
+		.sector_size = job->sector_size,
+	};
+	const struct crypt_pbkdf_type *defaults;
+	void *params = NULL;
+	int r;
+
+	if (!strcmp(job->type, CRYPT_LUKS2))
+		params = &luks2;
+	else if (job->data_alignment)
+		params = &luks1;
+
+	if (job->has_pbkdf) {
+		/* libcryptsetup refuses a zero target time, fall back to iterationTime() */
+		if (!job->pbkdf.time_ms && !(job->pbkdf.flags & CRYPT_PBKDF_NO_BENCHMARK)) {
+			defaults = crypt_get_pbkdf_type_params(job->pbkdf.type);
+			job->pbkdf.time_ms = job->self->iteration_time ?:
+					     defaults ? defaults->time_ms : 0;
+		}
+		r = crypt_set_pbkdf_type(job->self->device, &job->pbkdf);
+		if (r < 0)
+			return r;
+	}
+	pbkdf_cache_apply(job->self, job->type, job->keysize / 8);
+
+	// FIXME use #defined defaults
+	return TIMED(FORMAT, crypt_format(job->self->device, job->type,
+			    job->cipher ?: "aes", job->cipher_mode ?: "cbc-essiv:sha256",
+			    NULL, NULL, job->keysize / 8, params));
+}
+
+static int CryptSetup_luksFormat_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"cipher", "cipherMode", "keysize", "type", "sectorSize",
+				       "dataAlignment", "pbkdf", NULL};
+	char *cipher_mode = NULL, *cipher = NULL, *type = NULL;
+	PyObject *keysize_object = NULL, *pbkdf = NULL;
+	unsigned int sector_size = 0;
+	Py_ssize_t data_alignment = 0;
+	int luks2;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zzOzInO", CONST_CAST(char**)kwlist,
+					&cipher, &cipher_mode, &keysize_object, &type,
+					&sector_size, &data_alignment, &pbkdf))
+		return -1;
+
+	job->type = job_type(type ?: "luks1");
+	if (!job->type)
+		return -1;
+
+	if (strcmp(job->type, CRYPT_LUKS1) && strcmp(job->type, CRYPT_LUKS2)) {
+		PyErr_SetString(PyExc_ValueError, "luksFormat supports luks1 and luks2 only");
+		return -1;
+	}
+
+	luks2 = !strcmp(job->type, CRYPT_LUKS2);
+	if (sector_size && !luks2) {
+		PyErr_SetString(PyExc_ValueError, "sectorSize requires luks2");
+		return -1;
+	}
+
+	if (data_alignment < 0) {
+		PyErr_SetString(PyExc_ValueError, "dataAlignment must not be negative");
+		return -1;
+	}
+
+	job->sector_size = sector_size;
+	job->data_alignment = data_alignment;
+	job->keysize = luks2 ? 512 : 256;
+	if (luks2 && !cipher_mode)
+		cipher_mode = CONST_CAST(char*)"xts-plain64";
+
+	if (!keysize_object || keysize_object == Py_None) {
+		/* use default value */
+	} else if (!PyInt_Check(keysize_object)) {
+		PyErr_SetString(PyExc_TypeError, "keysize must be an integer");
+		return -1;
+	} else if (PyInt_AsLong(keysize_object) % 8) {
+		PyErr_SetString(PyExc_TypeError, "keysize must have integer value dividable by 8");
+		return -1;
+	} else if (PyInt_AsLong(keysize_object) <= 0) {
+		PyErr_SetString(PyExc_TypeError, "keysize must be positive number bigger than 0");
+		return -1;
+	} else
+		job->keysize = PyInt_AsLong(keysize_object);
+
+	job->run = CryptSetup_luksFormat_run;
+	if (job_strdup(&job->cipher, cipher) ||
+	    job_strdup(&job->cipher_mode, cipher_mode) ||
+	    job_pbkdf(job, pbkdf))
+		return -1;
+
+	if (job->has_pbkdf && !luks2 && strcmp(job->pbkdf.type, CRYPT_KDF_PBKDF2)) {
+		PyErr_SetString(PyExc_ValueError, "luks1 supports pbkdf2 only");
+		return -1;
+	}
+
+	return 0;
+}
+
+static PyObject *CryptSetup_luksFormat(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_luksFormat_parse);
+}
+
+static char
+CryptSetup_addKeyByPassphrase_HELP[] =
+"Initialize keyslot using passphrase\n\n\
+  addKeyByPassphrase(passphrase, newPassphrase, slot)\n\n\
+  passphrase - string, bytes-like object or none to ask the user\n\
+  newPassphrase - passphrase to add\n\
+  slot - which slot to use (optional)";
+
+static int CryptSetup_addKeyByPassphrase_run(CryptSetupJob *job)
+{
+	pbkdf_cache_apply(job->self, NULL, crypt_get_volume_key_size(job->self->device));
+	return TIMED(KEYSLOT_ADD_PASSPHRASE, crypt_keyslot_add_by_passphrase(job->self->device, job->slot,
+					       job->passphrase.buf, job->passphrase.len,
+					       job->new_passphrase.buf, job->new_passphrase.len));
+}
+
+static int CryptSetup_addKeyByPassphrase_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"passphrase", "newPassphrase", "slot", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s*s*|i", CONST_CAST(char**)kwlist, &job->passphrase,
+					 &job->new_passphrase, &job->slot))
+		return -1;
+
+	job->run = CryptSetup_addKeyByPassphrase_run;
+	return 0;
+}
+
+static PyObject *CryptSetup_addKeyByPassphrase(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_addKeyByPassphrase_parse);
+}
+
+static char
+CryptSetup_addKeyByKeyfile_HELP[] =
+"Initialize keyslot using keyfile\n\n\
+  addKeyByKeyfile(keyfile, newKeyfile, slot, keyfileSize, keyfileOffset,\n\
+                  newKeyfileSize, newKeyfileOffset)\n\n\
+  keyfile - path to a keyfile unlocking an existing keyslot\n\
+  newKeyfile - path to the keyfile to add\n\
+  slot - which slot to use (optional)\n\
+  *Size, *Offset - bytes to read and to skip, 0 for the whole file";
+
+static int CryptSetup_addKeyByKeyfile_run(CryptSetupJob *job)
+{
+	pbkdf_cache_apply(job->self, NULL, crypt_get_volume_key_size(job->self->device));
+	return TIMED(KEYSLOT_ADD_KEYFILE, crypt_keyslot_add_by_keyfile_offset(job->self->device, job->slot,
+						   job->keyfile, job->keyfile_size, job->keyfile_offset,
+						   job->new_keyfile, job->new_keyfile_size, job->new_keyfile_offset));
+}
+
+static int CryptSetup_addKeyByKeyfile_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"keyfile", "newKeyfile", "slot", "keyfileSize", "keyfileOffset",
+				       "newKeyfileSize", "newKeyfileOffset", NULL};
+	char *keyfile = NULL, *new_keyfile = NULL;
+	Py_ssize_t keyfile_size = 0, keyfile_offset = 0, new_keyfile_size = 0, new_keyfile_offset = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|innnn", CONST_CAST(char**)kwlist, &keyfile, &new_keyfile,
+					 &job->slot, &keyfile_size, &keyfile_offset,
+					 &new_keyfile_size, &new_keyfile_offset))
+		return -1;
+
+	job->run = CryptSetup_addKeyByKeyfile_run;
+	if (job_strdup(&job->keyfile, keyfile) ||
+	    job_strdup(&job->new_keyfile, new_keyfile) ||
+	    job_size(&job->keyfile_size, keyfile_size, "keyfileSize") ||
+	    job_size(&job->keyfile_offset, keyfile_offset, "keyfileOffset") ||
+	    job_size(&job->new_keyfile_size, new_keyfile_size, "newKeyfileSize") ||
+	    job_size(&job->new_keyfile_offset, new_keyfile_offset, "newKeyfileOffset"))
+		return -1;
+
+	return 0;
+}
+
+static PyObject *CryptSetup_addKeyByKeyfile(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_addKeyByKeyfile_parse);
+}
+
+static char
+CryptSetup_addKeyByVolumeKey_HELP[] =
+"Initialize keyslot using cached or given volume key\n\n\
+  addKeyByVolumeKey(newPassphrase, slot, key)\n\n\
+  newPassphrase - passphrase to add\n\
+  slot - which slot to use (optional)\n\
+  key - volume key, e.g. from getVolumeKey() (optional)";
+
+static PyObject *CryptSetup_addKeyByVolumeKey(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"newPassphrase", "slot", "key", NULL};
+	Py_buffer newpassphrase, key = { NULL };
+	int slot = CRYPT_ANY_SLOT, is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s*|i" BUFFER_FMT, CONST_CAST(char**)kwlist,
+					 &newpassphrase, &slot, &key))
+		return NULL;
+
+	if (CryptSetup_lock(self)) {
+		PyBuffer_Release(&newpassphrase);
+		PyBuffer_Release(&key);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	pbkdf_cache_apply(self, NULL, crypt_get_volume_key_size(self->device));
+	is = TIMED(KEYSLOT_ADD_VOLUME_KEY, crypt_keyslot_add_by_volume_key(self->device, slot, key.buf, key.len,
+					     newpassphrase.buf, newpassphrase.len));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+	PyBuffer_Release(&newpassphrase);
+	PyBuffer_Release(&key);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_getVolumeKey_HELP[] =
+"Get volume key using passphrase\n\n\
+  getVolumeKey(passphrase, slot)\n\n\
+  passphrase - passphrase unlocking a keyslot\n\
+  slot - which slot to try (optional, default is all active slots)\n\n\
+  returns VolumeKey object kept in locked memory";
+
+static PyObject *CryptSetup_getVolumeKey(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"passphrase", "slot", NULL};
+	Py_buffer passphrase;
+	VolumeKeyObject *key;
+	size_t key_len;
+	int slot = CRYPT_ANY_SLOT, is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s*|i", CONST_CAST(char**)kwlist, &passphrase, &slot))
+		return NULL;
+
+	if (CryptSetup_lock(self)) {
+		PyBuffer_Release(&passphrase);
+		return NULL;
+	}
+
+	is = crypt_get_volume_key_size(self->device);
+	if (is <= 0) {
+		CryptSetup_unlock(self);
+		PyBuffer_Release(&passphrase);
+		PyErr_SetString(PyExc_RuntimeError, "Volume key size is unknown, header is not loaded");
+		return NULL;
+	}
+
+	key = VolumeKey_alloc(module_state(self)->VolumeKeyType, is);
+	if (!key) {
+		CryptSetup_unlock(self);
+		PyBuffer_Release(&passphrase);
+		return NULL;
+	}
+
+	key_len = key->key_len;
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(VOLUME_KEY_GET, crypt_volume_key_get(self->device, slot, key->key, &key_len,
+				  passphrase.buf, passphrase.len));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_unlock(self);
+	PyBuffer_Release(&passphrase);
+
+	if (is < 0) {
+		Py_DECREF(key);
+		return PyObjectError(is);
+	}
+
+	key->key_len = key_len;
+
+	return (PyObject *)key;
+}
+
+static char
+CryptSetup_activateByVolumeKey_HELP[] =
+"Activate LUKS device using volume key, no keyslot is unlocked\n\n\
+  activateByVolumeKey(name, key, flags)\n\n\
+  key - volume key, e.g. from getVolumeKey(); None for TCRYPT and\n\
+        INTEGRITY devices after load()\n\
+  flags - CRYPT_ACTIVATE_* flags (optional)";
+
+static PyObject *CryptSetup_activateByVolumeKey(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"name", "key", "flags", NULL};
+	PyObject *key_object = NULL;
+	char *name = NULL;
+	Py_buffer key = { 0 };
+	uint32_t flags = 0;
+	int is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|OI", CONST_CAST(char**)kwlist,
+					 &name, &key_object, &flags))
+		return NULL;
+
+	/* TCRYPT and INTEGRITY take the key from the loaded header */
+	if (key_object && key_object != Py_None &&
+	    PyObject_GetBuffer(key_object, &key, PyBUF_SIMPLE))
+		return NULL;
+
+	if (CryptSetup_lock(self)) {
+		PyBuffer_Release(&key);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(ACTIVATE_VOLUME_KEY, crypt_activate_by_volume_key(self->device, name, key.buf, key.len, flags));
+	Py_END_ALLOW_THREADS
+
+	if (is >= 0) {
+		free(self->activated_as);
+		self->activated_as = strdup(name);
+	}
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+	PyBuffer_Release(&key);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_resumeByVolumeKey_HELP[] =
+"Resume LUKS device using volume key\n\n\
+  resumeByVolumeKey(key)\n\n\
+  key - volume key, e.g. from getVolumeKey()";
+
+static PyObject *CryptSetup_resumeByVolumeKey(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"key", NULL};
+	Py_buffer key;
+	int is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, BUFFER_FMT, CONST_CAST(char**)kwlist, &key))
+		return NULL;
+
+	if (CryptSetup_lock(self)) {
+		PyBuffer_Release(&key);
+		return NULL;
+	}
+
+	if (!self->activated_as){
+		CryptSetup_unlock(self);
+		PyBuffer_Release(&key);
+		PyErr_SetString(PyExc_IOError, "Device has not been activated yet.");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(RESUME_VOLUME_KEY, crypt_resume_by_volume_key(self->device, self->activated_as, key.buf, key.len));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+	PyBuffer_Release(&key);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_removePassphrase_HELP[] =
+"Destroy keyslot using passphrase\n\n\
+  removePassphrase(passphrase, slot, parallel_slots)\n\n\
+  passphrase - string, bytes-like object or none to ask the user\n\
+  slot - which slot to try (optional, default is all active slots)\n\
+  parallel_slots - without slot, check all active keyslots concurrently";
+
+static int CryptSetup_removePassphrase_slot(CryptSetupJob *job, int slot)
+{
+	return TIMED(ACTIVATE_PASSPHRASE, crypt_activate_by_passphrase(job->self->device, NULL, slot,
+					    job->passphrase.buf, job->passphrase.len, 0));
+}
+
+/* Destroys the keyslot the key material of the job unlocks. */
+static int CryptSetupJob_remove_slot(CryptSetupJob *job, int (*try_slot)(CryptSetupJob *job, int slot))
+{
+	const char *uuid;
+	int is;
+
+	is = CryptSetupJob_run_slot(job, try_slot);
+	if (is < 0)
+		return is;
+
+	uuid = crypt_get_uuid(job->self->device);
+	if (uuid)
+		slot_cache_forget(uuid, is);
+
+	return TIMED(KEYSLOT_DESTROY, crypt_keyslot_destroy(job->self->device, is));
+}
+
+static int CryptSetup_removePassphrase_run(CryptSetupJob *job)
+{
+	return CryptSetupJob_remove_slot(job, CryptSetup_removePassphrase_slot);
+}
+
+static int CryptSetup_removePassphrase_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"passphrase", "slot", "parallel_slots", NULL};
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s*|ii", CONST_CAST(char**)kwlist, &job->passphrase,
+					 &job->slot, &job->parallel_slots))
+		return -1;
+
+	job->run = CryptSetup_removePassphrase_run;
+	return 0;
+}
+
+static PyObject *CryptSetup_removePassphrase(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_removePassphrase_parse);
+}
+
+static char
+CryptSetup_removeKeyfile_HELP[] =
+"Destroy keyslot using keyfile\n\n\
+  removeKeyfile(keyfile, slot, keyfileSize, keyfileOffset)\n\n\
+  keyfile - path to the keyfile unlocking the keyslot to destroy\n\
+  slot - which slot to try (optional, default is all active slots)\n\
+  keyfileSize, keyfileOffset - bytes to read and to skip, 0 for the whole file";
+
+static int CryptSetup_removeKeyfile_slot(CryptSetupJob *job, int slot)
+{
+	return TIMED(ACTIVATE_KEYFILE, crypt_activate_by_keyfile_offset(job->self->device, NULL, slot,
+						job->keyfile, job->keyfile_size, job->keyfile_offset, 0));
+}
+
+static int CryptSetup_removeKeyfile_run(CryptSetupJob *job)
+{
+	return CryptSetupJob_remove_slot(job, CryptSetup_removeKeyfile_slot);
+}
+
+static int CryptSetup_removeKeyfile_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"keyfile", "slot", "keyfileSize", "keyfileOffset", NULL};
+	char *keyfile = NULL;
+	Py_ssize_t keyfile_size = 0, keyfile_offset = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|inn", CONST_CAST(char**)kwlist, &keyfile,
+					 &job->slot, &keyfile_size, &keyfile_offset))
+		return -1;
+
+	job->run = CryptSetup_removeKeyfile_run;
+	if (job_strdup(&job->keyfile, keyfile) ||
+	    job_size(&job->keyfile_size, keyfile_size, "keyfileSize") ||
+	    job_size(&job->keyfile_offset, keyfile_offset, "keyfileOffset"))
+		return -1;
+
+	return 0;
+}
+
+static PyObject *CryptSetup_removeKeyfile(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_removeKeyfile_parse);
+}
+
+/*
+ * Slots killSlot() and rekey('kill') may destroy: active or unbound ones,
+ * never the last active slot. Returns NULL or the reason for refusing.
+ */
+static const char *keyslot_kill_refusal(struct crypt_device *cd, int slot)
+{
+	switch (crypt_keyslot_status(cd, slot)) {
+	case CRYPT_SLOT_ACTIVE:
+	case CRYPT_SLOT_UNBOUND:
+		return NULL;
+	case CRYPT_SLOT_ACTIVE_LAST:
+		return "Last slot, removing it would render the device unusable";
+	case CRYPT_SLOT_INACTIVE:
+		return "Inactive slot";
+	case CRYPT_SLOT_INVALID:
+		return "Invalid slot";
+	default:
+		return "Unknown slot status";
+	}
+}
+
+static char
+CryptSetup_killSlot_HELP[] =
+"Destroy keyslot\n\n\
+  killSlot(slot)\n\n\
+  slot - the slot to remove";
+
+static PyObject *CryptSetup_killSlot(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"slot", NULL};
+	const char *refusal;
+	int slot = CRYPT_ANY_SLOT, is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &slot))
+		return NULL;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	refusal = keyslot_kill_refusal(self->device, slot);
+	if (refusal) {
+		CryptSetup_unlock(self);
+		PyErr_SetString(PyExc_ValueError, refusal);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(KEYSLOT_DESTROY, crypt_keyslot_destroy(self->device, slot));
+	Py_END_ALLOW_THREADS
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+static PyObject *keyslot_build(struct crypt_device *cd, int slot)
+{
+	struct crypt_pbkdf_type pbkdf;
+	crypt_keyslot_info status = crypt_keyslot_status(cd, slot);
+	PyObject *pbkdf_info, *result;
+	int keysize = -1;
+
+	if (status == CRYPT_SLOT_ACTIVE || status == CRYPT_SLOT_ACTIVE_LAST || status == CRYPT_SLOT_UNBOUND)
+		keysize = crypt_keyslot_get_key_size(cd, slot);
+
+	if (keysize >= 0 && !crypt_keyslot_get_pbkdf(cd, slot, &pbkdf))
+		pbkdf_info = Py_BuildValue("{s:s,s:z,s:I,s:I,s:I,s:I}",
+					   "type",		pbkdf.type,
+					   "hash",		pbkdf.hash,
+					   "time_ms",		pbkdf.time_ms,
+					   "iterations",	pbkdf.iterations,
+					   "max_memory_kb",	pbkdf.max_memory_kb,
+					   "parallel_threads",	pbkdf.parallel_threads);
+	else
+		pbkdf_info = Py_BuildValue("");
+	if (!pbkdf_info)
+		return NULL;
+
+	if (keysize >= 0)
+		result = Py_BuildValue("{s:i,s:i,s:i,s:O,s:i}",
+				       "slot",		slot,
+				       "status",	status,
+				       "priority",	crypt_keyslot_get_priority(cd, slot),
+				       "pbkdf",		pbkdf_info,
+				       "keysize",	keysize * 8);
+	else
+		result = Py_BuildValue("{s:i,s:i,s:i,s:O,s:O}",
+				       "slot",		slot,
+				       "status",	status,
+				       "priority",	crypt_keyslot_get_priority(cd, slot),
+				       "pbkdf",		pbkdf_info,
+				       "keysize",	Py_None);
+
+	Py_DECREF(pbkdf_info);
+	return result;
+}
+
+static char
+CryptSetup_keyslots_HELP[] =
+"Returns list describing every keyslot of the loaded header\n\n\
+  keyslots()\n\n\
+  one dictionary per slot with keys slot, status (CRYPT_SLOT_*),\n\
+  priority (CRYPT_SLOT_PRIORITY_*), pbkdf (dictionary as used by\n\
+  luksFormat, or None) and keysize (bits, or None for unused slots)";
+
+static PyObject *CryptSetup_keyslots(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	PyObject *result, *item;
+	const char *type;
+	int i, n;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	type = crypt_get_type(self->device);
+	n = type ? crypt_keyslot_max(type) : 0;
+	if (n < 0)
+		n = 0;
+
+	result = PyList_New(n);
+	for (i = 0; result && i < n; i++) {
+		item = keyslot_build(self->device, i);
+		if (!item) {
+			Py_CLEAR(result);
+			break;
+		}
+		PyList_SET_ITEM(result, i, item);
+	}
+
+	CryptSetup_unlock(self);
+
+	return result;
+}
+
+static int header_backup_mem(struct crypt_device *cd, char **data, size_t *size);
+static int header_restore_mem(struct crypt_device *cd, const void *data, size_t size);
+static void header_free(char *data, size_t size);
+
+/* One step of rekey(), see CryptSetup_rekey_HELP. */
+typedef struct {
+	enum { REKEY_ADD, REKEY_CHANGE, REKEY_REMOVE, REKEY_KILL } op;
+	Py_buffer passphrase;
+	Py_buffer new_passphrase;
+	int slot;
+	int result;
+} RekeyOp;
+
+static int rekey_parse(PyObject *item, RekeyOp *op)
+{
+	const char *name;
+
+	if (!PyTuple_Check(item) || PyTuple_GET_SIZE(item) < 1) {
+		PyErr_SetString(PyExc_TypeError, "change must be a tuple starting with the operation name");
+		return -1;
+	}
+
+	op->slot = CRYPT_ANY_SLOT;
+	if (!PyArg_Parse(PyTuple_GET_ITEM(item, 0), "s", &name))
+		return -1;
+
+	if (!strcmp(name, "add")) {
+		op->op = REKEY_ADD;
+		return PyArg_ParseTuple(item, "ss*s*|i;('add', passphrase, newPassphrase[, slot])",
+					&name, &op->passphrase, &op->new_passphrase, &op->slot) ? 0 : -1;
+	} else if (!strcmp(name, "change")) {
+		op->op = REKEY_CHANGE;
+		return PyArg_ParseTuple(item, "ss*s*|i;('change', passphrase, newPassphrase[, slot])",
+					&name, &op->passphrase, &op->new_passphrase, &op->slot) ? 0 : -1;
+	} else if (!strcmp(name, "remove")) {
+		op->op = REKEY_REMOVE;
+		return PyArg_ParseTuple(item, "ss*|i;('remove', passphrase[, slot])",
+					&name, &op->passphrase, &op->slot) ? 0 : -1;
+	} else if (!strcmp(name, "kill")) {
+		op->op = REKEY_KILL;
+		return PyArg_ParseTuple(item, "si;('kill', slot)", &name, &op->slot) ? 0 : -1;
+	}
+
+	PyErr_Format(PyExc_ValueError, "Unknown rekey operation %s", name);
+	return -1;
+}
+
+static int rekey_run(CryptSetupObject *self, RekeyOp *op)
+{
+	struct crypt_device *cd = self->device;
+	int r;
+
+	if (op->op == REKEY_ADD || op->op == REKEY_CHANGE)
+		pbkdf_cache_apply(self, NULL, crypt_get_volume_key_size(cd));
+
+	switch (op->op) {
+	case REKEY_ADD:
+		return TIMED(KEYSLOT_ADD_PASSPHRASE, crypt_keyslot_add_by_passphrase(cd, op->slot,
+				op->passphrase.buf, op->passphrase.len,
+				op->new_passphrase.buf, op->new_passphrase.len));
+	case REKEY_CHANGE:
+		return TIMED(KEYSLOT_CHANGE, crypt_keyslot_change_by_passphrase(cd, CRYPT_ANY_SLOT, op->slot,
+				op->passphrase.buf, op->passphrase.len,
+				op->new_passphrase.buf, op->new_passphrase.len));
+	case REKEY_REMOVE:
+		r = TIMED(ACTIVATE_PASSPHRASE, crypt_activate_by_passphrase(cd, NULL, op->slot,
+				op->passphrase.buf, op->passphrase.len, 0));
+		if (r < 0)
+			return r;
+		if (crypt_get_uuid(cd))
+			slot_cache_forget(crypt_get_uuid(cd), r);
+		return TIMED(KEYSLOT_DESTROY, crypt_keyslot_destroy(cd, r));
+	case REKEY_KILL:
+		if (keyslot_kill_refusal(cd, op->slot))
+			return -EINVAL;
+		if (crypt_get_uuid(cd))
+			slot_cache_forget(crypt_get_uuid(cd), op->slot);
+		return TIMED(KEYSLOT_DESTROY, crypt_keyslot_destroy(cd, op->slot));
+	}
+
+	return -EINVAL;
+}
+
+static char
+CryptSetup_rekey_HELP[] =
+"Run several keyslot changes against the loaded header\n\n\
+  rekey(changes, atomic = True)\n\n\
+  changes - sequence of tuples, one of\n\
+            ('add', passphrase, newPassphrase[, slot])\n\
+            ('change', passphrase, newPassphrase[, slot])\n\
+            ('remove', passphrase[, slot])\n\
+            ('kill', slot)\n\
+  atomic  - back the header up in memory first and restore it when a\n\
+            change fails, so either all changes apply or none does\n\n\
+  All changes are validated first, then run in order under one lock\n\
+  and stop at the first failure. Returns list with the result of each\n\
+  change (slot number or -errno), None for the ones not run; with\n\
+  atomic the changes before a failure have been rolled back.\n\
+  Like killSlot, 'kill' refuses to destroy the last active slot.\n\
+  OSError if the header backup or the roll back fails.";
+
+static PyObject *CryptSetup_rekey(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"changes", "atomic", NULL};
+	PyObject *changes, *seq, *result = NULL, *value;
+	RekeyOp *ops;
+	Py_ssize_t i, n, done = 0;
+	char *backup = NULL;
+	size_t backup_size = 0;
+	int atomic = 1, is = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|p", CONST_CAST(char**)kwlist, &changes, &atomic))
+		return NULL;
+
+	seq = PySequence_Fast(changes, "changes must be a sequence");
+	if (!seq)
+		return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+	ops = calloc(n ?: 1, sizeof(*ops));
+	if (!ops) {
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+
+	for (i = 0; i < n; i++)
+		if (rekey_parse(PySequence_Fast_GET_ITEM(seq, i), &ops[i]))
+			goto out;
+
+	if (CryptSetup_lock(self))
+		goto out;
+
+	Py_BEGIN_ALLOW_THREADS
+	if (atomic && n)
+		is = header_backup_mem(self->device, &backup, &backup_size);
+	for (done = 0; !is && done < n; done++) {
+		ops[done].result = rekey_run(self, &ops[done]);
+		if (ops[done].result < 0) {
+			if (backup)
+				is = header_restore_mem(self->device, backup, backup_size);
+			done++;
+			break;
+		}
+	}
+	header_free(backup, backup_size);
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+
+	if (is < 0) {
+		PyObjectError(is);
+		goto out;
+	}
+
+	result = PyList_New(n);
+	for (i = 0; result && i < n; i++) {
+		value = i < done ? PyObjectResult(ops[i].result) : Py_BuildValue("");
+		if (!value) {
+			Py_CLEAR(result);
+			break;
+		}
+		PyList_SET_ITEM(result, i, value);
+	}
+out:
+	for (i = 0; i < n; i++) {
+		PyBuffer_Release(&ops[i].passphrase);
+		PyBuffer_Release(&ops[i].new_passphrase);
+	}
+	free(ops);
+	Py_DECREF(seq);
+	return result;
+}
+
+/*
+ * crypt_header_backup() insists on creating the backup file itself, so
+ * backups go to a private directory on tmpfs and are read straight back
+ * into memory. crypt_header_restore() only reads its file, a memfd will
+ * do there and no file ever shows up.
+ */
+static const char *header_tmp_base(void)
+{
+	const char *dir;
+
+	if (!access("/dev/shm", W_OK | X_OK))
+		return "/dev/shm";
+
+	dir = getenv("TMPDIR");
+	return dir && *dir ? dir : "/tmp";
+}
+
+static int header_write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len) {
+		n = write(fd, buf, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return n < 0 ? -errno : -EIO;
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int header_read_all(int fd, char **data, size_t *size)
+{
+	struct stat st;
+	size_t done = 0;
+	ssize_t n;
+	int r;
+
+	if (fstat(fd, &st))
+		return -errno;
+
+	*data = malloc(st.st_size ?: 1);
+	if (!*data)
+		return -ENOMEM;
+
+	while (done < (size_t)st.st_size) {
+		n = read(fd, *data + done, st.st_size - done);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0) {
+			/* a truncated backup must never reach headerRestore() */
+			r = n < 0 ? -errno : -EIO;
+			crypt_safe_memzero(*data, done);
+			free(*data);
+			*data = NULL;
+			return r;
+		}
+		done += n;
+	}
+
+	*size = done;
+	return 0;
+}
+
+static void header_free(char *data, size_t size)
+{
+	if (data)
+		crypt_safe_memzero(data, size);
+	free(data);
+}
+
+/* Backup of the loaded header into malloc()ed memory, wipe with header_free() */
+static int header_backup_mem(struct crypt_device *cd, char **data, size_t *size)
+{
+	char dir[PATH_MAX], path[PATH_MAX + 8];
+	int fd, r;
+
+	*data = NULL;
+	*size = 0;
+
+	if (snprintf(dir, sizeof(dir), "%s/pycryptsetup-XXXXXX", header_tmp_base()) >= (int)sizeof(dir))
+		return -ENAMETOOLONG;
+	if (!mkdtemp(dir))
+		return -errno;
+	snprintf(path, sizeof(path), "%s/header", dir);
+
+	r = TIMED(HEADER_BACKUP, crypt_header_backup(cd, NULL, path));
+	if (!r) {
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		if (fd < 0)
+			r = -errno;
+		else {
+			r = header_read_all(fd, data, size);
+			close(fd);
+		}
+	}
+
+	unlink(path);
+	rmdir(dir);
+
+	if (r < 0) {
+		header_free(*data, *size);
+		*data = NULL;
+		*size = 0;
+	}
+
+	return r;
+}
+
+static int header_restore_mem(struct crypt_device *cd, const void *data, size_t size)
+{
+	char dir[PATH_MAX], path[PATH_MAX + 8];
+	int fd, r;
+
+#ifdef MFD_CLOEXEC
+	fd = memfd_create("pycryptsetup-header", MFD_CLOEXEC);
+	if (fd >= 0) {
+		r = header_write_all(fd, data, size);
+		snprintf(path, sizeof(path), "/proc/self/fd/%d", fd);
+		if (!r)
+			r = TIMED(HEADER_RESTORE, crypt_header_restore(cd, NULL, path));
+		close(fd);
+		return r;
+	}
+#endif
+	/* no memfd, fall back to a private file on tmpfs */
+	if (snprintf(dir, sizeof(dir), "%s/pycryptsetup-XXXXXX", header_tmp_base()) >= (int)sizeof(dir))
+		return -ENAMETOOLONG;
+	if (!mkdtemp(dir))
+		return -errno;
+	snprintf(path, sizeof(path), "%s/header", dir);
+
+	fd = open(path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		r = -errno;
+	else {
+		r = header_write_all(fd, data, size);
+		close(fd);
+		if (!r)
+			r = TIMED(HEADER_RESTORE, crypt_header_restore(cd, NULL, path));
+	}
+
+	unlink(path);
+	rmdir(dir);
+
+	return r;
+}
+
+static char
+CryptSetup_headerBackup_HELP[] =
+"Backup the LUKS header into memory\n\n\
+  headerBackup(buffer)\n\n\
+  buffer - optional writable buffer (bytearray, memoryview, mmap)\n\
+           receiving the header\n\n\
+  returns the header as bytes, or the number of bytes written when\n\
+  buffer is given; ValueError if buffer is too small";
+
+static PyObject *CryptSetup_headerBackup(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"buffer", NULL};
+	PyObject *target = NULL, *result = NULL;
+	Py_buffer view;
+	char *data;
+	size_t size;
+	int is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|O", CONST_CAST(char**)kwlist, &target))
+		return NULL;
+
+	if (target == Py_None)
+		target = NULL;
+
+	if (target && PyObject_GetBuffer(target, &view, PyBUF_WRITABLE | PyBUF_C_CONTIGUOUS))
+		return NULL;
+
+	if (CryptSetup_lock(self)) {
+		if (target)
+			PyBuffer_Release(&view);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = header_backup_mem(self->device, &data, &size);
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_unlock(self);
+
+	if (is < 0)
+		result = PyObjectError(is);
+	else if (!target)
+		result = PyBytes_FromStringAndSize(data, size);
+	else if ((size_t)view.len < size)
+		PyErr_Format(PyExc_ValueError, "Buffer too small, header needs %zu bytes", size);
+	else {
+		memcpy(view.buf, data, size);
+		result = PyObjectResult(size);
+	}
+
+	if (target)
+		PyBuffer_Release(&view);
+	header_free(data, size);
+
+	return result;
+}
+
+static char
+CryptSetup_headerRestore_HELP[] =
+"Restore the LUKS header from memory\n\n\
+  headerRestore(header)\n\n\
+  header - bytes-like object as returned by headerBackup()";
+
+static PyObject *CryptSetup_headerRestore(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"header", NULL};
+	Py_buffer header;
+	int is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, BUFFER_FMT, CONST_CAST(char**)kwlist, &header))
+		return NULL;
+
+	if (CryptSetup_lock(self)) {
+		PyBuffer_Release(&header);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = header_restore_mem(self->device, header.buf, header.len);
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+	PyBuffer_Release(&header);
+
+	return PyObjectResult(is);
+}
+
+/*
+ * Progress reporting for long running calls. libcryptsetup calls back
+ * for every chunk from the thread running without the GIL; the Python
+ * callback only gets called once per interval (and on completion) so a
+ * fast device does not spend its time in the interpreter. A true return
+ * value or an exception stops the operation.
+ */
+typedef struct {
+	PyObject *callback;
+	double interval;
+	double last;
+	uint64_t base;
+	uint64_t last_offset;
+	int started;
+	int stopped;
+#ifdef MULTI_PHASE_INIT
+	PyInterpreterState *interp;
+#endif
+} Progress;
+
+static double progress_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Holds its own reference to callback, drop it with progress_clear(). */
+static void progress_init(Progress *progress, PyObject *callback, double interval)
+{
+	memset(progress, 0, sizeof(*progress));
+	progress->callback = callback == Py_None ? NULL : callback;
+	Py_XINCREF(progress->callback);
+	progress->interval = interval;
+	progress->last = progress_now();
+#ifdef MULTI_PHASE_INIT
+	progress->interp = PyInterpreterState_Get();
+#endif
+}
+
+static void progress_clear(Progress *progress)
+{
+	Py_CLEAR(progress->callback);
+}
+
+static int progress_cb(uint64_t size, uint64_t offset, void *usrptr)
+{
+	Progress *progress = usrptr;
+	CallbackState cbstate;
+	PyObject *result;
+	double now = progress_now(), rate;
+	int r = 0;
+
+	if (!progress->started) {
+		progress->started = 1;
+		progress->last_offset = offset;
+	}
+
+	if (!progress->callback || (offset < size && now - progress->last < progress->interval))
+		return 0;
+
+	/* current rate, over the interval since the previous call */
+	rate = now > progress->last && offset >= progress->last_offset ?
+		(offset - progress->last_offset) / (now - progress->last) / (1024 * 1024) : 0.0;
+	progress->last = now;
+	progress->last_offset = offset;
+
+	callback_enter(&cbstate, CALLBACK_INTERP(progress));
+
+	/* done and total count from where the operation started */
+	result = PyObject_CallFunction(progress->callback, "KKd",
+				       (unsigned long long)(offset - progress->base),
+				       (unsigned long long)(size - progress->base), rate);
+	if (!result) {
+		PyErr_WriteUnraisable(progress->callback);
+		r = 1;
+	} else {
+		r = PyObject_IsTrue(result) ? 1 : 0;
+		Py_DECREF(result);
+	}
+
+	callback_leave(&cbstate);
+
+	progress->stopped |= r;
+	return r;
+}
+
+static char
+CryptSetup_resize_HELP[] =
+"Resize active device\n\n\
+  resize(size)\n\n\
+  size - new size in 512-byte sectors, 0 to use the whole underlying device";
+
+static PyObject *CryptSetup_resize(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"size", NULL};
+	unsigned long long size = 0;
+	int is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "K", CONST_CAST(char**)kwlist, &size))
+		return NULL;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	/* activated_as is replaced under the lock */
+	if (!self->activated_as) {
+		CryptSetup_unlock(self);
+		PyErr_SetString(PyExc_RuntimeError, "Device has not been activated yet.");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(RESIZE, crypt_resize(self->device, self->activated_as, size));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_reencrypt_HELP[] =
+"Reencrypt LUKS2 device in place, online when activated\n\n\
+  reencrypt(passphrase, cipher, cipherMode, keysize, slot, hotzoneSize,\n\
+            resilience, hash, direction, flags, progress, progressInterval)\n\n\
+  passphrase  - passphrase of slot, also protects the new volume key\n\
+  cipher, cipherMode, keysize - new cipher spec (default: current one)\n\
+  slot        - keyslot to unlock (default: any)\n\
+  hotzoneSize - maximal area reencrypted at once in 512-byte sectors,\n\
+                smaller values interfere less with foreground I/O\n\
+  resilience  - 'checksum' (default), 'journal', 'datashift' or 'none'\n\
+  hash        - checksum hash for checksum resilience (default: sha256)\n\
+  direction   - CRYPT_REENCRYPT_FORWARD or CRYPT_REENCRYPT_BACKWARD\n\
+  flags       - CRYPT_REENCRYPT_* flags, e.g. CRYPT_REENCRYPT_RESUME_ONLY\n\
+                to continue an interrupted reencryption\n\
+  progress    - func(done, total, mibps) called at most every\n\
+                progressInterval seconds (default 1.0); returning True\n\
+                stops, the reencryption can be resumed later";
+
+static PyObject *CryptSetup_reencrypt(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"passphrase", "cipher", "cipherMode", "keysize", "slot",
+				       "hotzoneSize", "resilience", "hash", "direction", "flags",
+				       "progress", "progressInterval", NULL};
+	struct crypt_params_reencrypt params = { .mode = CRYPT_REENCRYPT_REENCRYPT };
+	struct crypt_params_luks2 luks2 = { 0 };
+	PyObject *callback = NULL;
+	Py_buffer passphrase;
+	const char *cipher = NULL, *cipher_mode = NULL, *type;
+	unsigned long long hotzone = 0;
+	double interval = 1.0;
+	Progress progress;
+	int keysize = 0, slot = CRYPT_ANY_SLOT, new_slot = CRYPT_ANY_SLOT, direction = CRYPT_REENCRYPT_FORWARD, is;
+	unsigned int flags = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s*|zziiKzziIOd", CONST_CAST(char**)kwlist,
+					 &passphrase, &cipher, &cipher_mode, &keysize, &slot, &hotzone,
+					 &params.resilience, &params.hash, &direction, &flags,
+					 &callback, &interval))
+		return NULL;
+
+	if (callback && callback != Py_None && !PyCallable_Check(callback)) {
+		PyBuffer_Release(&passphrase);
+		PyErr_SetString(PyExc_TypeError, "progress must be callable");
+		return NULL;
+	}
+
+	/* libcryptsetup has no defaults for these, same as cryptsetup reencrypt */
+	if (!params.resilience)
+		params.resilience = "checksum";
+	if (!params.hash)
+		params.hash = "sha256";
+
+	if (CryptSetup_lock(self)) {
+		PyBuffer_Release(&passphrase);
+		return NULL;
+	}
+
+	type = crypt_get_type(self->device);
+	if (!type || strcmp(type, CRYPT_LUKS2)) {
+		CryptSetup_unlock(self);
+		PyBuffer_Release(&passphrase);
+		PyErr_SetString(PyExc_ValueError, "Reencryption requires a LUKS2 header");
+		return NULL;
+	}
+
+	params.direction = direction;
+	params.max_hotzone_size = hotzone;
+	params.flags = flags;
+	luks2.sector_size = crypt_get_sector_size(self->device);
+	params.luks2 = &luks2;
+	progress_init(&progress, callback, interval);
+
+	Py_BEGIN_ALLOW_THREADS
+	if (!(flags & CRYPT_REENCRYPT_RESUME_ONLY)) {
+		/* the new volume key lives in its own unbound keyslot until the switch */
+		is = TIMED(KEYSLOT_ADD_KEY, crypt_keyslot_add_by_key(self->device, CRYPT_ANY_SLOT, NULL,
+				keysize ? keysize / 8 : crypt_get_volume_key_size(self->device),
+				passphrase.buf, passphrase.len, CRYPT_VOLUME_KEY_NO_SEGMENT));
+		new_slot = is;
+	} else
+		is = 0;
+
+	if (is >= 0)
+		is = TIMED(REENCRYPT_INIT, crypt_reencrypt_init_by_passphrase(self->device, self->activated_as,
+				passphrase.buf, passphrase.len, slot, new_slot,
+				cipher ?: crypt_get_cipher(self->device),
+				cipher_mode ?: crypt_get_cipher_mode(self->device), &params));
+
+	if (is < 0 && new_slot >= 0)
+		TIMED(KEYSLOT_DESTROY, crypt_keyslot_destroy(self->device, new_slot));
+	else if (is >= 0 && !(flags & CRYPT_REENCRYPT_INITIALIZE_ONLY))
+		is = TIMED(REENCRYPT_RUN, crypt_reencrypt_run(self->device, progress_cb, &progress));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+	PyBuffer_Release(&passphrase);
+	progress_clear(&progress);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_wipe_HELP[] =
+"Wipe device area\n\n\
+  wipe(pattern, offset, length, blockSize, flags, device, progress,\n\
+       progressInterval)\n\n\
+  pattern   - CRYPT_WIPE_ZERO (default), CRYPT_WIPE_RANDOM or\n\
+              CRYPT_WIPE_ENCRYPTED_ZERO\n\
+  offset    - start in bytes\n\
+  length    - size in bytes, 0 (default) up to the end of the device\n\
+  blockSize - size of a single write, default 1 MiB\n\
+  flags     - CRYPT_WIPE_NO_DIRECT_IO to go through the page cache\n\
+  device    - path to wipe, default is the active mapping\n\
+  progress  - func(done, total, mibps) called at most every\n\
+              progressInterval seconds (default 1.0); returning True\n\
+              cancels the wipe";
+
+static PyObject *CryptSetup_wipe(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"pattern", "offset", "length", "blockSize", "flags",
+				       "device", "progress", "progressInterval", NULL};
+	PyObject *callback = NULL;
+	char *device = NULL, *path = NULL;
+	unsigned long long offset = 0, length = 0, block_size = 1024 * 1024;
+	unsigned int flags = 0;
+	double interval = 1.0;
+	Progress progress;
+	off_t end;
+	int pattern = CRYPT_WIPE_ZERO, fd, is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iKKKIzOd", CONST_CAST(char**)kwlist,
+					 &pattern, &offset, &length, &block_size, &flags,
+					 &device, &callback, &interval))
+		return NULL;
+
+	if (pattern != CRYPT_WIPE_ZERO && pattern != CRYPT_WIPE_RANDOM &&
+	    pattern != CRYPT_WIPE_ENCRYPTED_ZERO) {
+		PyErr_SetString(PyExc_ValueError, "Unknown wipe pattern");
+		return NULL;
+	}
+
+	if (!block_size) {
+		PyErr_SetString(PyExc_ValueError, "blockSize must not be zero");
+		return NULL;
+	}
+
+	if (callback && callback != Py_None && !PyCallable_Check(callback)) {
+		PyErr_SetString(PyExc_TypeError, "progress must be callable");
+		return NULL;
+	}
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	/* activated_as is replaced under the lock */
+	if (!device && !self->activated_as) {
+		CryptSetup_unlock(self);
+		PyErr_SetString(PyExc_RuntimeError, "Device has not been activated yet.");
+		return NULL;
+	}
+
+	if (device)
+		path = strdup(device);
+	else if (asprintf(&path, "%s/%s", crypt_get_dir(), self->activated_as) < 0)
+		path = NULL;
+	if (!path) {
+		CryptSetup_unlock(self);
+		return PyErr_NoMemory();
+	}
+
+	progress_init(&progress, callback, interval);
+	/* crypt_wipe() reports device offsets, the range ends at offset + length */
+	progress.base = offset;
+
+	Py_BEGIN_ALLOW_THREADS
+	is = 0;
+	if (!length) {
+		fd = open(path, O_RDONLY | O_CLOEXEC);
+		end = fd < 0 ? -1 : lseek(fd, 0, SEEK_END);
+		if (end < 0)
+			is = -errno;
+		else if ((unsigned long long)end > offset)
+			length = end - offset;
+		if (fd >= 0)
+			close(fd);
+	}
+
+	if (!is && length)
+		is = TIMED(WIPE, crypt_wipe(self->device, path, pattern, offset, length,
+					    block_size, flags, progress_cb, &progress));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_unlock(self);
+	free(path);
+	progress_clear(&progress);
+
+	if (is < 0 && progress.stopped)
+		is = -EINTR;
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_close_HELP[] =
+"Release the device context\n\n\
+  close()\n\n\
+  with set_context_pool() enabled an unmodified context goes back to\n\
+  the pool; the object cannot be used afterwards";
+
+static PyObject *CryptSetup_close(CryptSetupObject* self, PyObject *args)
+{
+	long me = PyThread_get_thread_ident();
+
+	if (!self->device)
+		Py_RETURN_NONE;
+
+	if (__atomic_load_n(&self->lock_owner, __ATOMIC_RELAXED) == me) {
+		PyErr_SetString(PyExc_RuntimeError, "Device context is already in use by this thread");
+		return NULL;
+	}
+
+	/* not CryptSetup_lock(), closing must not read the header */
+	Py_BEGIN_ALLOW_THREADS
+	PyThread_acquire_lock(self->lock, WAIT_LOCK);
+	CryptSetup_release_context(self);
+	PyThread_release_lock(self->lock);
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_drain_log(self);
+
+	Py_RETURN_NONE;
+}
+
+static PyObject *CryptSetup_enter(CryptSetupObject* self, PyObject *args)
+{
+	Py_INCREF(self);
+	return (PyObject *)self;
+}
+
+static PyObject *CryptSetup_exit(CryptSetupObject* self, PyObject *args)
+{
+	PyObject *result = CryptSetup_close(self, NULL);
+
+	if (!result)
+		return NULL;
+
+	Py_DECREF(result);
+	Py_RETURN_FALSE;
+}
+
+static char
+CryptSetup_Status_HELP[] =
+"Status of LUKS device\n\n\
+  luksStatus()";
+
+static PyObject *CryptSetup_Status(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	int is;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	if (!self->activated_as){
+		CryptSetup_unlock(self);
+		PyErr_SetString(PyExc_IOError, "Device has not been activated yet.");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(STATUS, crypt_status(self->device, self->activated_as));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_Resume_HELP[] =
+"Resume LUKS device\n\n\
+  luksOpen(passphrase, slot)\n\n\
+  passphrase - string, bytes-like object or none to ask the user\n\
+  slot - which slot to try (optional, default is all active slots)";
+
+static int CryptSetup_Resume_slot(CryptSetupJob *job, int slot)
+{
+	return TIMED(RESUME_PASSPHRASE, crypt_resume_by_passphrase(job->self->device, job->self->activated_as,
+					  slot, job->passphrase.buf, job->passphrase.len));
+}
+
+static int CryptSetup_Resume_run(CryptSetupJob *job)
+{
+	/* deactivated while the job was queued */
+	if (!job->self->activated_as)
+		return -ENODEV;
+
+	return CryptSetupJob_run_slot(job, CryptSetup_Resume_slot);
+}
+
+static int CryptSetup_Resume_parse(CryptSetupJob *job, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"passphrase", "slot", NULL};
+
+	if (!job->self->activated_as){
+		PyErr_SetString(PyExc_IOError, "Device has not been activated yet.");
+		return -1;
+	}
+
+	if (! PyArg_ParseTupleAndKeywords(args, kwds, "|z*i", CONST_CAST(char**)kwlist, &job->passphrase, &job->slot))
+		return -1;
+
+	job->run = CryptSetup_Resume_run;
+	return 0;
+}
+
+static PyObject *CryptSetup_Resume(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_execute(self, args, kwds, CryptSetup_Resume_parse);
+}
+
+static char
+CryptSetup_Suspend_HELP[] =
+"Suspend LUKS device\n\n\
+  luksSupsend()";
+
+static PyObject *CryptSetup_Suspend(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	int is;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	if (!self->activated_as){
+		CryptSetup_unlock(self);
+		PyErr_SetString(PyExc_IOError, "Device has not been activated yet.");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(SUSPEND, crypt_suspend(self->device, self->activated_as));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_setPersistentFlags_HELP[] =
+"Store activation flags in the LUKS2 header\n\n\
+  setPersistentFlags(flags)\n\n\
+  flags - CRYPT_ACTIVATE_* flags applied on every activation";
+
+static PyObject *CryptSetup_setPersistentFlags(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"flags", NULL};
+	uint32_t flags = 0;
+	int is;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "I", CONST_CAST(char**)kwlist, &flags))
+		return NULL;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	is = TIMED(PERSISTENT_FLAGS_SET, crypt_persistent_flags_set(self->device, CRYPT_FLAGS_ACTIVATION, flags));
+	Py_END_ALLOW_THREADS
+
+	CryptSetup_invalidate(self);
+	CryptSetup_unlock(self);
+
+	return PyObjectResult(is);
+}
+
+static char
+CryptSetup_getPersistentFlags_HELP[] =
+"Get activation flags stored in the LUKS2 header\n\n\
+  getPersistentFlags()";
+
+static PyObject *CryptSetup_getPersistentFlags(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	uint32_t flags = 0;
+	int is;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	is = TIMED(PERSISTENT_FLAGS_GET, crypt_persistent_flags_get(self->device, CRYPT_FLAGS_ACTIVATION, &flags));
+
+	CryptSetup_unlock(self);
+
+	if (is < 0)
+		return PyObjectError(is);
+
+	return Py_BuildValue("I", flags);
+}
+
+static char
+CryptSetup_debugLevel_HELP[] =
+"Set debug level\n\n\
+  debugLevel(level)\n\n\
+  level - debug level";
+
+static PyObject *CryptSetup_debugLevel(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"level", NULL};
+	int level = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &level))
+		return NULL;
+
+	crypt_set_debug_level(level);
+
+	Py_RETURN_NONE;
+}
+
+static char
+CryptSetup_iterationTime_HELP[] =
+"Set iteration time\n\n\
+  iterationTime(time_ms)\n\n\
+  time_ms - time in miliseconds";
+
+static PyObject *CryptSetup_iterationTime(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"time_ms", NULL};
+	uint64_t time_ms = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "K", CONST_CAST(char**)kwlist, &time_ms))
+		return NULL;
+
+	if (CryptSetup_lock(self))
+		return NULL;
+
+	crypt_set_iteration_time(self->device, time_ms);
+	self->iteration_time = time_ms > UINT32_MAX ? 0 : time_ms;
+	/* not a setting to hand to the next user of a pooled context */
+	self->pool_clean = 0;
+
+	CryptSetup_unlock(self);
+
+	Py_RETURN_NONE;
+}
+
+#if PY_MAJOR_VERSION >= 3
+static char
+CryptSetup_activate_async_HELP[] =
+"Activate LUKS device on the worker pool\n\n\
+  activate_async(name, passphrase, slot, flags, keyDescription)\n\n\
+  returns an asyncio future resolving to the result of activate()";
+
+static PyObject *CryptSetup_activate_async(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_submit(self, args, kwds, CryptSetup_activate_parse);
+}
+
+static char
+CryptSetup_luksFormat_async_HELP[] =
+"Format device to enable LUKS on the worker pool\n\n\
+  luksFormat_async(cipher = 'aes', cipherMode = 'cbc-essiv:sha256', keysize = 256,\n\
+                   type = 'luks1', sectorSize = 512, dataAlignment = 0, pbkdf = None)\n\n\
+  returns an asyncio future resolving to the result of luksFormat()";
+
+static PyObject *CryptSetup_luksFormat_async(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_submit(self, args, kwds, CryptSetup_luksFormat_parse);
+}
+
+static char
+CryptSetup_addKeyByPassphrase_async_HELP[] =
+"Initialize keyslot using passphrase on the worker pool\n\n\
+  addKeyByPassphrase_async(passphrase, newPassphrase, slot)\n\n\
+  returns an asyncio future resolving to the result of addKeyByPassphrase()";
+
+static PyObject *CryptSetup_addKeyByPassphrase_async(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_submit(self, args, kwds, CryptSetup_addKeyByPassphrase_parse);
+}
+
+static char
+CryptSetup_removePassphrase_async_HELP[] =
+"Destroy keyslot using passphrase on the worker pool\n\n\
+  removePassphrase_async(passphrase, slot)\n\n\
+  returns an asyncio future resolving to the result of removePassphrase()";
+
+static PyObject *CryptSetup_removePassphrase_async(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_submit(self, args, kwds, CryptSetup_removePassphrase_parse);
+}
+
+static char
+CryptSetup_Resume_async_HELP[] =
+"Resume LUKS device on the worker pool\n\n\
+  resume_async(passphrase, slot)\n\n\
+  returns an asyncio future resolving to the result of resume()";
+
+static PyObject *CryptSetup_Resume_async(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+{
+	return CryptSetup_submit(self, args, kwds, CryptSetup_Resume_parse);
+}
+#endif
+
+/* closure is the offset of the callback in CryptSetupObject */
+static PyObject *CryptSetup_callback_get(CryptSetupObject *self, void *closure)
+{
+	PyObject *cb = CryptSetup_get_callback(self, (PyObject **)((char *)self + (size_t)closure));
+
+	if (!cb)
+		PyErr_SetString(PyExc_AttributeError, "Callback is not set");
+
+	return cb;
+}
+
+static int CryptSetup_callback_set(CryptSetupObject *self, PyObject *value, void *closure)
+{
+	CryptSetup_set_callback(self, (PyObject **)((char *)self + (size_t)closure), value);
+	return 0;
+}
+
+static PyGetSetDef CryptSetup_getset[] = {
+	{CONST_CAST(char*)"yesDialogCB", (getter)CryptSetup_callback_get, (setter)CryptSetup_callback_set,
+	 CONST_CAST(char*)"confirmation dialog callback", (void *)offsetof(CryptSetupObject, yesDialogCB)},
+	{CONST_CAST(char*)"cmdLineLogCB", (getter)CryptSetup_callback_get, (setter)CryptSetup_callback_set,
+	 CONST_CAST(char*)"logging callback", (void *)offsetof(CryptSetupObject, cmdLineLogCB)},
+	{NULL}
+};
+
+static PyMethodDef CryptSetup_methods[] = {
+	/* self-test methods */
+	{"log", (PyCFunction)CryptSetup_log, METH_VARARGS|METH_KEYWORDS, CryptSetup_askyes_HELP},
+	{"askyes", (PyCFunction)CryptSetup_askyes, METH_VARARGS|METH_KEYWORDS, CryptSetup_log_HELP},
+
+	/* activation and deactivation */
+	{"deactivate", (PyCFunction)CryptSetup_deactivate, METH_NOARGS, CryptSetup_deactivate_HELP},
+	{"activate", (PyCFunction)CryptSetup_activate, METH_VARARGS|METH_KEYWORDS, CryptSetup_activate_HELP},
+	{"activateByKeyfile", (PyCFunction)CryptSetup_activateByKeyfile, METH_VARARGS|METH_KEYWORDS, CryptSetup_activateByKeyfile_HELP},
+	{"activateByToken", (PyCFunction)CryptSetup_activateByToken, METH_VARARGS|METH_KEYWORDS, CryptSetup_activateByToken_HELP},
+	{"activateByVolumeKey", (PyCFunction)CryptSetup_activateByVolumeKey, METH_VARARGS|METH_KEYWORDS, CryptSetup_activateByVolumeKey_HELP},
+
+	/* cryptsetup info entrypoints */
+	{"luksUUID", (PyCFunction)CryptSetup_luksUUID, METH_NOARGS, CryptSetup_luksUUID_HELP},
+	{"isLuks", (PyCFunction)CryptSetup_isLuks, METH_NOARGS, CryptSetup_isLuks_HELP},
+	{"probe", (PyCFunction)CryptSetup_probe, METH_NOARGS, CryptSetup_probe_HELP},
+	{"info", (PyCFunction)CryptSetup_Info, METH_NOARGS, CryptSetup_Info_HELP},
+	{"status", (PyCFunction)CryptSetup_Status, METH_NOARGS, CryptSetup_Status_HELP},
+	{"keyslots", (PyCFunction)CryptSetup_keyslots, METH_NOARGS, CryptSetup_keyslots_HELP},
+
+	/* cryptsetup mgmt entrypoints */
+	{"load", (PyCFunction)CryptSetup_load, METH_VARARGS|METH_KEYWORDS, CryptSetup_load_HELP},
+	{"setupPlain", (PyCFunction)CryptSetup_setupPlain, METH_VARARGS|METH_KEYWORDS, CryptSetup_setupPlain_HELP},
+	{"luksFormat", (PyCFunction)CryptSetup_luksFormat, METH_VARARGS|METH_KEYWORDS, CryptSetup_luksFormat_HELP},
+	{"addKeyByPassphrase", (PyCFunction)CryptSetup_addKeyByPassphrase, METH_VARARGS|METH_KEYWORDS, CryptSetup_addKeyByPassphrase_HELP},
+	{"addKeyByKeyfile", (PyCFunction)CryptSetup_addKeyByKeyfile, METH_VARARGS|METH_KEYWORDS, CryptSetup_addKeyByKeyfile_HELP},
+	{"addKeyByVolumeKey", (PyCFunction)CryptSetup_addKeyByVolumeKey, METH_VARARGS|METH_KEYWORDS, CryptSetup_addKeyByVolumeKey_HELP},
+	{"getVolumeKey", (PyCFunction)CryptSetup_getVolumeKey, METH_VARARGS|METH_KEYWORDS, CryptSetup_getVolumeKey_HELP},
+	{"removePassphrase", (PyCFunction)CryptSetup_removePassphrase, METH_VARARGS|METH_KEYWORDS, CryptSetup_removePassphrase_HELP},
+	{"removeKeyfile", (PyCFunction)CryptSetup_removeKeyfile, METH_VARARGS|METH_KEYWORDS, CryptSetup_removeKeyfile_HELP},
+	{"rekey", (PyCFunction)CryptSetup_rekey, METH_VARARGS|METH_KEYWORDS, CryptSetup_rekey_HELP},
+	{"killSlot", (PyCFunction)CryptSetup_killSlot, METH_VARARGS|METH_KEYWORDS, CryptSetup_killSlot_HELP},
+
+	/* resize and reencryption */
+	{"resize", (PyCFunction)CryptSetup_resize, METH_VARARGS|METH_KEYWORDS, CryptSetup_resize_HELP},
+	{"reencrypt", (PyCFunction)CryptSetup_reencrypt, METH_VARARGS|METH_KEYWORDS, CryptSetup_reencrypt_HELP},
+
+	/* wipe */
+	{"wipe", (PyCFunction)CryptSetup_wipe, METH_VARARGS|METH_KEYWORDS, CryptSetup_wipe_HELP},
+
+	/* header backup and restore */
+	{"headerBackup", (PyCFunction)CryptSetup_headerBackup, METH_VARARGS|METH_KEYWORDS, CryptSetup_headerBackup_HELP},
+	{"headerRestore", (PyCFunction)CryptSetup_headerRestore, METH_VARARGS|METH_KEYWORDS, CryptSetup_headerRestore_HELP},
+
+	/* suspend resume */
+	{"resume", (PyCFunction)CryptSetup_Resume, METH_VARARGS|METH_KEYWORDS, CryptSetup_Resume_HELP},
+	{"resumeByVolumeKey", (PyCFunction)CryptSetup_resumeByVolumeKey, METH_VARARGS|METH_KEYWORDS, CryptSetup_resumeByVolumeKey_HELP},
+	{"suspend", (PyCFunction)CryptSetup_Suspend, METH_NOARGS, CryptSetup_Suspend_HELP},
+
+	/* kernel keyring */
+	{"addKeyringToken", (PyCFunction)CryptSetup_addKeyringToken, METH_VARARGS|METH_KEYWORDS, CryptSetup_addKeyringToken_HELP},
+	{"volumeKeyKeyring", (PyCFunction)CryptSetup_volumeKeyKeyring, METH_VARARGS|METH_KEYWORDS, CryptSetup_volumeKeyKeyring_HELP},
+
+	/* persistent activation flags */
+	{"setPersistentFlags", (PyCFunction)CryptSetup_setPersistentFlags, METH_VARARGS|METH_KEYWORDS, CryptSetup_setPersistentFlags_HELP},
+	{"getPersistentFlags", (PyCFunction)CryptSetup_getPersistentFlags, METH_NOARGS, CryptSetup_getPersistentFlags_HELP},
+
+	/* logging */
+	{"drainLog", (PyCFunction)CryptSetup_drainLog, METH_NOARGS, CryptSetup_drainLog_HELP},
+	{"setLogFilter", (PyCFunction)CryptSetup_setLogFilter, METH_VARARGS|METH_KEYWORDS, CryptSetup_setLogFilter_HELP},
+
+	/* context management */
+	{"close", (PyCFunction)CryptSetup_close, METH_NOARGS, CryptSetup_close_HELP},
+	{"__enter__", (PyCFunction)CryptSetup_enter, METH_NOARGS, NULL},
+	{"__exit__", (PyCFunction)CryptSetup_exit, METH_VARARGS, NULL},
+
+	/* misc */
+	{"debugLevel", (PyCFunction)CryptSetup_debugLevel, METH_VARARGS|METH_KEYWORDS, CryptSetup_debugLevel_HELP},
+	{"iterationTime", (PyCFunction)CryptSetup_iterationTime, METH_VARARGS|METH_KEYWORDS, CryptSetup_iterationTime_HELP},
+
+#if PY_MAJOR_VERSION >= 3
+	/* asyncio variants running on the worker pool */
+	{"activate_async", (PyCFunction)CryptSetup_activate_async, METH_VARARGS|METH_KEYWORDS, CryptSetup_activate_async_HELP},
+	{"luksFormat_async", (PyCFunction)CryptSetup_luksFormat_async, METH_VARARGS|METH_KEYWORDS, CryptSetup_luksFormat_async_HELP},
+	{"addKeyByPassphrase_async", (PyCFunction)CryptSetup_addKeyByPassphrase_async, METH_VARARGS|METH_KEYWORDS, CryptSetup_addKeyByPassphrase_async_HELP},
+	{"removePassphrase_async", (PyCFunction)CryptSetup_removePassphrase_async, METH_VARARGS|METH_KEYWORDS, CryptSetup_removePassphrase_async_HELP},
+	{"resume_async", (PyCFunction)CryptSetup_Resume_async, METH_VARARGS|METH_KEYWORDS, CryptSetup_Resume_async_HELP},
+#endif
+
+	{NULL} /* Sentinel */
+};
+
+#ifdef MULTI_PHASE_INIT
+static PyType_Slot CryptSetup_slots[] = {
+	{Py_tp_dealloc, (void *)CryptSetup_dealloc},
+	{Py_tp_traverse, (void *)CryptSetup_traverse},
+	{Py_tp_clear, (void *)CryptSetup_clear},
+	{Py_tp_doc, CryptSetup_HELP},
+	{Py_tp_methods, CryptSetup_methods},
+	{Py_tp_getset, CryptSetup_getset},
+	{Py_tp_init, (void *)CryptSetup_init},
+	{Py_tp_new, (void *)CryptSetup_new},
+	{0, NULL}
+};
+
+static PyType_Spec CryptSetup_spec = {
+	"pycryptsetup.CryptSetup",
+	sizeof(CryptSetupObject),
+	0,
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_IMMUTABLETYPE | Py_TPFLAGS_HAVE_GC,
+	CryptSetup_slots
+};
+#else
+static PyTypeObject CryptSetupType = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	"pycryptsetup.CryptSetup", /*tp_name*/
+	sizeof(CryptSetupObject), /*tp_basicsize*/
+	0, /*tp_itemsize*/
+	(destructor)CryptSetup_dealloc, /*tp_dealloc*/
+	0, /*tp_print*/
+	0, /*tp_getattr*/
+	0, /*tp_setattr*/
+	0, /*tp_compare*/
+	0, /*tp_repr*/
+	0, /*tp_as_number*/
+	0, /*tp_as_sequence*/
+	0, /*tp_as_mapping*/
+	0, /*tp_hash */
+	0, /*tp_call*/
+	0, /*tp_str*/
+	0, /*tp_getattro*/
+	0, /*tp_setattro*/
+	0, /*tp_as_buffer*/
+	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
+	CryptSetup_HELP, /* tp_doc */
+	(traverseproc)CryptSetup_traverse, /* tp_traverse */
+	(inquiry)CryptSetup_clear, /* tp_clear */
+	0, /* tp_richcompare */
+	0, /* tp_weaklistoffset */
+	0, /* tp_iter */
+	0, /* tp_iternext */
+	CryptSetup_methods, /* tp_methods */
+	0, /* tp_members */
+	CryptSetup_getset, /* tp_getset */
+	0, /* tp_base */
+	0, /* tp_dict */
+	0, /* tp_descr_get */
+	0, /* tp_descr_set */
+	0, /* tp_dictoffset */
+	(initproc)CryptSetup_init, /* tp_init */
+	0, /* tp_alloc */
+	CryptSetup_new, /* tp_new */
+};
+#endif
+
+static char
+pycryptsetup_set_pool_size_HELP[] =
+"Set the size of the worker pool used by the *_async methods\n\n\
+  set_pool_size(threads)\n\n\
+  threads - maximum number of worker threads, 0 for one per online CPU\n\n\
+  At interpreter exit queued jobs are cancelled and running ones are\n\
+  waited for; *_async calls made after that raise RuntimeError.";
+
+static PyObject *pycryptsetup_set_pool_size(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"threads", NULL};
+	int threads = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &threads))
+		return NULL;
+
+	if (threads < 0) {
+		PyErr_SetString(PyExc_ValueError, "threads must not be negative");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&pool.mutex);
+	pool.max_threads = threads ?: pool_default_size();
+	/* wake idle workers so the surplus ones exit */
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.mutex);
+
+	Py_RETURN_NONE;
+}
+
+static char
+pycryptsetup_pool_size_HELP[] =
+"Get the size of the worker pool used by the *_async methods\n\n\
+  pool_size()";
+
+static PyObject *pycryptsetup_pool_size(PyObject *unused, PyObject *args)
+{
+	int threads;
+
+	pthread_mutex_lock(&pool.mutex);
+	threads = pool.max_threads ?: pool_default_size();
+	pthread_mutex_unlock(&pool.mutex);
+
+	return PyObjectResult(threads);
+}
+
+/*
+ * Batch operations. Every entry gets its own crypt_device context, so the
+ * entries are independent and a fixed set of native threads just pulls the
+ * next one off a shared index until all are done.
+ */
+typedef struct {
+	char *device;
+	char *name;
+	Py_buffer passphrase;
+	char *keyfile;
+	char *header;
+	size_t header_size;
+	int result;
+} BatchEntry;
+
+typedef struct {
+	pthread_mutex_t mutex;
+	int (*run)(BatchEntry *e);
+	BatchEntry *entries;
+	int count;
+	int next;
+} Batch;
+
+static int batch_activate_one(BatchEntry *e)
+{
+	struct crypt_device *cd = NULL;
+	int r;
+
+	r = TIMED(INIT, crypt_init(&cd, e->device));
+	if (r)
+		return r;
+
+	r = TIMED(LOAD, crypt_load(cd, NULL, NULL));
+	if (!r && e->keyfile)
+		r = TIMED(ACTIVATE_KEYFILE, crypt_activate_by_keyfile_offset(cd, e->name, CRYPT_ANY_SLOT,
+						     e->keyfile, 0, 0, 0));
+	else if (!r)
+		r = TIMED(ACTIVATE_PASSPHRASE, crypt_activate_by_passphrase(cd, e->name, CRYPT_ANY_SLOT,
+						 e->passphrase.buf, e->passphrase.len, 0));
+
+	crypt_free(cd);
+	return r;
+}
+
+static void *batch_worker(void *arg)
+{
+	Batch *batch = arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&batch->mutex);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->mutex);
+
+		if (i >= batch->count)
+			break;
+
+		batch->entries[i].result = batch->run(&batch->entries[i]);
+	}
+
+	return NULL;
+}
+
+static void batch_run(Batch *batch, int workers)
+{
+	pthread_t *threads;
+	int i, started = 0;
+
+	threads = workers > 0 ? calloc(workers, sizeof(*threads)) : NULL;
+	if (threads)
+		for (started = 0; started < workers; started++)
+			if (pthread_create(&threads[started], NULL, batch_worker, batch))
+				break;
+
+	/* whatever could not be handed to a thread runs here */
+	batch_worker(batch);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+}
+
+static void batch_free(Batch *batch)
+{
+	int i;
+
+	for (i = 0; i < batch->count; i++) {
+		free(batch->entries[i].device);
+		free(batch->entries[i].name);
+		free(batch->entries[i].keyfile);
+		header_free(batch->entries[i].header, batch->entries[i].header_size);
+		PyBuffer_Release(&batch->entries[i].passphrase);
+	}
+	free(batch->entries);
 }
 
 static char
-CryptSetup_Info_HELP[] =
-"Returns dictionary with info about opened device\nKeys:\n\
-  dir\n  name\n  uuid\n  cipher\n  cipher_mode\n  keysize\n  device\n\
-  offset\n  size\n  skip\n  mode\n";
+pycryptsetup_activate_many_HELP[] =
+"Activate several LUKS devices concurrently\n\n\
+  activate_many(entries, workers)\n\n\
+  entries - sequence of (device, name, passphrase[, keyfile]) tuples,\n\
+            passphrase may be None when keyfile is given\n\
+  workers - number of native threads, 0 for one per online CPU\n\n\
+  returns a list with the result of activation (or -errno) per entry";
+
+static PyObject *pycryptsetup_activate_many(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"entries", "workers", NULL};
+	PyObject *entries, *seq, *result = NULL, *value;
+	char *device, *name, *keyfile;
+	Batch batch = { PTHREAD_MUTEX_INITIALIZER, batch_activate_one, NULL, 0, 0 };
+	int workers = 0, i;
 
-static PyObject *CryptSetup_Info(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", CONST_CAST(char**)kwlist, &entries, &workers))
+		return NULL;
+
+	if (workers < 0) {
+		PyErr_SetString(PyExc_ValueError, "workers must not be negative");
+		return NULL;
+	}
+
+	seq = PySequence_Fast(entries, "entries must be a sequence");
+	if (!seq)
+		return NULL;
+
+	batch.count = PySequence_Fast_GET_SIZE(seq);
+	batch.entries = calloc(batch.count ?: 1, sizeof(*batch.entries));
+	if (!batch.entries) {
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+
+	for (i = 0; i < batch.count; i++) {
+		device = name = keyfile = NULL;
+		if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "ssz*|z;entry must be (device, name, passphrase[, keyfile])",
+				      &device, &name, &batch.entries[i].passphrase, &keyfile))
+			goto out;
+
+		if (!batch.entries[i].passphrase.buf && !keyfile) {
+			PyErr_SetString(PyExc_ValueError, "Either passphrase or keyfile has to be specified");
+			goto out;
+		}
+
+		if (job_strdup(&batch.entries[i].device, device) ||
+		    job_strdup(&batch.entries[i].name, name) ||
+		    job_strdup(&batch.entries[i].keyfile, keyfile))
+			goto out;
+	}
+
+	if (!workers)
+		workers = pool_default_size();
+	if (workers > batch.count)
+		workers = batch.count;
+
+	Py_BEGIN_ALLOW_THREADS
+	/* the calling thread is one of the workers */
+	batch_run(&batch, workers - 1);
+	Py_END_ALLOW_THREADS
+
+	result = PyList_New(batch.count);
+	if (!result)
+		goto out;
+
+	for (i = 0; i < batch.count; i++) {
+		value = PyObjectResult(batch.entries[i].result);
+		if (!value) {
+			Py_CLEAR(result);
+			goto out;
+		}
+		PyList_SET_ITEM(result, i, value);
+	}
+out:
+	batch_free(&batch);
+	Py_DECREF(seq);
+	return result;
+}
+
+static int batch_header_backup_one(BatchEntry *e)
+{
+	struct crypt_device *cd = NULL;
+	int r;
+
+	r = TIMED(INIT, crypt_init(&cd, e->device));
+	if (r)
+		return r;
+
+	r = TIMED(LOAD, crypt_load(cd, NULL, NULL));
+	if (!r)
+		r = header_backup_mem(cd, &e->header, &e->header_size);
+
+	crypt_free(cd);
+	return r;
+}
+
+static char
+pycryptsetup_header_backup_many_HELP[] =
+"Backup the LUKS headers of several devices concurrently\n\n\
+  header_backup_many(devices, workers)\n\n\
+  devices - sequence of device paths\n\
+  workers - number of native threads, 0 for one per online CPU\n\n\
+  returns a list with the header as bytes (or -errno) per device";
+
+static PyObject *pycryptsetup_header_backup_many(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"devices", "workers", NULL};
+	PyObject *devices, *seq, *result = NULL, *value;
+	char *device;
+	Batch batch = { PTHREAD_MUTEX_INITIALIZER, batch_header_backup_one, NULL, 0, 0 };
+	int workers = 0, i;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|i", CONST_CAST(char**)kwlist, &devices, &workers))
+		return NULL;
+
+	if (workers < 0) {
+		PyErr_SetString(PyExc_ValueError, "workers must not be negative");
+		return NULL;
+	}
+
+	seq = PySequence_Fast(devices, "devices must be a sequence");
+	if (!seq)
+		return NULL;
+
+	batch.count = PySequence_Fast_GET_SIZE(seq);
+	batch.entries = calloc(batch.count ?: 1, sizeof(*batch.entries));
+	if (!batch.entries) {
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+
+	for (i = 0; i < batch.count; i++) {
+		if (!PyArg_Parse(PySequence_Fast_GET_ITEM(seq, i), "s;device must be a path", &device) ||
+		    job_strdup(&batch.entries[i].device, device))
+			goto out;
+	}
+
+	if (!workers)
+		workers = pool_default_size();
+	if (workers > batch.count)
+		workers = batch.count;
+
+	Py_BEGIN_ALLOW_THREADS
+	/* the calling thread is one of the workers */
+	batch_run(&batch, workers - 1);
+	Py_END_ALLOW_THREADS
+
+	result = PyList_New(batch.count);
+	if (!result)
+		goto out;
+
+	for (i = 0; i < batch.count; i++) {
+		if (batch.entries[i].result < 0)
+			value = PyObjectResult(batch.entries[i].result);
+		else
+			value = PyBytes_FromStringAndSize(batch.entries[i].header,
+							  batch.entries[i].header_size);
+		if (!value) {
+			Py_CLEAR(result);
+			goto out;
+		}
+		PyList_SET_ITEM(result, i, value);
+	}
+out:
+	batch_free(&batch);
+	Py_DECREF(seq);
+	return result;
+}
+
+static char
+pycryptsetup_set_slot_cache_HELP[] =
+"Enable or disable the last successful keyslot cache\n\n\
+  set_slot_cache(enabled)\n\n\
+  enabled - try the keyslot that last opened a device (by UUID) first\n\
+            when activate, resume or removePassphrase get no slot";
+
+static PyObject *pycryptsetup_set_slot_cache(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"enabled", NULL};
+	int enabled = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &enabled))
+		return NULL;
+
+	pthread_mutex_lock(&slot_cache.mutex);
+	__atomic_store_n(&slot_cache.enabled, !!enabled, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&slot_cache.mutex);
+
+	Py_RETURN_NONE;
+}
+
+static char
+pycryptsetup_slot_cache_stats_HELP[] =
+"Returns dictionary with keyslot cache counters\nKeys:\n\
+  enabled\n  entries\n  hits\n  misses\n";
+
+static PyObject *pycryptsetup_slot_cache_stats(PyObject *unused, PyObject *args)
 {
 	PyObject *result;
 
-	result = Py_BuildValue("{s:s,s:s,s:z,s:s,s:s,s:s,s:i,s:K}",
-				"dir",		crypt_get_dir(),
-				"device",	crypt_get_device_name(self->device),
-				"name",		self->activated_as,
-				"uuid",		crypt_get_uuid(self->device),
-				"cipher",	crypt_get_cipher(self->device),
-				"cipher_mode",	crypt_get_cipher_mode(self->device),
-				"keysize",	crypt_get_volume_key_size(self->device) * 8,
-				//"size",	co.size,
-				//"mode",	(co.flags & CRYPT_FLAG_READONLY) ? "readonly" : "read/write",
-				"offset",	crypt_get_data_offset(self->device)
+	pthread_mutex_lock(&slot_cache.mutex);
+	result = Py_BuildValue("{s:O,s:i,s:K,s:K}",
+				"enabled",	slot_cache.enabled ? Py_True : Py_False,
+				"entries",	slot_cache.count,
+				"hits",		slot_cache.hits,
+				"misses",	slot_cache.misses
 				);
+	pthread_mutex_unlock(&slot_cache.mutex);
 
 	if (!result)
 		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for return value");
@@ -364,345 +5497,988 @@ static PyObject *CryptSetup_Info(CryptSetupObject* self, PyObject *args, PyObjec
 }
 
 static char
-CryptSetup_luksFormat_HELP[] =
-"Format device to enable LUKS\n\n\
-  luksFormat(cipher = 'aes', cipherMode = 'cbc-essiv:sha256', keysize = 256)\n\n\
+pycryptsetup_clear_slot_cache_HELP[] =
+"Drop all cached keyslots and reset the cache counters\n\n\
+  clear_slot_cache()";
+
+static PyObject *pycryptsetup_clear_slot_cache(PyObject *unused, PyObject *args)
+{
+	pthread_mutex_lock(&slot_cache.mutex);
+	free(slot_cache.entries);
+	slot_cache.entries = NULL;
+	slot_cache.count = 0;
+	slot_cache.hits = 0;
+	slot_cache.misses = 0;
+	pthread_mutex_unlock(&slot_cache.mutex);
+
+	Py_RETURN_NONE;
+}
+
+static char
+pycryptsetup_set_pbkdf_cache_HELP[] =
+"Enable or disable the persistent PBKDF calibration cache\n\n\
+  set_pbkdf_cache(path, maxAge)\n\n\
+  path   - cache file, created on the first calibration; None disables\n\
+           the cache\n\
+  maxAge - seconds after which a calibration is repeated (default 30 days)\n\n\
+  luksFormat and the keyslot adding methods then calibrate a KDF setting\n\
+  (type, hash, iterationTime, memory, threads, key size) once per CPU\n\
+  model and reuse the stored costs instead of benchmarking every time";
+
+static PyObject *pycryptsetup_set_pbkdf_cache(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"path", "maxAge", NULL};
+	long long max_age = PBKDF_CACHE_MAX_AGE;
+	char *path = NULL, *copy = NULL, *old;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "z|L", CONST_CAST(char**)kwlist, &path, &max_age))
+		return NULL;
+
+	if (max_age < 0) {
+		PyErr_SetString(PyExc_ValueError, "maxAge must not be negative");
+		return NULL;
+	}
+
+	if (path && !(copy = strdup(path)))
+		return PyErr_NoMemory();
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&pbkdf_cache.mutex);
+	old = pbkdf_cache.path;
+	free(pbkdf_cache.entries);
+	pbkdf_cache.entries = NULL;
+	pbkdf_cache.count = 0;
+	pbkdf_cache.max_age = max_age;
+	__atomic_store_n(&pbkdf_cache.path, copy, __ATOMIC_RELAXED);
+	if (copy) {
+		if (!pbkdf_cache.cpu[0])
+			pbkdf_cache_cpu(pbkdf_cache.cpu, sizeof(pbkdf_cache.cpu));
+		pbkdf_cache_read();
+	}
+	pthread_mutex_unlock(&pbkdf_cache.mutex);
+	Py_END_ALLOW_THREADS
+
+	free(old);
+
+	Py_RETURN_NONE;
+}
+
+static char
+pycryptsetup_pbkdf_cache_HELP[] =
+"Returns dictionary describing the PBKDF calibration cache\nKeys:\n\
+  path\n  max_age\n  cpu\n  hits\n  misses\n\
+  entries - list of dictionaries with cpu, type, hash, time_ms,\n\
+            max_memory_kb, parallel_threads, key_size (the key) and\n\
+            iterations, memory_kb, threads, created (the calibration)\n";
+
+static PyObject *pycryptsetup_pbkdf_cache(PyObject *unused, PyObject *args)
+{
+	PyObject *result = NULL, *entries, *item;
+	PbkdfCacheEntry *e;
+	int i;
+
+	pthread_mutex_lock(&pbkdf_cache.mutex);
+
+	entries = PyList_New(pbkdf_cache.count);
+	for (i = 0; entries && i < pbkdf_cache.count; i++) {
+		e = &pbkdf_cache.entries[i];
+		item = Py_BuildValue("{s:s,s:s,s:s,s:I,s:I,s:I,s:I,s:I,s:I,s:I,s:L}",
+				     "cpu",		e->cpu,
+				     "type",		e->type,
+				     "hash",		e->hash,
+				     "time_ms",		e->time_ms,
+				     "max_memory_kb",	e->max_memory_kb,
+				     "parallel_threads", e->parallel_threads,
+				     "key_size",	e->key_size,
+				     "iterations",	e->iterations,
+				     "memory_kb",	e->memory_kb,
+				     "threads",		e->threads,
+				     "created",		e->created);
+		if (!item) {
+			Py_CLEAR(entries);
+			break;
+		}
+		PyList_SET_ITEM(entries, i, item);
+	}
+
+	if (entries)
+		result = Py_BuildValue("{s:z,s:L,s:s,s:K,s:K,s:N}",
+				       "path",		pbkdf_cache.path,
+				       "max_age",	pbkdf_cache.max_age,
+				       "cpu",		pbkdf_cache.cpu,
+				       "hits",		pbkdf_cache.hits,
+				       "misses",	pbkdf_cache.misses,
+				       "entries",	entries);
+
+	pthread_mutex_unlock(&pbkdf_cache.mutex);
+
+	return result;
+}
+
+static char
+pycryptsetup_clear_pbkdf_cache_HELP[] =
+"Drop all PBKDF calibrations, also from the cache file, and reset the\n\
+cache counters\n\n\
+  clear_pbkdf_cache()";
+
+static PyObject *pycryptsetup_clear_pbkdf_cache(PyObject *unused, PyObject *args)
+{
+	int r = 0;
+
+	pthread_mutex_lock(&pbkdf_cache.mutex);
+	free(pbkdf_cache.entries);
+	pbkdf_cache.entries = NULL;
+	pbkdf_cache.count = 0;
+	pbkdf_cache.hits = 0;
+	pbkdf_cache.misses = 0;
+	if (pbkdf_cache.path && unlink(pbkdf_cache.path) && errno != ENOENT)
+		r = -errno;
+	pthread_mutex_unlock(&pbkdf_cache.mutex);
+
+	if (r)
+		return PyObjectError(r);
+
+	Py_RETURN_NONE;
+}
+
+static char
+pycryptsetup_set_context_pool_HELP[] =
+"Set the number of idle device contexts kept for reuse\n\n\
+  set_context_pool(size)\n\n\
+  size - idle contexts kept across all devices, 0 (default) disables\n\
+         the pool and frees the idle contexts\n\n\
+  CryptSetup(device=...) and CryptSetup(name=...) then reuse a context\n\
+  released by close(), a with block or garbage collection, as long as\n\
+  the header on disk did not change in between";
+
+/* Frees idle contexts until at most keep are left, needs the pool mutex. */
+static void context_pool_drain(int keep)
+{
+	PooledContext *e;
+
+	while (context_pool.count > keep) {
+		e = &context_pool.entries[--context_pool.count];
+		crypt_free(e->cd);
+		free(e->key);
+	}
+	if (!context_pool.count) {
+		free(context_pool.entries);
+		context_pool.entries = NULL;
+	}
+}
+
+static void context_pool_trim(int size)
+{
+	pthread_mutex_lock(&context_pool.mutex);
+	__atomic_store_n(&context_pool.size, size, __ATOMIC_RELAXED);
+	context_pool_drain(size);
+	pthread_mutex_unlock(&context_pool.mutex);
+}
+
+static PyObject *pycryptsetup_set_context_pool(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"size", NULL};
+	int size = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &size))
+		return NULL;
+
+	if (size < 0) {
+		PyErr_SetString(PyExc_ValueError, "size must not be negative");
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	context_pool_trim(size);
+	Py_END_ALLOW_THREADS
+
+	Py_RETURN_NONE;
+}
+
+static char
+pycryptsetup_context_pool_stats_HELP[] =
+"Returns dictionary with context pool counters\nKeys:\n\
+  size\n  idle\n  hits\n  misses\n  stale\n";
+
+static PyObject *pycryptsetup_context_pool_stats(PyObject *unused, PyObject *args)
+{
+	PyObject *result;
+
+	pthread_mutex_lock(&context_pool.mutex);
+	result = Py_BuildValue("{s:i,s:i,s:K,s:K,s:K}",
+				"size",		context_pool.size,
+				"idle",		context_pool.count,
+				"hits",		context_pool.hits,
+				"misses",	context_pool.misses,
+				"stale",	context_pool.stale
+				);
+	pthread_mutex_unlock(&context_pool.mutex);
+
+	if (!result)
+		PyErr_SetString(PyExc_RuntimeError, "Error during constructing values for return value");
+
+	return result;
+}
+
+static char
+pycryptsetup_clear_context_pool_HELP[] =
+"Free all idle device contexts and reset the pool counters\n\n\
+  clear_context_pool()";
+
+static PyObject *pycryptsetup_clear_context_pool(PyObject *unused, PyObject *args)
+{
+	Py_BEGIN_ALLOW_THREADS
+	pthread_mutex_lock(&context_pool.mutex);
+	context_pool_drain(0);
+	context_pool.hits = 0;
+	context_pool.misses = 0;
+	context_pool.stale = 0;
+	pthread_mutex_unlock(&context_pool.mutex);
+	Py_END_ALLOW_THREADS
+
+	Py_RETURN_NONE;
+}
+
+/* The cipher benchmark works on raw blocks, only ECB needs no IV. */
+static int benchmark_iv_size(const char *cipher_mode)
+{
+	return strncmp(cipher_mode, "ecb", 3) ? 16 : 0;
+}
+
+static int benchmark_cipher_run(const char *cipher, const char *cipher_mode, int keysize,
+				size_t buffer_size, double *enc, double *dec)
+{
+	int r;
+
+	Py_BEGIN_ALLOW_THREADS
+	r = TIMED(BENCHMARK, crypt_benchmark(NULL, cipher, cipher_mode, keysize / 8,
+			    benchmark_iv_size(cipher_mode), buffer_size, enc, dec));
+	Py_END_ALLOW_THREADS
+
+	return r;
+}
+
+static char
+pycryptsetup_benchmark_cipher_HELP[] =
+"Measure in-memory throughput of a cipher\n\n\
+  benchmark_cipher(cipher = 'aes', cipherMode = 'xts-plain64', keysize = 256, bufferSize = 1048576)\n\n\
   cipher - cipher specification, e.g. aes, serpent\n\
   cipherMode - cipher mode specification, e.g. cbc-essiv:sha256, xts-plain64\n\
-  keysize - key size in bits";
+  keysize - key size in bits\n\
+  bufferSize - size of the buffer processed in one pass in bytes\n\n\
+  returns dictionary with encryption and decryption speed in MiB/s";
 
-static PyObject *CryptSetup_luksFormat(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static PyObject *pycryptsetup_benchmark_cipher(PyObject *unused, PyObject *args, PyObject *kwds)
 {
-	static const char *kwlist[] = {"cipher", "cipherMode", "keysize", NULL};
-	char *cipher_mode = NULL, *cipher = NULL;
-	int keysize = 256;
-	PyObject *keysize_object = NULL;
+	static const char *kwlist[] = {"cipher", "cipherMode", "keysize", "bufferSize", NULL};
+	const char *cipher = "aes", *cipher_mode = "xts-plain64";
+	int keysize = 256, r;
+	Py_ssize_t buffer_size = 1024 * 1024;
+	double enc = 0, dec = 0;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ssin", CONST_CAST(char**)kwlist,
+					 &cipher, &cipher_mode, &keysize, &buffer_size))
+		return NULL;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|zzO", CONST_CAST(char**)kwlist,
-					&cipher, &cipher_mode, &keysize_object))
+	if (keysize <= 0 || keysize % 8) {
+		PyErr_SetString(PyExc_ValueError, "keysize must be positive number dividable by 8");
 		return NULL;
+	}
 
-	if (!keysize_object || keysize_object == Py_None) {
-		/* use default value */
-	} else if (!PyInt_Check(keysize_object)) {
-		PyErr_SetString(PyExc_TypeError, "keysize must be an integer");
+	if (buffer_size <= 0) {
+		PyErr_SetString(PyExc_ValueError, "bufferSize must be positive number");
 		return NULL;
-	} else if (PyInt_AsLong(keysize_object) % 8) {
-		PyErr_SetString(PyExc_TypeError, "keysize must have integer value dividable by 8");
+	}
+
+	r = benchmark_cipher_run(cipher, cipher_mode, keysize, buffer_size, &enc, &dec);
+	if (r < 0)
+		return PyObjectError(r);
+
+	return Py_BuildValue("{s:d,s:d}", "encryption", enc, "decryption", dec);
+}
+
+static char
+pycryptsetup_benchmark_pbkdf_HELP[] =
+"Measure a key derivation function\n\n\
+  benchmark_pbkdf(pbkdf = 'pbkdf2', hash = 'sha256', time_ms = 1000, maxMemoryKb = 0, parallelThreads = 0, keysize = 256)\n\n\
+  pbkdf - pbkdf2, argon2i or argon2id\n\
+  hash - hash used by pbkdf2\n\
+  time_ms - target unlock time in miliseconds\n\
+  maxMemoryKb, parallelThreads - argon2 limits, 0 for library defaults\n\
+  keysize - volume key size in bits\n\n\
+  returns dictionary with the cost parameters reaching time_ms;\n\
+  for pbkdf2 with time_ms = 1000 iterations are iterations per second\n\
+Keys:\n\
+  type\n  hash\n  time_ms\n  iterations\n  max_memory_kb\n  parallel_threads\n";
+
+static PyObject *pycryptsetup_benchmark_pbkdf(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"pbkdf", "hash", "time_ms", "maxMemoryKb", "parallelThreads", "keysize", NULL};
+	static const char salt[] = "0123456789abcdef0123456789abcdef";
+	const struct crypt_pbkdf_type *defaults;
+	struct crypt_pbkdf_type pbkdf = {
+		.type = CRYPT_KDF_PBKDF2,
+		.hash = "sha256",
+		.time_ms = 1000,
+	};
+	int keysize = 256, r;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|ssIIIi", CONST_CAST(char**)kwlist,
+					 &pbkdf.type, &pbkdf.hash, &pbkdf.time_ms, &pbkdf.max_memory_kb,
+					 &pbkdf.parallel_threads, &keysize))
 		return NULL;
-	} else if (PyInt_AsLong(keysize_object) <= 0) {
-		PyErr_SetString(PyExc_TypeError, "keysize must be positive number bigger than 0");
+
+	if (keysize <= 0 || keysize % 8) {
+		PyErr_SetString(PyExc_ValueError, "keysize must be positive number dividable by 8");
 		return NULL;
-	} else
-		keysize = PyInt_AsLong(keysize_object);
+	}
 
-	// FIXME use #defined defaults
-	return PyObjectResult(crypt_format(self->device, CRYPT_LUKS1,
-				cipher ?: "aes", cipher_mode ?: "cbc-essiv:sha256",
-				NULL, NULL, keysize / 8, NULL));
+	defaults = crypt_get_pbkdf_type_params(pbkdf.type);
+	if (!defaults) {
+		PyErr_SetString(PyExc_ValueError, "Unknown pbkdf type");
+		return NULL;
+	}
+
+	if (!pbkdf.max_memory_kb)
+		pbkdf.max_memory_kb = defaults->max_memory_kb;
+	if (!pbkdf.parallel_threads)
+		pbkdf.parallel_threads = defaults->parallel_threads;
+
+	Py_BEGIN_ALLOW_THREADS
+	r = TIMED(BENCHMARK_PBKDF, crypt_benchmark_pbkdf(NULL, &pbkdf, "foo", 3, salt, sizeof(salt) - 1,
+				  keysize / 8, NULL, NULL));
+	Py_END_ALLOW_THREADS
+
+	if (r < 0)
+		return PyObjectError(r);
+
+	return Py_BuildValue("{s:s,s:z,s:I,s:I,s:I,s:I}",
+				"type",			pbkdf.type,
+				"hash",			pbkdf.hash,
+				"time_ms",		pbkdf.time_ms,
+				"iterations",		pbkdf.iterations,
+				"max_memory_kb",	pbkdf.max_memory_kb,
+				"parallel_threads",	pbkdf.parallel_threads
+				);
 }
 
-static char
-CryptSetup_addKeyByPassphrase_HELP[] =
-"Initialize keyslot using passphrase\n\n\
-  addKeyByPassphrase(passphrase, newPassphrase, slot)\n\n\
-  passphrase - string or none to ask the user\n\
-  newPassphrase - passphrase to add\n\
-  slot - which slot to use (optional)";
+typedef struct {
+	Py_ssize_t index;
+	double enc, dec;
+} BenchmarkRank;
 
-static PyObject *CryptSetup_addKeyByPassphrase(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+/* fastest first */
+static int benchmark_rank_cmp(const void *a, const void *b)
 {
-	static const char *kwlist[] = {"passphrase", "newPassphrase", "slot", NULL};
-	char *passphrase = NULL, *newpassphrase = NULL;
-	size_t passphrase_len = 0, newpassphrase_len = 0;
-	int slot = CRYPT_ANY_SLOT;
+	const BenchmarkRank *x = a, *y = b;
+	double sx = x->enc + x->dec, sy = y->enc + y->dec;
+
+	return sx < sy ? 1 : sx > sy ? -1 : 0;
+}
+
+static char
+pycryptsetup_choose_fastest_HELP[] =
+"Benchmark several cipher candidates and rank them\n\n\
+  choose_fastest(candidates, bufferSize = 1048576)\n\n\
+  candidates - sequence of (cipher, cipherMode, keysize) tuples\n\n\
+  returns list of dictionaries with keys cipher, cipher_mode, keysize,\n\
+  encryption and decryption, fastest (by mean of both speeds) first;\n\
+  candidates not supported by the kernel are left out";
+
+static PyObject *pycryptsetup_choose_fastest(PyObject *unused, PyObject *args, PyObject *kwds)
+{
+	static const char *kwlist[] = {"candidates", "bufferSize", NULL};
+	BenchmarkRank *ranks;
+	PyObject *candidates, *seq, *result = NULL, *item;
+	const char *cipher, *cipher_mode;
+	Py_ssize_t buffer_size = 1024 * 1024, i, n, count = 0;
+	int keysize, r;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "O|n", CONST_CAST(char**)kwlist, &candidates, &buffer_size))
+		return NULL;
+
+	if (buffer_size <= 0) {
+		PyErr_SetString(PyExc_ValueError, "bufferSize must be positive number");
+		return NULL;
+	}
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "ss|i", CONST_CAST(char**)kwlist, &passphrase, &newpassphrase, &slot))
+	seq = PySequence_Fast(candidates, "candidates must be a sequence");
+	if (!seq)
 		return NULL;
 
-	if(passphrase)
-		passphrase_len = strlen(passphrase);
+	n = PySequence_Fast_GET_SIZE(seq);
+	ranks = calloc(n ?: 1, sizeof(*ranks));
+	if (!ranks) {
+		Py_DECREF(seq);
+		return PyErr_NoMemory();
+	}
+
+	/* one at a time, concurrent runs would skew each other */
+	for (i = 0; i < n; i++) {
+		if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, i), "ssi;candidate must be (cipher, cipherMode, keysize)",
+				      &cipher, &cipher_mode, &keysize))
+			goto out;
+
+		if (keysize <= 0 || keysize % 8)
+			continue;
 
-	if(newpassphrase)
-		newpassphrase_len = strlen(newpassphrase);
+		r = benchmark_cipher_run(cipher, cipher_mode, keysize, buffer_size,
+					 &ranks[count].enc, &ranks[count].dec);
+		if (r < 0)
+			continue;
 
-	return PyObjectResult(crypt_keyslot_add_by_passphrase(self->device, slot,
-					passphrase, passphrase_len,
-					newpassphrase, newpassphrase_len));
+		ranks[count].index = i;
+		count++;
+	}
+
+	qsort(ranks, count, sizeof(*ranks), benchmark_rank_cmp);
+
+	result = PyList_New(count);
+	if (!result)
+		goto out;
+
+	for (i = 0; i < count; i++) {
+		PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq, ranks[i].index), "ssi",
+				 &cipher, &cipher_mode, &keysize);
+		item = Py_BuildValue("{s:s,s:s,s:i,s:d,s:d}",
+				     "cipher",		cipher,
+				     "cipher_mode",	cipher_mode,
+				     "keysize",		keysize,
+				     "encryption",	ranks[i].enc,
+				     "decryption",	ranks[i].dec);
+		if (!item) {
+			Py_CLEAR(result);
+			goto out;
+		}
+		PyList_SET_ITEM(result, i, item);
+	}
+out:
+	free(ranks);
+	Py_DECREF(seq);
+	return result;
 }
 
 static char
-CryptSetup_addKeyByVolumeKey_HELP[] =
-"Initialize keyslot using cached volume key\n\n\
-  addKeyByVolumeKey(passphrase, newPassphrase, slot)\n\n\
-  newPassphrase - passphrase to add\n\
-  slot - which slot to use (optional)";
+pycryptsetup_set_stats_HELP[] =
+"Enable or disable libcryptsetup call accounting\n\n\
+  set_stats(enabled)\n\n\
+  enabled - time every libcryptsetup call, off by default";
 
-static PyObject *CryptSetup_addKeyByVolumeKey(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static PyObject *pycryptsetup_set_stats(PyObject *unused, PyObject *args, PyObject *kwds)
 {
-	static const char *kwlist[] = {"newPassphrase", "slot", NULL};
-	char *newpassphrase = NULL;
-	size_t newpassphrase_len = 0;
-	int slot = CRYPT_ANY_SLOT;
+	static const char *kwlist[] = {"enabled", NULL};
+	int enabled = 0;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s|i", CONST_CAST(char**)kwlist, &newpassphrase, &slot))
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &enabled))
 		return NULL;
 
-	if (newpassphrase)
-		newpassphrase_len = strlen(newpassphrase);
+	__atomic_store_n(&stats_enabled, !!enabled, __ATOMIC_RELAXED);
 
-	return PyObjectResult(crypt_keyslot_add_by_volume_key(self->device, slot,
-					NULL, 0, newpassphrase, newpassphrase_len));
+	Py_RETURN_NONE;
 }
 
-static char
-CryptSetup_removePassphrase_HELP[] =
-"Destroy keyslot using passphrase\n\n\
-  removePassphrase(passphrase)\n\n\
-  passphrase - string or none to ask the user";
+/* Upper bound of the bucket holding the percentile, never above the maximum. */
+static uint64_t stat_percentile(const uint64_t *buckets, uint64_t count, uint64_t max, int percent)
+{
+	uint64_t rank = (count * percent + 99) / 100, seen = 0;
+	int i;
 
-static PyObject *CryptSetup_removePassphrase(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+	for (i = 0; i < STAT_BUCKETS; i++) {
+		seen += buckets[i];
+		if (seen >= rank)
+			return stat_bucket_ns(i) < max ? stat_bucket_ns(i) : max;
+	}
+
+	return 0;
+}
+
+static PyObject *stat_build(StatOp *stat)
 {
-	static const char *kwlist[] = {"passphrase", NULL};
-	char *passphrase = NULL;
-	size_t passphrase_len = 0;
-	int is;
+	StatOp copy;
+	PyObject *errors, *key, *value, *result = NULL;
+	uint64_t count = 0;
+	int i;
+
+	for (i = 0; i < STAT_BUCKETS; i++) {
+		copy.buckets[i] = __atomic_load_n(&stat->buckets[i], __ATOMIC_RELAXED);
+		count += copy.buckets[i];
+	}
+	copy.total_ns = __atomic_load_n(&stat->total_ns, __ATOMIC_RELAXED);
+	copy.max_ns = __atomic_load_n(&stat->max_ns, __ATOMIC_RELAXED);
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "s", CONST_CAST(char**)kwlist, &passphrase))
+	if (!count)
 		return NULL;
 
-	if (passphrase)
-		passphrase_len = strlen(passphrase);
+	errors = PyDict_New();
+	if (!errors)
+		return NULL;
 
-	is = crypt_activate_by_passphrase(self->device, NULL, CRYPT_ANY_SLOT,
-					  passphrase, passphrase_len, 0);
-	if (is < 0)
-		return PyObjectResult(is);
+	for (i = 1; i < STAT_ERRNOS; i++) {
+		copy.errors[i] = __atomic_load_n(&stat->errors[i], __ATOMIC_RELAXED);
+		if (!copy.errors[i])
+			continue;
+
+		key = Py_BuildValue("i", i);
+		value = PyLong_FromUnsignedLongLong(copy.errors[i]);
+		if (!key || !value || PyDict_SetItem(errors, key, value)) {
+			Py_XDECREF(key);
+			Py_XDECREF(value);
+			goto out;
+		}
+		Py_DECREF(key);
+		Py_DECREF(value);
+	}
 
-	return PyObjectResult(crypt_keyslot_destroy(self->device, is));
+	result = Py_BuildValue("{s:K,s:O,s:d,s:d,s:d,s:d}",
+				"count",	count,
+				"errors",	errors,
+				"total",	copy.total_ns / 1e9,
+				"p50",		stat_percentile(copy.buckets, count, copy.max_ns, 50) / 1e9,
+				"p99",		stat_percentile(copy.buckets, count, copy.max_ns, 99) / 1e9,
+				"max",		copy.max_ns / 1e9
+				);
+out:
+	Py_DECREF(errors);
+	return result;
 }
 
 static char
-CryptSetup_killSlot_HELP[] =
-"Destroy keyslot\n\n\
-  killSlot(slot)\n\n\
-  slot - the slot to remove";
-
-static PyObject *CryptSetup_killSlot(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+pycryptsetup_stats_HELP[] =
+"Returns libcryptsetup call statistics collected since set_stats(True)\n\n\
+  stats()\n\n\
+  returns dictionary keyed by libcryptsetup function name, values are\n\
+  dictionaries with keys count, errors (errno -> count), total, p50,\n\
+  p99 and max, times in seconds";
+
+static PyObject *pycryptsetup_stats(PyObject *unused, PyObject *args)
 {
-	static const char *kwlist[] = {"slot", NULL};
-	int slot = CRYPT_ANY_SLOT;
+	PyObject *result, *stat;
+	int i;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &slot))
+	result = PyDict_New();
+	if (!result)
 		return NULL;
 
-	switch (crypt_keyslot_status(self->device, slot)) {
-	case CRYPT_SLOT_ACTIVE:
-		return PyObjectResult(crypt_keyslot_destroy(self->device, slot));
-	case CRYPT_SLOT_ACTIVE_LAST:
-		PyErr_SetString(PyExc_ValueError, "Last slot, removing it would render the device unusable");
-		break;
-	case CRYPT_SLOT_INACTIVE:
-		PyErr_SetString(PyExc_ValueError, "Inactive slot");
-		break;
-	case CRYPT_SLOT_INVALID:
-		PyErr_SetString(PyExc_ValueError, "Invalid slot");
-		break;
+	for (i = 0; i < STAT_COUNT; i++) {
+		stat = stat_build(&stats[i]);
+		if (!stat) {
+			if (PyErr_Occurred()) {
+				Py_DECREF(result);
+				return NULL;
+			}
+			continue;
+		}
+
+		if (PyDict_SetItemString(result, stat_names[i], stat)) {
+			Py_DECREF(stat);
+			Py_DECREF(result);
+			return NULL;
+		}
+		Py_DECREF(stat);
 	}
 
-	return NULL;
+	return result;
 }
 
 static char
-CryptSetup_Status_HELP[] =
-"Status of LUKS device\n\n\
-  luksStatus()";
+pycryptsetup_reset_stats_HELP[] =
+"Clear libcryptsetup call statistics\n\n\
+  reset_stats()";
 
-static PyObject *CryptSetup_Status(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static PyObject *pycryptsetup_reset_stats(PyObject *unused, PyObject *args)
 {
-	if (!self->activated_as){
-		PyErr_SetString(PyExc_IOError, "Device has not been activated yet.");
-		return NULL;
-	}
+	uint64_t *counter = (uint64_t *)stats;
+	size_t i;
 
-	return PyObjectResult(crypt_status(self->device, self->activated_as));
+	for (i = 0; i < STAT_COUNT * (sizeof(StatOp) / sizeof(uint64_t)); i++)
+		__atomic_store_n(&counter[i], 0, __ATOMIC_RELAXED);
+
+	Py_RETURN_NONE;
 }
 
-static char
-CryptSetup_Resume_HELP[] =
-"Resume LUKS device\n\n\
-  luksOpen(passphrase)\n\n\
-  passphrase - string or none to ask the user";
+/*
+ * Inventory of active dm-crypt mappings straight from device-mapper: one
+ * DM_DEVICE_LIST ioctl, then one DM_DEVICE_TABLE query per mapping, since
+ * device-mapper has no ioctl returning the tables of all devices at once.
+ * No crypt_device context and no header access are involved. Tables carry
+ * the volume key unless it lives in the kernel keyring, so they are
+ * requested as secure data and wiped.
+ */
+typedef struct {
+	char *name;
+	char *uuid;
+	char *cipher;
+	char device[PATH_MAX];
+	int keysize;
+	uint64_t iv_offset;
+	uint64_t offset;
+	uint64_t size;
+	uint32_t flags;
+	uint32_t sector_size;
+} ActiveMapping;
+
+static const struct {
+	const char *arg;
+	uint32_t flag;
+} dm_crypt_flags[] = {
+	{ "allow_discards",		CRYPT_ACTIVATE_ALLOW_DISCARDS },
+	{ "same_cpu_crypt",		CRYPT_ACTIVATE_SAME_CPU_CRYPT },
+	{ "submit_from_crypt_cpus",	CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS },
+	{ "no_read_workqueue",		CRYPT_ACTIVATE_NO_READ_WORKQUEUE },
+	{ "no_write_workqueue",		CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE },
+	{ NULL, 0 }
+};
 
-static PyObject *CryptSetup_Resume(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+/* Resolves a major:minor device reference to its /dev node. */
+static void dm_backing_device(const char *dev, char *path, size_t path_len)
 {
-	static const char *kwlist[] = {"passphrase", NULL};
-	char* passphrase = NULL;
-	size_t passphrase_len = 0;
+	char link[PATH_MAX], target[PATH_MAX], *base;
+	ssize_t len;
+
+	snprintf(path, path_len, "%s", dev);
+	if (dev[0] == '/')
+		return;
+
+	snprintf(link, sizeof(link), "/sys/dev/block/%s", dev);
+	len = readlink(link, target, sizeof(target) - 1);
+	if (len < 0)
+		return;
+	target[len] = '\0';
+
+	base = strrchr(target, '/');
+	/* keep the major:minor reference rather than a truncated node */
+	if (snprintf(path, path_len, "/dev/%s", base ? base + 1 : target) >= (int)path_len)
+		snprintf(path, path_len, "%s", dev);
+}
 
-	if (!self->activated_as){
-		PyErr_SetString(PyExc_IOError, "Device has not been activated yet.");
-		return NULL;
+/* <cipher> <key> <iv_offset> <device> <offset> [<#opt_params> <opt_params>...] */
+static int dm_crypt_params(const char *params, ActiveMapping *m)
+{
+	char *copy, *tok, *save = NULL;
+	size_t len = strlen(params);
+	int i, n = 0, r = -EINVAL;
+
+	copy = strdup(params);
+	if (!copy)
+		return -ENOMEM;
+
+	if (!(tok = strtok_r(copy, " ", &save)) || !(m->cipher = strdup(tok)))
+		goto out;
+
+	if (!(tok = strtok_r(NULL, " ", &save)))
+		goto out;
+	if (tok[0] == ':')
+		m->keysize = strtoul(tok + 1, NULL, 10) * 8; /* :<size>:<type>:<description> */
+	else if (tok[0] != '-')
+		m->keysize = strlen(tok) * 4;
+
+	if (!(tok = strtok_r(NULL, " ", &save)))
+		goto out;
+	m->iv_offset = strtoull(tok, NULL, 10);
+
+	if (!(tok = strtok_r(NULL, " ", &save)))
+		goto out;
+	dm_backing_device(tok, m->device, sizeof(m->device));
+
+	if (!(tok = strtok_r(NULL, " ", &save)))
+		goto out;
+	m->offset = strtoull(tok, NULL, 10);
+
+	if ((tok = strtok_r(NULL, " ", &save)))
+		n = atoi(tok);
+
+	for (; n > 0 && (tok = strtok_r(NULL, " ", &save)); n--) {
+		if (!strncmp(tok, "sector_size:", 12))
+			m->sector_size = strtoul(tok + 12, NULL, 10);
+		for (i = 0; dm_crypt_flags[i].arg; i++)
+			if (!strcmp(tok, dm_crypt_flags[i].arg))
+				m->flags |= dm_crypt_flags[i].flag;
 	}
 
-	if (! PyArg_ParseTupleAndKeywords(args, kwds, "|s", CONST_CAST(char**)kwlist, &passphrase))
-		return NULL;
-
-	if (passphrase)
-		passphrase_len = strlen(passphrase);
-
-	return PyObjectResult(crypt_resume_by_passphrase(self->device, self->activated_as,
-					CRYPT_ANY_SLOT, passphrase, passphrase_len));
+	r = 0;
+out:
+	crypt_safe_memzero(copy, len);
+	free(copy);
+	return r;
 }
 
-static char
-CryptSetup_Suspend_HELP[] =
-"Suspend LUKS device\n\n\
-  luksSupsend()";
-
-static PyObject *CryptSetup_Suspend(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static int dm_crypt_mapping(const char *name, ActiveMapping *m)
 {
-	if (!self->activated_as){
-		PyErr_SetString(PyExc_IOError, "Device has not been activated yet.");
-		return NULL;
+	struct dm_task *dmt;
+	struct dm_info info;
+	uint64_t start, length;
+	char *target_type = NULL, *params = NULL;
+	const char *uuid;
+	void *next = NULL;
+	int r = -ENODEV;
+
+	dmt = dm_task_create(DM_DEVICE_TABLE);
+	if (!dmt)
+		return -ENOMEM;
+
+	if (!dm_task_secure_data(dmt) || !dm_task_set_name(dmt, name) ||
+	    !dm_task_run(dmt) || !dm_task_get_info(dmt, &info) || !info.exists)
+		goto out;
+
+	next = dm_get_next_target(dmt, next, &start, &length, &target_type, &params);
+	if (!target_type || strcmp(target_type, "crypt") || !params)
+		goto out;
+
+	r = dm_crypt_params(params, m);
+	if (r)
+		goto out;
+
+	/* multi-segment tables (e.g. during reencryption) report the first segment */
+	m->size = length;
+	while (next) {
+		next = dm_get_next_target(dmt, next, &start, &length, &target_type, &params);
+		m->size += length;
 	}
 
-	return PyObjectResult(crypt_suspend(self->device, self->activated_as));
+	if (info.read_only)
+		m->flags |= CRYPT_ACTIVATE_READONLY;
+
+	uuid = dm_task_get_uuid(dmt);
+	if (!(m->name = strdup(name)) || (uuid && *uuid && !(m->uuid = strdup(uuid))))
+		r = -ENOMEM;
+out:
+	dm_task_destroy(dmt);
+	return r;
 }
 
-static char
-CryptSetup_debugLevel_HELP[] =
-"Set debug level\n\n\
-  debugLevel(level)\n\n\
-  level - debug level";
+static void active_mapping_clear(ActiveMapping *m)
+{
+	free(m->name);
+	free(m->uuid);
+	free(m->cipher);
+	memset(m, 0, sizeof(*m));
+}
 
-static PyObject *CryptSetup_debugLevel(CryptSetupObject* self, PyObject *args, PyObject *kwds)
+static void active_mappings_free(ActiveMapping *mappings, int count)
 {
-	static const char *kwlist[] = {"level", NULL};
-	int level = 0;
+	int i;
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "i", CONST_CAST(char**)kwlist, &level))
-		return NULL;
+	for (i = 0; i < count; i++)
+		active_mapping_clear(&mappings[i]);
+	free(mappings);
+}
 
-	crypt_set_debug_level(level);
+static int active_mappings(ActiveMapping **mappings)
+{
+	struct dm_task *dmt;
+	struct dm_names *names;
+	ActiveMapping *list = NULL, *tmp;
+	unsigned int next = 0;
+	int count = 0, r = 0;
+
+	dmt = dm_task_create(DM_DEVICE_LIST);
+	if (!dmt)
+		return -ENOMEM;
+
+	if (!dm_task_run(dmt) || !(names = dm_task_get_names(dmt))) {
+		r = -EINVAL;
+		goto out;
+	}
 
-	Py_RETURN_NONE;
-}
+	if (!names->dev)
+		goto out;
 
-static char
-CryptSetup_iterationTime_HELP[] =
-"Set iteration time\n\n\
-  iterationTime(time_ms)\n\n\
-  time_ms - time in miliseconds";
+	do {
+		names = (struct dm_names *)((char *)names + next);
 
-static PyObject *CryptSetup_iterationTime(CryptSetupObject* self, PyObject *args, PyObject *kwds)
-{
-	static const char *kwlist[] = {"time_ms", NULL};
-	uint64_t time_ms = 0;
+		tmp = realloc(list, (count + 1) * sizeof(*list));
+		if (!tmp) {
+			r = -ENOMEM;
+			goto out;
+		}
+		list = tmp;
+		memset(&list[count], 0, sizeof(*list));
+
+		r = dm_crypt_mapping(names->name, &list[count]);
+		if (!r)
+			count++;
+		else {
+			active_mapping_clear(&list[count]);
+			if (r == -ENOMEM)
+				goto out;
+			/* not a crypt mapping or gone meanwhile */
+			r = 0;
+		}
 
-	if (!PyArg_ParseTupleAndKeywords(args, kwds, "K", CONST_CAST(char**)kwlist, &time_ms))
-		return NULL;
+		next = names->next;
+	} while (next);
+out:
+	dm_task_destroy(dmt);
+	if (r) {
+		active_mappings_free(list, count);
+		return r;
+	}
 
-	crypt_set_iteration_time(self->device, time_ms);
+	*mappings = list;
+	return count;
+}
 
-	Py_RETURN_NONE;
+static PyObject *active_mapping_dict(const ActiveMapping *m)
+{
+	return Py_BuildValue("{s:z,s:z,s:s,s:s,s:i,s:K,s:K,s:K,s:I,s:I}",
+			     "name",		m->name,
+			     "uuid",		m->uuid,
+			     "device",		m->device,
+			     "cipher",		m->cipher,
+			     "keysize",		m->keysize,
+			     "offset",		m->offset,
+			     "iv_offset",	m->iv_offset,
+			     "size",		m->size,
+			     "sector_size",	m->sector_size ?: 512,
+			     "flags",		m->flags);
 }
 
-static PyMemberDef CryptSetup_members[] = {
-	{CONST_CAST(char*)"yesDialogCB", T_OBJECT_EX, offsetof(CryptSetupObject, yesDialogCB), 0, CONST_CAST(char*)"confirmation dialog callback"},
-	{CONST_CAST(char*)"cmdLineLogCB", T_OBJECT_EX, offsetof(CryptSetupObject, cmdLineLogCB), 0, CONST_CAST(char*)"logging callback"},
-	{NULL}
-};
+static char
+pycryptsetup_list_active_HELP[] =
+"List all active dm-crypt mappings\n\n\
+  list_active()\n\n\
+  returns list of dictionaries, one per mapping, with keys\n\
+  name, uuid, device, cipher, keysize, offset, iv_offset, size,\n\
+  sector_size and flags (CRYPT_ACTIVATE_*); sizes in 512-byte sectors\n\n\
+  Costs one device list query plus one table query per mapping.";
+
+static PyObject *pycryptsetup_list_active(PyObject *unused, PyObject *args)
+{
+	ActiveMapping *mappings = NULL;
+	PyObject *result, *item;
+	int i, count;
 
-static PyMethodDef CryptSetup_methods[] = {
-	/* self-test methods */
-	{"log", (PyCFunction)CryptSetup_log, METH_VARARGS|METH_KEYWORDS, CryptSetup_askyes_HELP},
-	{"askyes", (PyCFunction)CryptSetup_askyes, METH_VARARGS|METH_KEYWORDS, CryptSetup_log_HELP},
+	Py_BEGIN_ALLOW_THREADS
+	count = active_mappings(&mappings);
+	Py_END_ALLOW_THREADS
 
-	/* activation and deactivation */
-	{"deactivate", (PyCFunction)CryptSetup_deactivate, METH_NOARGS, CryptSetup_deactivate_HELP},
-	{"activate", (PyCFunction)CryptSetup_activate, METH_VARARGS|METH_KEYWORDS, CryptSetup_activate_HELP},
+	if (count < 0)
+		return PyObjectError(count);
 
-	/* cryptsetup info entrypoints */
-	{"luksUUID", (PyCFunction)CryptSetup_luksUUID, METH_NOARGS, CryptSetup_luksUUID_HELP},
-	{"isLuks", (PyCFunction)CryptSetup_isLuks, METH_NOARGS, CryptSetup_isLuks_HELP},
-	{"info", (PyCFunction)CryptSetup_Info, METH_NOARGS, CryptSetup_Info_HELP},
-	{"status", (PyCFunction)CryptSetup_Status, METH_NOARGS, CryptSetup_Status_HELP},
+	result = PyList_New(count);
+	if (!result)
+		goto out;
 
-	/* cryptsetup mgmt entrypoints */
-	{"luksFormat", (PyCFunction)CryptSetup_luksFormat, METH_VARARGS|METH_KEYWORDS, CryptSetup_luksFormat_HELP},
-	{"addKeyByPassphrase", (PyCFunction)CryptSetup_addKeyByPassphrase, METH_VARARGS|METH_KEYWORDS, CryptSetup_addKeyByPassphrase_HELP},
-	{"addKeyByVolumeKey", (PyCFunction)CryptSetup_addKeyByVolumeKey, METH_VARARGS|METH_KEYWORDS, CryptSetup_addKeyByVolumeKey_HELP},
-	{"removePassphrase", (PyCFunction)CryptSetup_removePassphrase, METH_VARARGS|METH_KEYWORDS, CryptSetup_removePassphrase_HELP},
-	{"killSlot", (PyCFunction)CryptSetup_killSlot, METH_VARARGS|METH_KEYWORDS, CryptSetup_killSlot_HELP},
+	for (i = 0; i < count; i++) {
+		item = active_mapping_dict(&mappings[i]);
+		if (!item) {
+			Py_CLEAR(result);
+			goto out;
+		}
+		PyList_SET_ITEM(result, i, item);
+	}
+out:
+	active_mappings_free(mappings, count);
+	return result;
+}
 
-	/* suspend resume */
-	{"resume", (PyCFunction)CryptSetup_Resume, METH_VARARGS|METH_KEYWORDS, CryptSetup_Resume_HELP},
-	{"suspend", (PyCFunction)CryptSetup_Suspend, METH_NOARGS, CryptSetup_Suspend_HELP},
+static char
+pycryptsetup__parse_crypt_table_HELP[] =
+"Parse the parameters of a dm-crypt table line (testing aid)\n\n\
+  _parse_crypt_table(params)\n\n\
+  params: <cipher> <key> <iv_offset> <device> <offset> [<#opt> <opt>...]\n\n\
+  returns the dictionary list_active() reports for such a table,\n\
+  with name and uuid set to None and size 0";
+
+static PyObject *pycryptsetup__parse_crypt_table(PyObject *unused, PyObject *args)
+{
+	ActiveMapping m = { 0 };
+	const char *params;
+	PyObject *result;
+	int r;
 
-	/* misc */
-	{"debugLevel", (PyCFunction)CryptSetup_debugLevel, METH_VARARGS|METH_KEYWORDS, CryptSetup_debugLevel_HELP},
-	{"iterationTime", (PyCFunction)CryptSetup_iterationTime, METH_VARARGS|METH_KEYWORDS, CryptSetup_iterationTime_HELP},
+	if (!PyArg_ParseTuple(args, "s", &params))
+		return NULL;
 
-	{NULL} /* Sentinel */
-};
+	r = dm_crypt_params(params, &m);
+	if (r) {
+		active_mapping_clear(&m);
+		return PyObjectError(r);
+	}
 
-static PyTypeObject CryptSetupType = {
-	PyVarObject_HEAD_INIT(NULL, 0)
-	"pycryptsetup.CryptSetup", /*tp_name*/
-	sizeof(CryptSetupObject), /*tp_basicsize*/
-	0, /*tp_itemsize*/
-	(destructor)CryptSetup_dealloc, /*tp_dealloc*/
-	0, /*tp_print*/
-	0, /*tp_getattr*/
-	0, /*tp_setattr*/
-	0, /*tp_compare*/
-	0, /*tp_repr*/
-	0, /*tp_as_number*/
-	0, /*tp_as_sequence*/
-	0, /*tp_as_mapping*/
-	0, /*tp_hash */
-	0, /*tp_call*/
-	0, /*tp_str*/
-	0, /*tp_getattro*/
-	0, /*tp_setattro*/
-	0, /*tp_as_buffer*/
-	Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE, /*tp_flags*/
-	CryptSetup_HELP, /* tp_doc */
-	0, /* tp_traverse */
-	0, /* tp_clear */
-	0, /* tp_richcompare */
-	0, /* tp_weaklistoffset */
-	0, /* tp_iter */
-	0, /* tp_iternext */
-	CryptSetup_methods, /* tp_methods */
-	CryptSetup_members, /* tp_members */
-	0, /* tp_getset */
-	0, /* tp_base */
-	0, /* tp_dict */
-	0, /* tp_descr_get */
-	0, /* tp_descr_set */
-	0, /* tp_dictoffset */
-	(initproc)CryptSetup_init, /* tp_init */
-	0, /* tp_alloc */
-	CryptSetup_new, /* tp_new */
-};
+	result = active_mapping_dict(&m);
+	active_mapping_clear(&m);
+	return result;
+}
 
 static PyMethodDef pycryptsetup_methods[] = {
+	{"set_pool_size", (PyCFunction)pycryptsetup_set_pool_size, METH_VARARGS|METH_KEYWORDS, pycryptsetup_set_pool_size_HELP},
+	{"pool_size", (PyCFunction)pycryptsetup_pool_size, METH_NOARGS, pycryptsetup_pool_size_HELP},
+	{"activate_many", (PyCFunction)pycryptsetup_activate_many, METH_VARARGS|METH_KEYWORDS, pycryptsetup_activate_many_HELP},
+	{"header_backup_many", (PyCFunction)pycryptsetup_header_backup_many, METH_VARARGS|METH_KEYWORDS, pycryptsetup_header_backup_many_HELP},
+	{"set_slot_cache", (PyCFunction)pycryptsetup_set_slot_cache, METH_VARARGS|METH_KEYWORDS, pycryptsetup_set_slot_cache_HELP},
+	{"slot_cache_stats", (PyCFunction)pycryptsetup_slot_cache_stats, METH_NOARGS, pycryptsetup_slot_cache_stats_HELP},
+	{"clear_slot_cache", (PyCFunction)pycryptsetup_clear_slot_cache, METH_NOARGS, pycryptsetup_clear_slot_cache_HELP},
+	{"set_context_pool", (PyCFunction)pycryptsetup_set_context_pool, METH_VARARGS|METH_KEYWORDS, pycryptsetup_set_context_pool_HELP},
+	{"context_pool_stats", (PyCFunction)pycryptsetup_context_pool_stats, METH_NOARGS, pycryptsetup_context_pool_stats_HELP},
+	{"clear_context_pool", (PyCFunction)pycryptsetup_clear_context_pool, METH_NOARGS, pycryptsetup_clear_context_pool_HELP},
+	{"set_pbkdf_cache", (PyCFunction)pycryptsetup_set_pbkdf_cache, METH_VARARGS|METH_KEYWORDS, pycryptsetup_set_pbkdf_cache_HELP},
+	{"pbkdf_cache", (PyCFunction)pycryptsetup_pbkdf_cache, METH_NOARGS, pycryptsetup_pbkdf_cache_HELP},
+	{"clear_pbkdf_cache", (PyCFunction)pycryptsetup_clear_pbkdf_cache, METH_NOARGS, pycryptsetup_clear_pbkdf_cache_HELP},
+	{"benchmark_cipher", (PyCFunction)pycryptsetup_benchmark_cipher, METH_VARARGS|METH_KEYWORDS, pycryptsetup_benchmark_cipher_HELP},
+	{"benchmark_pbkdf", (PyCFunction)pycryptsetup_benchmark_pbkdf, METH_VARARGS|METH_KEYWORDS, pycryptsetup_benchmark_pbkdf_HELP},
+	{"set_stats", (PyCFunction)pycryptsetup_set_stats, METH_VARARGS|METH_KEYWORDS, pycryptsetup_set_stats_HELP},
+	{"stats", (PyCFunction)pycryptsetup_stats, METH_NOARGS, pycryptsetup_stats_HELP},
+	{"reset_stats", (PyCFunction)pycryptsetup_reset_stats, METH_NOARGS, pycryptsetup_reset_stats_HELP},
+	{"choose_fastest", (PyCFunction)pycryptsetup_choose_fastest, METH_VARARGS|METH_KEYWORDS, pycryptsetup_choose_fastest_HELP},
+	{"list_active", (PyCFunction)pycryptsetup_list_active, METH_NOARGS, pycryptsetup_list_active_HELP},
+	{"_parse_crypt_table", (PyCFunction)pycryptsetup__parse_crypt_table, METH_VARARGS, pycryptsetup__parse_crypt_table_HELP},
 	{NULL} /* Sentinel */
 };
 
-MOD_INIT(pycryptsetup)
+/*
+ * Fills the module. Native state (worker pool, caches, statistics) is
+ * process-wide and guarded by its own locks, only Python objects live
+ * in the per-module state.
+ */
+static int pycryptsetup_exec(PyObject *m)
 {
-	PyObject *m;
+	ModuleState *state = pycryptsetup_state(m);
+
+#ifdef MULTI_PHASE_INIT
+	state->CryptSetupType = (PyTypeObject *)PyType_FromModuleAndSpec(m, &CryptSetup_spec, NULL);
+	if (!state->CryptSetupType)
+		return -1;
+
+	state->VolumeKeyType = (PyTypeObject *)PyType_FromModuleAndSpec(m, &VolumeKey_spec, NULL);
+	if (!state->VolumeKeyType)
+		return -1;
 
+	state->InfoType = PyStructSequence_NewType(&Info_desc);
+	if (!state->InfoType)
+		return -1;
+#else
 	if (PyType_Ready(&CryptSetupType) < 0)
-		return MOD_ERROR_VAL;
+		return -1;
 
-	MOD_DEF(m, "pycryptsetup", "CryptSetup pythonized API.", pycryptsetup_methods);
-	Py_INCREF(&CryptSetupType);
+	if (PyType_Ready(&VolumeKeyType) < 0)
+		return -1;
+
+	if (!InfoType.tp_name) {
+		PyStructSequence_InitType(&InfoType, &Info_desc);
+		if (PyErr_Occurred())
+			return -1;
+	}
 
-	PyModule_AddObject(m, "CryptSetup", (PyObject *)&CryptSetupType);
+	state->CryptSetupType = &CryptSetupType;
+	state->VolumeKeyType = &VolumeKeyType;
+	state->InfoType = &InfoType;
+#endif
+
+#if PY_MAJOR_VERSION >= 3
+	if (!state->complete_cb)
+		state->complete_cb = PyCFunction_New(&pool_complete_def, NULL);
+	if (!state->complete_cb || pool_register_drain(m) < 0)
+		return -1;
+#endif
+	Py_INCREF(state->CryptSetupType);
+	PyModule_AddObject(m, "CryptSetup", (PyObject *)state->CryptSetupType);
+
+	Py_INCREF(state->VolumeKeyType);
+	PyModule_AddObject(m, "VolumeKey", (PyObject *)state->VolumeKeyType);
+
+	Py_INCREF(state->InfoType);
+	PyModule_AddObject(m, "Info", (PyObject *)state->InfoType);
 
 	/* debug constants */
 	PyModule_AddIntConstant(m, "CRYPT_DEBUG_ALL", CRYPT_DEBUG_ALL);
@@ -714,11 +6490,152 @@ MOD_INIT(pycryptsetup)
 	PyModule_AddIntConstant(m, "CRYPT_LOG_VERBOSE", CRYPT_LOG_VERBOSE);
 	PyModule_AddIntConstant(m, "CRYPT_LOG_DEBUG", CRYPT_LOG_DEBUG);
 
+	/* device types */
+	PyModule_AddStringConstant(m, "CRYPT_LUKS1", CRYPT_LUKS1);
+	PyModule_AddStringConstant(m, "CRYPT_LUKS2", CRYPT_LUKS2);
+	PyModule_AddStringConstant(m, "CRYPT_PLAIN", CRYPT_PLAIN);
+	PyModule_AddStringConstant(m, "CRYPT_TCRYPT", CRYPT_TCRYPT);
+	PyModule_AddStringConstant(m, "CRYPT_BITLK", CRYPT_BITLK);
+	PyModule_AddStringConstant(m, "CRYPT_INTEGRITY", CRYPT_INTEGRITY);
+
+	/* tcrypt flags */
+	PyModule_AddIntConstant(m, "CRYPT_TCRYPT_LEGACY_MODES", CRYPT_TCRYPT_LEGACY_MODES);
+	PyModule_AddIntConstant(m, "CRYPT_TCRYPT_HIDDEN_HEADER", CRYPT_TCRYPT_HIDDEN_HEADER);
+	PyModule_AddIntConstant(m, "CRYPT_TCRYPT_BACKUP_HEADER", CRYPT_TCRYPT_BACKUP_HEADER);
+	PyModule_AddIntConstant(m, "CRYPT_TCRYPT_SYSTEM_HEADER", CRYPT_TCRYPT_SYSTEM_HEADER);
+	PyModule_AddIntConstant(m, "CRYPT_TCRYPT_VERA_MODES", CRYPT_TCRYPT_VERA_MODES);
+
+	/* pbkdf types */
+	PyModule_AddStringConstant(m, "CRYPT_KDF_PBKDF2", CRYPT_KDF_PBKDF2);
+	PyModule_AddStringConstant(m, "CRYPT_KDF_ARGON2I", CRYPT_KDF_ARGON2I);
+	PyModule_AddStringConstant(m, "CRYPT_KDF_ARGON2ID", CRYPT_KDF_ARGON2ID);
+
+	/* activation flags */
+	PyModule_AddIntConstant(m, "CRYPT_ACTIVATE_READONLY", CRYPT_ACTIVATE_READONLY);
+	PyModule_AddIntConstant(m, "CRYPT_ACTIVATE_ALLOW_DISCARDS", CRYPT_ACTIVATE_ALLOW_DISCARDS);
+	PyModule_AddIntConstant(m, "CRYPT_ACTIVATE_SAME_CPU_CRYPT", CRYPT_ACTIVATE_SAME_CPU_CRYPT);
+	PyModule_AddIntConstant(m, "CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS", CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS);
+	PyModule_AddIntConstant(m, "CRYPT_ACTIVATE_NO_READ_WORKQUEUE", CRYPT_ACTIVATE_NO_READ_WORKQUEUE);
+	PyModule_AddIntConstant(m, "CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE", CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE);
+
+	/* token constants */
+	PyModule_AddIntConstant(m, "CRYPT_ANY_TOKEN", CRYPT_ANY_TOKEN);
+
+	/* wipe constants */
+	PyModule_AddIntConstant(m, "CRYPT_WIPE_ZERO", CRYPT_WIPE_ZERO);
+	PyModule_AddIntConstant(m, "CRYPT_WIPE_RANDOM", CRYPT_WIPE_RANDOM);
+	PyModule_AddIntConstant(m, "CRYPT_WIPE_ENCRYPTED_ZERO", CRYPT_WIPE_ENCRYPTED_ZERO);
+	PyModule_AddIntConstant(m, "CRYPT_WIPE_NO_DIRECT_IO", CRYPT_WIPE_NO_DIRECT_IO);
+
+	/* reencryption constants */
+	PyModule_AddIntConstant(m, "CRYPT_REENCRYPT_FORWARD", CRYPT_REENCRYPT_FORWARD);
+	PyModule_AddIntConstant(m, "CRYPT_REENCRYPT_BACKWARD", CRYPT_REENCRYPT_BACKWARD);
+	PyModule_AddIntConstant(m, "CRYPT_REENCRYPT_INITIALIZE_ONLY", CRYPT_REENCRYPT_INITIALIZE_ONLY);
+	PyModule_AddIntConstant(m, "CRYPT_REENCRYPT_MOVE_FIRST_SEGMENT", CRYPT_REENCRYPT_MOVE_FIRST_SEGMENT);
+	PyModule_AddIntConstant(m, "CRYPT_REENCRYPT_RESUME_ONLY", CRYPT_REENCRYPT_RESUME_ONLY);
+	PyModule_AddIntConstant(m, "CRYPT_REENCRYPT_RECOVERY", CRYPT_REENCRYPT_RECOVERY);
+
+	/* keyslot constants */
+	PyModule_AddIntConstant(m, "CRYPT_SLOT_INVALID", CRYPT_SLOT_INVALID);
+	PyModule_AddIntConstant(m, "CRYPT_SLOT_INACTIVE", CRYPT_SLOT_INACTIVE);
+	PyModule_AddIntConstant(m, "CRYPT_SLOT_ACTIVE", CRYPT_SLOT_ACTIVE);
+	PyModule_AddIntConstant(m, "CRYPT_SLOT_ACTIVE_LAST", CRYPT_SLOT_ACTIVE_LAST);
+	PyModule_AddIntConstant(m, "CRYPT_SLOT_UNBOUND", CRYPT_SLOT_UNBOUND);
+	PyModule_AddIntConstant(m, "CRYPT_SLOT_PRIORITY_IGNORE", CRYPT_SLOT_PRIORITY_IGNORE);
+	PyModule_AddIntConstant(m, "CRYPT_SLOT_PRIORITY_NORMAL", CRYPT_SLOT_PRIORITY_NORMAL);
+	PyModule_AddIntConstant(m, "CRYPT_SLOT_PRIORITY_PREFER", CRYPT_SLOT_PRIORITY_PREFER);
+
 	/* status constants */
 	PyModule_AddIntConstant(m, "CRYPT_INVALID", CRYPT_INVALID);
 	PyModule_AddIntConstant(m, "CRYPT_INACTIVE", CRYPT_INACTIVE);
 	PyModule_AddIntConstant(m, "CRYPT_ACTIVE", CRYPT_ACTIVE);
 	PyModule_AddIntConstant(m, "CRYPT_BUSY", CRYPT_BUSY);
 
+	return PyErr_Occurred() ? -1 : 0;
+}
+
+#ifdef MULTI_PHASE_INIT
+static int pycryptsetup_traverse(PyObject *m, visitproc visit, void *arg)
+{
+	ModuleState *state = pycryptsetup_state(m);
+
+	Py_VISIT(state->CryptSetupType);
+	Py_VISIT(state->VolumeKeyType);
+	Py_VISIT(state->InfoType);
+	Py_VISIT(state->complete_cb);
+	return 0;
+}
+
+static int pycryptsetup_clear(PyObject *m)
+{
+	ModuleState *state = pycryptsetup_state(m);
+
+	Py_CLEAR(state->CryptSetupType);
+	Py_CLEAR(state->VolumeKeyType);
+	Py_CLEAR(state->InfoType);
+	Py_CLEAR(state->complete_cb);
+	return 0;
+}
+
+static void pycryptsetup_free(void *m)
+{
+	pycryptsetup_clear((PyObject *)m);
+}
+
+/*
+ * Nothing relies on the GIL: each CryptSetup object serializes its
+ * crypt_device with its own lock, callbacks are swapped under
+ * callback_mutex and called through a strong reference, and the shared
+ * caches and worker pool have their own mutexes.
+ */
+static PyModuleDef_Slot pycryptsetup_slots[] = {
+	{Py_mod_exec, (void *)pycryptsetup_exec},
+#ifdef Py_mod_multiple_interpreters
+	{Py_mod_multiple_interpreters, Py_MOD_PER_INTERPRETER_GIL_SUPPORTED},
+#endif
+#ifdef Py_mod_gil
+	{Py_mod_gil, Py_MOD_GIL_NOT_USED},
+#endif
+	{0, NULL}
+};
+
+static struct PyModuleDef pycryptsetup_module = {
+	PyModuleDef_HEAD_INIT,
+	"pycryptsetup",
+	"CryptSetup pythonized API.",
+	sizeof(ModuleState),
+	pycryptsetup_methods,
+	pycryptsetup_slots,
+	pycryptsetup_traverse,
+	pycryptsetup_clear,
+	pycryptsetup_free,
+};
+
+MOD_INIT(pycryptsetup)
+{
+	return PyModuleDef_Init(&pycryptsetup_module);
+}
+#else
+MOD_INIT(pycryptsetup)
+{
+	PyObject *m;
+
+#if PY_VERSION_HEX < 0x03070000
+	/* callbacks may come from threads running without the GIL */
+	PyEval_InitThreads();
+#endif
+
+	MOD_DEF(m, "pycryptsetup", "CryptSetup pythonized API.", pycryptsetup_methods);
+	if (!m)
+		return MOD_ERROR_VAL;
+
+	if (pycryptsetup_exec(m) < 0) {
+#if PY_MAJOR_VERSION >= 3
+		Py_DECREF(m);
+#endif
+		return MOD_ERROR_VAL;
+	}
+
 	return MOD_SUCCESS_VAL(m);
 }
+#endif
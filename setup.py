@@ -5,5 +5,5 @@ setup(name="pycryptsetup",
       author = "Martin Sivak",
       author_email= "msivak@redhat.com",
       license = 'GPLv2+',
-      ext_modules = [Extension("pycryptsetup", ["pycryptsetup.c"], libraries=['cryptsetup'])]
+      ext_modules = [Extension("pycryptsetup", ["pycryptsetup.c"], libraries=['cryptsetup', 'devmapper'])]
       )
@@ -0,0 +1,146 @@
+#
+# Shared helpers for the pycryptsetup tests
+#
+# Images are sparse files in a per-test temporary directory. Activation
+# needs root and the device-mapper driver, the keyring helpers the session
+# keyring; tests depending on either check DM_AVAILABLE or
+# keyring_available() and are skipped otherwise. PBKDF costs are pinned
+# low so a run takes about a minute.
+#
+#   python3 setup.py build_ext --inplace
+#   python3 -m unittest discover -s tests -v
+#
+
+import ctypes
+import ctypes.util
+import os
+import platform
+import shutil
+import tempfile
+import unittest
+
+import pycryptsetup
+
+PASSPHRASE = b"test-passphrase"
+LOW_PBKDF = {"type": pycryptsetup.CRYPT_KDF_PBKDF2, "hash": "sha256", "iterations": 1000}
+IMAGE_MIB = 32
+
+
+def dm_available():
+    if os.geteuid() != 0:
+        return False
+    try:
+        pycryptsetup.list_active()
+    except OSError:
+        return False
+    return True
+
+
+DM_AVAILABLE = dm_available()
+
+
+class Keyring(object):
+    """User keys in the session keyring.
+
+    Uses libkeyutils when it is installed, otherwise add_key(2) and
+    keyctl(2) through syscall() on the architectures listed below.
+    """
+
+    KEY_SPEC_SESSION_KEYRING = -3
+    KEYCTL_UNLINK = 9
+
+    # (__NR_add_key, __NR_keyctl)
+    SYSCALLS = {
+        "x86_64": (248, 250),
+        "i386": (286, 288),
+        "i686": (286, 288),
+        "aarch64": (217, 219),
+        "riscv64": (217, 219),
+        "armv7l": (309, 311),
+        "ppc64": (269, 271),
+        "ppc64le": (269, 271),
+        "s390x": (218, 220),
+    }
+
+    def __init__(self):
+        self.keys = []
+        self.keyutils = None
+        self.libc = None
+
+        name = ctypes.util.find_library("keyutils")
+        if name:
+            self.keyutils = ctypes.CDLL(name, use_errno=True)
+            self.keyutils.add_key.restype = ctypes.c_int32
+            self.keyutils.add_key.argtypes = [ctypes.c_char_p, ctypes.c_char_p, ctypes.c_char_p,
+                                              ctypes.c_size_t, ctypes.c_int32]
+            self.keyutils.keyctl_unlink.restype = ctypes.c_long
+            self.keyutils.keyctl_unlink.argtypes = [ctypes.c_int32, ctypes.c_int32]
+        elif platform.machine() in self.SYSCALLS:
+            self.libc = ctypes.CDLL(ctypes.util.find_library("c"), use_errno=True)
+            self.libc.syscall.restype = ctypes.c_long
+        else:
+            raise OSError(0, "no way to reach the kernel keyring on %s" % platform.machine())
+
+    def add(self, description, payload):
+        if self.keyutils:
+            key = self.keyutils.add_key(b"user", description.encode(), payload, len(payload),
+                                        self.KEY_SPEC_SESSION_KEYRING)
+        else:
+            key = self.libc.syscall(ctypes.c_long(self.SYSCALLS[platform.machine()][0]),
+                                    b"user", description.encode(), payload,
+                                    ctypes.c_size_t(len(payload)),
+                                    ctypes.c_long(self.KEY_SPEC_SESSION_KEYRING))
+        if key < 0:
+            raise OSError(ctypes.get_errno(), os.strerror(ctypes.get_errno()))
+        self.keys.append(key)
+        return key
+
+    def clear(self):
+        for key in self.keys:
+            if self.keyutils:
+                self.keyutils.keyctl_unlink(key, self.KEY_SPEC_SESSION_KEYRING)
+            else:
+                self.libc.syscall(ctypes.c_long(self.SYSCALLS[platform.machine()][1]),
+                                  ctypes.c_long(self.KEYCTL_UNLINK), ctypes.c_long(key),
+                                  ctypes.c_long(self.KEY_SPEC_SESSION_KEYRING))
+        self.keys = []
+
+
+def keyring_available():
+    if not os.path.exists("/proc/keys"):
+        return False
+    try:
+        keyring = Keyring()
+        keyring.add("pycryptsetup-probe-%d" % os.getpid(), b"probe")
+    except OSError:
+        return False
+    keyring.clear()
+    return True
+
+
+class ImageTestCase(unittest.TestCase):
+    def setUp(self):
+        self.directory = tempfile.mkdtemp(prefix="pycryptsetup-test-")
+
+    def tearDown(self):
+        shutil.rmtree(self.directory)
+
+    def image(self, size_mib=IMAGE_MIB):
+        fd, path = tempfile.mkstemp(suffix=".img", dir=self.directory)
+        os.ftruncate(fd, size_mib * 1024 * 1024)
+        os.close(fd)
+        return path
+
+    def luks(self, luks_type=pycryptsetup.CRYPT_LUKS2, **kwargs):
+        path = self.image()
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertEqual(c.luksFormat(type=luks_type, pbkdf=LOW_PBKDF, **kwargs), 0)
+        self.assertEqual(c.addKeyByVolumeKey(newPassphrase=PASSPHRASE), 0)
+        c.close()
+        return path
+
+    def open(self, path, **kwargs):
+        # keyslots added without an explicit pbkdf use the default KDF
+        c = pycryptsetup.CryptSetup(device=path, **kwargs)
+        c.iterationTime(10)
+        return c
@@ -0,0 +1,123 @@
+#
+# asyncio variants running on the native worker pool
+#
+
+import asyncio
+import os
+import subprocess
+import sys
+import textwrap
+import unittest
+
+import pycryptsetup
+
+from common import LOW_PBKDF, PASSPHRASE, ImageTestCase
+
+
+class AsyncTest(ImageTestCase):
+    def test_format_and_add(self):
+        paths = [self.image() for i in range(4)]
+
+        async def run():
+            objects = [pycryptsetup.CryptSetup(device=path) for path in paths]
+            formats = [c.luksFormat_async(type=pycryptsetup.CRYPT_LUKS2, pbkdf=LOW_PBKDF) for c in objects]
+            self.assertEqual(await asyncio.gather(*formats), [0] * len(paths))
+            for c in objects:
+                self.assertEqual(c.addKeyByVolumeKey(newPassphrase=PASSPHRASE), 0)
+            adds = [c.addKeyByPassphrase_async(passphrase=PASSPHRASE, newPassphrase=b"second")
+                    for c in objects]
+            self.assertEqual(await asyncio.gather(*adds), [1] * len(paths))
+            for c in objects:
+                c.close()
+
+        asyncio.run(run())
+
+    def test_busy_context(self):
+        path = self.luks()
+
+        async def run():
+            c = self.open(path)
+            futures = [c.addKeyByPassphrase_async(passphrase=PASSPHRASE, newPassphrase=b"second-%d" % i)
+                       for i in range(3)]
+            r = await asyncio.gather(*futures)
+            c.close()
+            return r
+
+        self.assertEqual(sorted(asyncio.run(run())), [1, 2, 3])
+
+    def test_error_result(self):
+        path = self.luks()
+
+        async def run():
+            c = self.open(path)
+            r = await c.removePassphrase_async(passphrase=b"wrong")
+            c.close()
+            return r
+
+        self.assertLess(asyncio.run(run()), 0)
+
+    def test_parse_error_raises_at_submit(self):
+        c = pycryptsetup.CryptSetup(device=self.image())
+
+        async def run():
+            with self.assertRaises(ValueError):
+                c.luksFormat_async(type="plain")
+
+        asyncio.run(run())
+        c.close()
+
+    def test_pool_size(self):
+        size = pycryptsetup.pool_size()
+        try:
+            pycryptsetup.set_pool_size(1)
+            self.assertEqual(pycryptsetup.pool_size(), 1)
+            self.test_format_and_add()
+            pycryptsetup.set_pool_size(0)
+            self.assertEqual(pycryptsetup.pool_size(), os.cpu_count())
+        finally:
+            pycryptsetup.set_pool_size(size)
+
+
+    def test_exit_with_pending_jobs(self):
+        # the callback registered before the import runs after the drain
+        script = textwrap.dedent('''
+            import asyncio, atexit, sys
+
+            def late():
+                try:
+                    asyncio.new_event_loop().run_until_complete(submit())
+                except RuntimeError as e:
+                    print("refused")
+
+            atexit.register(late)
+
+            import pycryptsetup
+
+            async def submit():
+                return c.addKeyByPassphrase_async(passphrase=%r, newPassphrase=b"x")
+
+            c = pycryptsetup.CryptSetup(device=sys.argv[1])
+            c.iterationTime(100)
+            loop = asyncio.new_event_loop()
+            futures = [loop.run_until_complete(submit()) for i in range(8)]
+            loop.close()
+        ''' % PASSPHRASE)
+
+        path = self.luks()
+        env = dict(os.environ, PYTHONPATH=os.pathsep.join(sys.path))
+        r = subprocess.run([sys.executable, "-c", script, path], env=env,
+                           stdout=subprocess.PIPE, stderr=subprocess.PIPE, timeout=120)
+        self.assertEqual(r.returncode, 0, r.stderr)
+        self.assertEqual(r.stdout.strip(), b"refused")
+        self.assertNotIn(b"Exception ignored", r.stderr)
+
+        # jobs either ran to completion or never started
+        c = pycryptsetup.CryptSetup(device=path)
+        active = [s for s in c.info().keyslots if s != pycryptsetup.CRYPT_SLOT_INACTIVE]
+        self.assertGreaterEqual(len(active), 1)
+        self.assertLessEqual(len(active), 9)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
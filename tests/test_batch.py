@@ -0,0 +1,45 @@
+#
+# activate_many(), several devices unlocked on native threads
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+
+class ActivateManyTest(ImageTestCase):
+    def test_entry_validation(self):
+        with self.assertRaises(TypeError):
+            pycryptsetup.activate_many([("/dev/null",)])
+        with self.assertRaises(TypeError):
+            pycryptsetup.activate_many(None)
+
+    def test_result_per_entry(self):
+        missing = os.path.join(self.directory, "missing.img")
+        r = pycryptsetup.activate_many([(missing, "pycryptsetup-test-missing-%d" % i, PASSPHRASE)
+                                        for i in range(3)], 2)
+        self.assertEqual(len(r), 3)
+        for value in r:
+            self.assertLess(value, 0)
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_activate(self):
+        paths = [self.luks() for i in range(3)]
+        names = ["pycryptsetup-test-%d-%d" % (os.getpid(), i) for i in range(3)]
+        entries = [(path, name, PASSPHRASE) for path, name in zip(paths, names)]
+        entries[2] = (paths[2], names[2], b"wrong")
+        r = pycryptsetup.activate_many(entries)
+        try:
+            self.assertEqual(r[:2], [0, 0])
+            self.assertLess(r[2], 0)
+        finally:
+            for name, value in zip(names, r):
+                if value == 0:
+                    pycryptsetup.CryptSetup(name=name).deactivate()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,59 @@
+#
+# Cipher and PBKDF benchmarks
+#
+
+import errno
+import unittest
+
+import pycryptsetup
+
+from common import PASSPHRASE, ImageTestCase
+
+
+class BenchmarkTest(ImageTestCase):
+    def test_pbkdf2(self):
+        r = pycryptsetup.benchmark_pbkdf(pbkdf=pycryptsetup.CRYPT_KDF_PBKDF2, time_ms=50)
+        self.assertEqual(r["type"], pycryptsetup.CRYPT_KDF_PBKDF2)
+        self.assertEqual(r["time_ms"], 50)
+        self.assertGreater(r["iterations"], 1000)
+
+    def test_argon2_limits(self):
+        r = pycryptsetup.benchmark_pbkdf(pbkdf=pycryptsetup.CRYPT_KDF_ARGON2ID, time_ms=50,
+                                         maxMemoryKb=32768, parallelThreads=1)
+        self.assertLessEqual(r["max_memory_kb"], 32768)
+        self.assertEqual(r["parallel_threads"], 1)
+
+    def test_result_usable_for_format(self):
+        pbkdf = pycryptsetup.benchmark_pbkdf(pbkdf=pycryptsetup.CRYPT_KDF_PBKDF2, time_ms=20)
+        c = pycryptsetup.CryptSetup(device=self.image())
+        self.assertEqual(c.luksFormat(type=pycryptsetup.CRYPT_LUKS2, pbkdf=pbkdf), 0)
+        self.assertEqual(c.addKeyByVolumeKey(newPassphrase=PASSPHRASE), 0)
+        self.assertEqual(c.keyslots()[0]["pbkdf"]["iterations"], pbkdf["iterations"])
+        c.close()
+
+    def test_unknown_pbkdf(self):
+        with self.assertRaises(ValueError):
+            pycryptsetup.benchmark_pbkdf(pbkdf="bogus")
+
+    def test_cipher(self):
+        try:
+            r = pycryptsetup.benchmark_cipher(cipher="aes", cipherMode="xts-plain64", keysize=256)
+        except OSError as e:
+            if e.errno in (errno.ENOTSUP, errno.ENOENT):
+                self.skipTest("kernel crypto API is not available")
+            raise
+        self.assertGreater(r["encryption"], 0)
+        self.assertGreater(r["decryption"], 0)
+
+    def test_choose_fastest(self):
+        candidates = [("aes", "xts-plain64", 256), ("aes", "xts-plain64", 512), ("bogus", "ecb", 128)]
+        ranks = pycryptsetup.choose_fastest(candidates)
+        self.assertLessEqual(len(ranks), 2)
+        for rank in ranks:
+            self.assertEqual(rank["cipher"], "aes")
+        means = [(r["encryption"] + r["decryption"]) / 2 for r in ranks]
+        self.assertEqual(means, sorted(means, reverse=True))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,119 @@
+#
+# Context pool, lazy header loading, context manager and close()
+#
+
+import asyncio
+import errno
+import unittest
+
+import pycryptsetup
+
+from common import PASSPHRASE, ImageTestCase
+
+
+class ContextPoolTest(ImageTestCase):
+    def setUp(self):
+        ImageTestCase.setUp(self)
+        pycryptsetup.set_context_pool(4)
+        pycryptsetup.clear_context_pool()
+
+    def tearDown(self):
+        pycryptsetup.set_context_pool(0)
+        ImageTestCase.tearDown(self)
+
+    def test_reuse(self):
+        path = self.luks()
+        pycryptsetup.clear_context_pool()
+
+        with pycryptsetup.CryptSetup(device=path) as c:
+            self.assertTrue(c.isLuks() == 0)
+        self.assertEqual(pycryptsetup.context_pool_stats()["idle"], 1)
+
+        with pycryptsetup.CryptSetup(device=path) as c:
+            uuid = c.luksUUID()
+        stats = pycryptsetup.context_pool_stats()
+        self.assertEqual(stats["hits"], 1)
+        self.assertEqual(stats["idle"], 1)
+        self.assertTrue(uuid)
+
+    def test_stale_after_header_change(self):
+        path = self.luks()
+        with pycryptsetup.CryptSetup(device=path) as c:
+            c.isLuks()
+
+        # a different path keeps the pooled context for path around
+        with self.open(path, header=path) as c:
+            self.assertGreaterEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"other"), 0)
+
+        pycryptsetup.CryptSetup(device=path).close()
+        self.assertEqual(pycryptsetup.context_pool_stats()["stale"], 1)
+
+    def test_modified_context_not_pooled(self):
+        path = self.luks()
+        pycryptsetup.clear_context_pool()
+
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertEqual(c.volumeKeyKeyring(False), 0)
+        c.close()
+        self.assertEqual(pycryptsetup.context_pool_stats()["idle"], 0)
+
+        c = self.open(path)
+        self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"other"), 1)
+        c.close()
+        self.assertEqual(pycryptsetup.context_pool_stats()["idle"], 0)
+
+    def test_clear_keeps_size(self):
+        path = self.luks()
+        pycryptsetup.CryptSetup(device=path).close()
+        pycryptsetup.clear_context_pool()
+
+        stats = pycryptsetup.context_pool_stats()
+        self.assertEqual(stats["size"], 4)
+        self.assertEqual(stats["idle"], 0)
+        self.assertEqual(stats["hits"], 0)
+
+        with pycryptsetup.CryptSetup(device=path) as c:
+            c.isLuks()
+        self.assertEqual(pycryptsetup.context_pool_stats()["idle"], 1)
+
+    def test_disable_frees_idle(self):
+        path = self.luks()
+        with pycryptsetup.CryptSetup(device=path) as c:
+            c.isLuks()
+        pycryptsetup.set_context_pool(0)
+        self.assertEqual(pycryptsetup.context_pool_stats()["idle"], 0)
+
+
+class CloseTest(ImageTestCase):
+    def test_closed_object(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        c.close()
+        c.close()
+        with self.assertRaises(RuntimeError):
+            c.isLuks()
+
+    def test_close_with_queued_jobs(self):
+        path = self.luks()
+        size = pycryptsetup.pool_size()
+
+        async def run():
+            c = self.open(path)
+            futures = [c.addKeyByPassphrase_async(passphrase=PASSPHRASE, newPassphrase=b"second-%d" % i)
+                       for i in range(4)]
+            # jobs still waiting for the object lock find the context gone
+            c.close()
+            return await asyncio.gather(*futures)
+
+        try:
+            pycryptsetup.set_pool_size(1)
+            r = asyncio.run(run())
+        finally:
+            pycryptsetup.set_pool_size(size)
+
+        self.assertEqual(r[-1], -errno.ENODEV)
+        for value in r:
+            self.assertTrue(value > 0 or value == -errno.ENODEV, r)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,94 @@
+#
+# probe(), load() and setupPlain() for the non-LUKS device types
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+
+class ProbeTest(ImageTestCase):
+    def test_luks(self):
+        for luks_type in (pycryptsetup.CRYPT_LUKS1, pycryptsetup.CRYPT_LUKS2):
+            c = pycryptsetup.CryptSetup(device=self.luks(luks_type))
+            self.assertEqual(c.probe(), luks_type)
+            c.close()
+
+    def test_no_signature(self):
+        c = pycryptsetup.CryptSetup(device=self.image())
+        self.assertIsNone(c.probe())
+        c.close()
+
+
+class LoadTest(ImageTestCase):
+    def test_probed_type(self):
+        c = pycryptsetup.CryptSetup(device=self.luks(pycryptsetup.CRYPT_LUKS1))
+        self.assertEqual(c.load(), 0)
+        self.assertEqual(c.info().type, pycryptsetup.CRYPT_LUKS1)
+        c.close()
+
+    def test_wrong_type(self):
+        c = pycryptsetup.CryptSetup(device=self.luks(pycryptsetup.CRYPT_LUKS1))
+        self.assertLess(c.load(type=pycryptsetup.CRYPT_LUKS2), 0)
+        c.close()
+
+    def test_no_header(self):
+        c = pycryptsetup.CryptSetup(device=self.image())
+        self.assertLess(c.load(), 0)
+        self.assertLess(c.load(type=pycryptsetup.CRYPT_INTEGRITY), 0)
+        self.assertLess(c.load(type=pycryptsetup.CRYPT_TCRYPT, params={"passphrase": PASSPHRASE}), 0)
+        c.close()
+
+    def test_arguments(self):
+        c = pycryptsetup.CryptSetup(device=self.image())
+        with self.assertRaises(ValueError):
+            c.load(type=pycryptsetup.CRYPT_PLAIN)
+        with self.assertRaises(ValueError):
+            c.load(type=pycryptsetup.CRYPT_LUKS2, params={})
+        with self.assertRaises(ValueError):
+            c.load(params={"passphrase": PASSPHRASE})
+        with self.assertRaises(TypeError):
+            c.load(type=pycryptsetup.CRYPT_TCRYPT, params=[PASSPHRASE])
+        with self.assertRaises(TypeError):
+            c.load(type=pycryptsetup.CRYPT_TCRYPT, params={"keyfiles": [1]})
+        c.close()
+
+
+class PlainTest(ImageTestCase):
+    def test_setup(self):
+        path = self.image()
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertEqual(c.setupPlain(cipher="aes", cipherMode="xts-plain64", keysize=512,
+                                      hash="sha256", offset=8, sectorSize=4096), 0)
+        info = c.info()
+        self.assertEqual(info.type, pycryptsetup.CRYPT_PLAIN)
+        self.assertEqual((info.cipher, info.cipher_mode, info.keysize), ("aes", "xts-plain64", 512))
+        self.assertEqual((info.offset, info.sector_size), (8, 4096))
+        c.close()
+
+        # nothing is written
+        with open(path, "rb") as f:
+            self.assertEqual(f.read(1024 * 1024).count(0), 1024 * 1024)
+
+    def test_keysize(self):
+        c = pycryptsetup.CryptSetup(device=self.image())
+        with self.assertRaises(TypeError):
+            c.setupPlain(keysize=100)
+        c.close()
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_activate(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = pycryptsetup.CryptSetup(device=self.image())
+        self.assertEqual(c.setupPlain(hash="sha256"), 0)
+        self.assertEqual(c.activate(name=name, passphrase=PASSPHRASE), 0)
+        self.assertEqual(c.info().name, name)
+        self.assertEqual(c.deactivate(), 0)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
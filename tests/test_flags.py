@@ -0,0 +1,51 @@
+#
+# Activation performance flags, per activation and stored in the header
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+PERFORMANCE_FLAGS = (pycryptsetup.CRYPT_ACTIVATE_ALLOW_DISCARDS |
+                     pycryptsetup.CRYPT_ACTIVATE_SAME_CPU_CRYPT |
+                     pycryptsetup.CRYPT_ACTIVATE_NO_READ_WORKQUEUE |
+                     pycryptsetup.CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE)
+
+
+class PersistentFlagsTest(ImageTestCase):
+    def test_roundtrip(self):
+        path = self.luks()
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertEqual(c.getPersistentFlags(), 0)
+        self.assertEqual(c.setPersistentFlags(PERFORMANCE_FLAGS), 0)
+        c.close()
+
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertEqual(c.getPersistentFlags(), PERFORMANCE_FLAGS)
+        self.assertEqual(c.setPersistentFlags(0), 0)
+        self.assertEqual(c.getPersistentFlags(), 0)
+        c.close()
+
+    def test_luks1_refused(self):
+        c = pycryptsetup.CryptSetup(device=self.luks(pycryptsetup.CRYPT_LUKS1))
+        self.assertLess(c.setPersistentFlags(pycryptsetup.CRYPT_ACTIVATE_ALLOW_DISCARDS), 0)
+        c.close()
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_activate_with_flags(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        self.assertEqual(c.activate(name=name, passphrase=PASSPHRASE,
+                                    flags=pycryptsetup.CRYPT_ACTIVATE_ALLOW_DISCARDS), 0)
+        try:
+            self.assertTrue(c.info().discards)
+        finally:
+            self.assertEqual(c.deactivate(), 0)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,69 @@
+#
+# luksFormat for LUKS1 and LUKS2 with PBKDF and sector size controls
+#
+
+import unittest
+
+import pycryptsetup
+
+from common import LOW_PBKDF, PASSPHRASE, ImageTestCase
+
+
+class LuksFormatTest(ImageTestCase):
+    def test_luks2_defaults(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        info = c.info()
+        self.assertEqual(info.type, pycryptsetup.CRYPT_LUKS2)
+        self.assertEqual(info.cipher_mode, "xts-plain64")
+        self.assertEqual(info.keysize, 512)
+        c.close()
+
+    def test_sector_size(self):
+        c = pycryptsetup.CryptSetup(device=self.luks(sectorSize=4096))
+        self.assertEqual(c.info().sector_size, 4096)
+        c.close()
+
+    def test_luks1_options(self):
+        c = pycryptsetup.CryptSetup(device=self.image())
+        with self.assertRaises(ValueError):
+            c.luksFormat(type=pycryptsetup.CRYPT_LUKS1, sectorSize=4096)
+        with self.assertRaises(ValueError):
+            c.luksFormat(type=pycryptsetup.CRYPT_LUKS1, pbkdf=pycryptsetup.CRYPT_KDF_ARGON2ID)
+        self.assertEqual(c.luksFormat(type=pycryptsetup.CRYPT_LUKS1, pbkdf=LOW_PBKDF), 0)
+        self.assertEqual(c.info().type, pycryptsetup.CRYPT_LUKS1)
+        c.close()
+
+    def test_keysize_validation(self):
+        c = pycryptsetup.CryptSetup(device=self.image())
+        for keysize in (255, 0, "256"):
+            with self.assertRaises(TypeError):
+                c.luksFormat(type=pycryptsetup.CRYPT_LUKS2, keysize=keysize)
+        c.close()
+
+    def test_pbkdf_dictionary(self):
+        pbkdf = {"type": pycryptsetup.CRYPT_KDF_ARGON2ID, "iterations": 4,
+                 "max_memory_kb": 32768, "parallel_threads": 1}
+        c = pycryptsetup.CryptSetup(device=self.image())
+        self.assertEqual(c.luksFormat(type=pycryptsetup.CRYPT_LUKS2, pbkdf=pbkdf), 0)
+        self.assertEqual(c.addKeyByVolumeKey(newPassphrase=PASSPHRASE), 0)
+        slot = c.keyslots()[0]["pbkdf"]
+        self.assertEqual(slot["type"], pycryptsetup.CRYPT_KDF_ARGON2ID)
+        self.assertEqual(slot["iterations"], 4)
+        self.assertEqual(slot["max_memory_kb"], 32768)
+        c.close()
+
+    def test_iteration_time_applies_to_pbkdf_dict(self):
+        iterations = []
+        for time_ms in (20, 200):
+            c = pycryptsetup.CryptSetup(device=self.image())
+            c.iterationTime(time_ms)
+            pbkdf = {"type": pycryptsetup.CRYPT_KDF_PBKDF2, "hash": "sha256"}
+            self.assertEqual(c.luksFormat(type=pycryptsetup.CRYPT_LUKS2, pbkdf=pbkdf), 0)
+            self.assertEqual(c.addKeyByVolumeKey(newPassphrase=PASSPHRASE), 0)
+            iterations.append(c.keyslots()[0]["pbkdf"]["iterations"])
+            c.close()
+        self.assertLess(iterations[0], iterations[1])
+
+
+if __name__ == "__main__":
+    unittest.main()
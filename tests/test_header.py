@@ -0,0 +1,60 @@
+#
+# In-memory header backup and restore
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import PASSPHRASE, ImageTestCase
+
+MAGIC = b"LUKS\xba\xbe"
+
+
+class HeaderTest(ImageTestCase):
+    def test_backup(self):
+        c = self.open(self.luks())
+        header = c.headerBackup()
+        self.assertIsInstance(header, bytes)
+        self.assertTrue(header.startswith(MAGIC))
+
+        buf = bytearray(len(header) + 4096)
+        self.assertEqual(c.headerBackup(buf), len(header))
+        self.assertEqual(bytes(buf[:len(header)]), header)
+
+        with self.assertRaises(ValueError):
+            c.headerBackup(bytearray(len(header) - 1))
+        c.close()
+
+    def test_restore(self):
+        c = self.open(self.luks())
+        header = c.headerBackup()
+        self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"second"), 1)
+
+        self.assertEqual(c.headerRestore(memoryview(header)), 0)
+        self.assertEqual(c.headerBackup(), header)
+        self.assertLess(c.removePassphrase(passphrase=b"second"), 0)
+        c.close()
+
+    def test_restore_rejects_garbage(self):
+        c = self.open(self.luks())
+        header = c.headerBackup()
+        r = c.headerRestore(b"\0" * len(header))
+        self.assertLess(r, 0)
+        self.assertEqual(c.headerBackup(), header)
+        c.close()
+
+    def test_header_backup_many(self):
+        paths = [self.luks() for i in range(3)]
+        missing = os.path.join(self.directory, "missing.img")
+        r = pycryptsetup.header_backup_many(paths + [missing], 2)
+        self.assertEqual(len(r), 4)
+        for header in r[:3]:
+            self.assertIsInstance(header, bytes)
+            self.assertTrue(header.startswith(MAGIC))
+        self.assertLess(r[3], 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
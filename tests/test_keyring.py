@@ -0,0 +1,60 @@
+#
+# Kernel keyring activation and LUKS2 keyring tokens
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase, Keyring, keyring_available
+
+
+@unittest.skipUnless(keyring_available(), "session keyring is not available")
+class KeyringTest(ImageTestCase):
+    def setUp(self):
+        ImageTestCase.setUp(self)
+        self.keyring = Keyring()
+        self.description = "pycryptsetup-test-%d" % os.getpid()
+        self.keyring.add(self.description, PASSPHRASE)
+        self.path = self.luks()
+
+    def tearDown(self):
+        self.keyring.clear()
+        ImageTestCase.tearDown(self)
+
+    def test_token(self):
+        c = pycryptsetup.CryptSetup(device=self.path)
+        self.assertEqual(c.addKeyringToken(keyDescription=self.description, slot=0), 0)
+        self.assertEqual(c.addKeyringToken(keyDescription=self.description, slot=0, token=3), 3)
+        c.close()
+
+    def test_token_requires_luks2(self):
+        c = pycryptsetup.CryptSetup(device=self.luks(pycryptsetup.CRYPT_LUKS1))
+        self.assertLess(c.addKeyringToken(keyDescription=self.description, slot=0), 0)
+        c.close()
+
+    def test_volume_key_keyring(self):
+        c = pycryptsetup.CryptSetup(device=self.path)
+        self.assertEqual(c.volumeKeyKeyring(False), 0)
+        self.assertEqual(c.volumeKeyKeyring(True), 0)
+        c.close()
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_activate(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = pycryptsetup.CryptSetup(device=self.path)
+        self.assertEqual(c.activate(name=name, keyDescription=self.description), 0)
+        self.assertEqual(c.deactivate(), 0)
+
+        self.assertEqual(c.addKeyringToken(keyDescription=self.description, slot=0), 0)
+        self.assertEqual(c.activateByToken(name=name), 0)
+        self.assertEqual(c.deactivate(), 0)
+
+        self.keyring.clear()
+        self.assertLess(c.activate(name=name, keyDescription=self.description), 0)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,75 @@
+#
+# Keyslot inspection, batched rekey and killSlot
+#
+
+import unittest
+
+import pycryptsetup
+
+from common import PASSPHRASE, ImageTestCase
+
+
+class KeyslotTest(ImageTestCase):
+    def test_rekey(self):
+        c = self.open(self.luks())
+        r = c.rekey([("add", PASSPHRASE, b"second"),
+                     ("change", b"second", b"third"),
+                     ("remove", b"third")])
+        self.assertEqual(r[0], 1)
+        self.assertGreaterEqual(r[1], 0)
+        self.assertEqual(len(r), 3)
+        self.assertGreaterEqual(r[2], 0)
+        self.assertLess(c.removePassphrase(passphrase=b"third"), 0)
+        c.close()
+
+    def test_rekey_stops_at_failure(self):
+        c = self.open(self.luks())
+        r = c.rekey([("remove", b"wrong"), ("add", PASSPHRASE, b"second")])
+        self.assertLess(r[0], 0)
+        self.assertIsNone(r[1])
+        c.close()
+
+    def test_rekey_rolls_back(self):
+        c = self.open(self.luks())
+        header = c.headerBackup()
+        keyslots = c.info().keyslots
+
+        r = c.rekey([("add", PASSPHRASE, b"second"), ("remove", b"wrong")])
+        self.assertEqual(r[0], 1)
+        self.assertLess(r[1], 0)
+        self.assertEqual(c.info().keyslots, keyslots)
+        self.assertEqual(c.headerBackup(), header)
+        self.assertLess(c.removePassphrase(passphrase=b"second"), 0)
+        c.close()
+
+    def test_rekey_not_atomic(self):
+        c = self.open(self.luks())
+        r = c.rekey([("add", PASSPHRASE, b"second"), ("remove", b"wrong")], atomic=False)
+        self.assertEqual(r[0], 1)
+        self.assertLess(r[1], 0)
+        self.assertEqual(c.removePassphrase(passphrase=b"second"), 0)
+        c.close()
+
+    def test_rekey_kill(self):
+        c = self.open(self.luks())
+        self.assertEqual(c.rekey([("add", PASSPHRASE, b"second"), ("kill", 0)]), [1, 0])
+        self.assertLess(c.removePassphrase(passphrase=PASSPHRASE), 0)
+        # like killSlot, the last active slot is refused
+        self.assertLess(c.rekey([("kill", 1)])[0], 0)
+        self.assertEqual(c.removePassphrase(passphrase=b"second", slot=1), 0)
+        c.close()
+
+    def test_kill_slot(self):
+        c = self.open(self.luks())
+        self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"second"), 1)
+        self.assertEqual(c.killSlot(1), 0)
+        with self.assertRaises(ValueError):
+            c.killSlot(1)
+        # the last active slot is never destroyed
+        with self.assertRaises(ValueError):
+            c.killSlot(0)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,80 @@
+#
+# list_active() and the dm-crypt table parser behind it
+#
+
+import errno
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+KEY = "0123456789abcdef" * 4
+
+
+class CryptTableTest(unittest.TestCase):
+    def test_plain_key(self):
+        m = pycryptsetup._parse_crypt_table("aes-xts-plain64 %s 0 /dev/loop0 4096" % KEY)
+        self.assertEqual(m["cipher"], "aes-xts-plain64")
+        self.assertEqual(m["keysize"], 256)
+        self.assertEqual(m["device"], "/dev/loop0")
+        self.assertEqual(m["offset"], 4096)
+        self.assertEqual(m["iv_offset"], 0)
+        self.assertEqual(m["sector_size"], 512)
+        self.assertEqual(m["flags"], 0)
+        self.assertIsNone(m["name"])
+        self.assertIsNone(m["uuid"])
+
+    def test_keyring_key(self):
+        m = pycryptsetup._parse_crypt_table(
+            "capi:xts(aes)-plain64 :64:logon:cryptsetup:0123-45 8 /dev/loop1 32768")
+        self.assertEqual(m["cipher"], "capi:xts(aes)-plain64")
+        self.assertEqual(m["keysize"], 512)
+        self.assertEqual(m["iv_offset"], 8)
+        self.assertEqual(m["offset"], 32768)
+
+    def test_null_key(self):
+        m = pycryptsetup._parse_crypt_table("cipher_null-ecb - 0 /dev/loop0 0")
+        self.assertEqual(m["keysize"], 0)
+
+    def test_optional_params(self):
+        m = pycryptsetup._parse_crypt_table(
+            "aes-xts-plain64 %s 0 /dev/loop0 4096 4 allow_discards same_cpu_crypt "
+            "sector_size:4096 no_read_workqueue" % KEY)
+        self.assertEqual(m["sector_size"], 4096)
+        self.assertEqual(m["flags"], pycryptsetup.CRYPT_ACTIVATE_ALLOW_DISCARDS |
+                         pycryptsetup.CRYPT_ACTIVATE_SAME_CPU_CRYPT |
+                         pycryptsetup.CRYPT_ACTIVATE_NO_READ_WORKQUEUE)
+
+    def test_option_count_is_honoured(self):
+        m = pycryptsetup._parse_crypt_table(
+            "aes-xts-plain64 %s 0 /dev/loop0 0 1 allow_discards same_cpu_crypt" % KEY)
+        self.assertEqual(m["flags"], pycryptsetup.CRYPT_ACTIVATE_ALLOW_DISCARDS)
+
+    def test_truncated(self):
+        for params in ("", "aes-xts-plain64", "aes-xts-plain64 %s 0 /dev/loop0" % KEY):
+            with self.assertRaises(OSError) as cm:
+                pycryptsetup._parse_crypt_table(params)
+            self.assertEqual(cm.exception.errno, errno.EINVAL)
+
+
+@unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+class ListActiveTest(ImageTestCase):
+    def test_activated(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        self.assertEqual(c.activate(name=name, passphrase=PASSPHRASE), 0)
+        try:
+            mappings = [m for m in pycryptsetup.list_active() if m["name"] == name]
+            self.assertEqual(len(mappings), 1)
+            self.assertEqual(mappings[0]["cipher"], "aes-xts-plain64")
+            self.assertEqual(mappings[0]["keysize"], 512)
+            self.assertGreater(mappings[0]["size"], 0)
+        finally:
+            c.deactivate()
+            c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,92 @@
+#
+# Log messages queued natively and delivered when a call returns
+#
+
+import sys
+import unittest
+
+import pycryptsetup
+
+from common import ImageTestCase
+
+
+class LogTest(ImageTestCase):
+    def fail_luks2_only(self, c):
+        # a plain file is no LUKS2 device, libcryptsetup logs why
+        self.assertLess(c.setPersistentFlags(pycryptsetup.CRYPT_ACTIVATE_ALLOW_DISCARDS), 0)
+
+    def test_delivered_on_return(self):
+        messages = []
+        c = pycryptsetup.CryptSetup(device=self.image(), logFunc=lambda level, text: messages.append((level, text)))
+        self.fail_luks2_only(c)
+        self.assertTrue(messages)
+        for level, text in messages:
+            self.assertEqual(level, pycryptsetup.CRYPT_LOG_ERROR)
+            self.assertIsInstance(text, str)
+        self.assertEqual(c.drainLog(), 0)
+        c.close()
+
+    def test_batch(self):
+        batches = []
+        c = pycryptsetup.CryptSetup(device=self.image(), logFunc=batches.append, logBatch=True)
+        self.fail_luks2_only(c)
+        self.assertEqual(len(batches), 1)
+        self.assertGreater(len(batches[0]), 1)
+        for level, timestamp, text in batches[0]:
+            self.assertEqual(level, pycryptsetup.CRYPT_LOG_ERROR)
+            self.assertIsInstance(timestamp, float)
+        timestamps = [timestamp for level, timestamp, text in batches[0]]
+        self.assertEqual(timestamps, sorted(timestamps))
+        c.close()
+
+    def test_filter(self):
+        messages = []
+        c = pycryptsetup.CryptSetup(device=self.image(), logFunc=lambda level, text: messages.append(level))
+        c.setLogFilter([pycryptsetup.CRYPT_LOG_NORMAL])
+        self.fail_luks2_only(c)
+        self.assertEqual(messages, [])
+
+        c.setLogFilter(None)
+        self.fail_luks2_only(c)
+        self.assertTrue(messages)
+
+        with self.assertRaises(ValueError):
+            c.setLogFilter([42])
+        with self.assertRaises(TypeError):
+            c.setLogFilter(42)
+        c.close()
+
+    def test_debug(self):
+        levels = []
+        c = pycryptsetup.CryptSetup(device=self.image(), logFunc=lambda level, text: levels.append(level))
+        c.setLogFilter([pycryptsetup.CRYPT_LOG_DEBUG])
+        c.debugLevel(pycryptsetup.CRYPT_DEBUG_ALL)
+        try:
+            self.fail_luks2_only(c)
+        finally:
+            c.debugLevel(pycryptsetup.CRYPT_DEBUG_NONE)
+        self.assertTrue(levels)
+        self.assertEqual(set(levels), set([pycryptsetup.CRYPT_LOG_DEBUG]))
+        c.close()
+
+    @unittest.skipUnless(hasattr(sys, "unraisablehook"), "needs sys.unraisablehook")
+    def test_callback_exception(self):
+        unraisable = []
+        hook = sys.unraisablehook
+        sys.unraisablehook = unraisable.append
+
+        def log(level, text):
+            raise RuntimeError("log callback")
+
+        try:
+            c = pycryptsetup.CryptSetup(device=self.image(), logFunc=log)
+            self.fail_luks2_only(c)
+            c.close()
+        finally:
+            sys.unraisablehook = hook
+        self.assertTrue(unraisable)
+        self.assertIsInstance(unraisable[0].exc_value, RuntimeError)
+
+
+if __name__ == "__main__":
+    unittest.main()
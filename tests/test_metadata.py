@@ -0,0 +1,78 @@
+#
+# info() and isLuks() answered from the loaded header
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+
+class MetadataTest(ImageTestCase):
+    def setUp(self):
+        ImageTestCase.setUp(self)
+        pycryptsetup.set_stats(True)
+        pycryptsetup.reset_stats()
+
+    def tearDown(self):
+        pycryptsetup.set_stats(False)
+        pycryptsetup.reset_stats()
+        ImageTestCase.tearDown(self)
+
+    def loads(self):
+        return pycryptsetup.stats().get("crypt_load", {"count": 0})["count"]
+
+    def test_info_cached(self):
+        c = self.open(self.luks())
+        info = c.info()
+        self.assertIs(c.info(), info)
+        self.assertEqual(info.keyslots[:2], (pycryptsetup.CRYPT_SLOT_ACTIVE_LAST, pycryptsetup.CRYPT_SLOT_INACTIVE))
+        self.assertEqual(info.device, c.info().device)
+
+        # a mutating call rebuilds it
+        self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"second"), 1)
+        info = c.info()
+        self.assertEqual(info.keyslots[:2], (pycryptsetup.CRYPT_SLOT_ACTIVE, pycryptsetup.CRYPT_SLOT_ACTIVE))
+        c.close()
+
+    def test_header_loaded_once(self):
+        path = self.luks()
+        pycryptsetup.reset_stats()
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertEqual(self.loads(), 0)
+        self.assertEqual(c.isLuks(), 0)
+        self.assertEqual(c.isLuks(), 0)
+        self.assertTrue(c.luksUUID())
+        c.info()
+        self.assertEqual(self.loads(), 1)
+        c.close()
+
+    def test_isluks_reads_header_once(self):
+        c = pycryptsetup.CryptSetup(device=self.image())
+        self.assertLess(c.isLuks(), 0)
+        self.assertEqual(self.loads(), 1)
+        c.close()
+
+    def test_status_inactive(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        with self.assertRaises(OSError):
+            c.status()
+        c.close()
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_status_active(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        self.assertEqual(c.activate(name=name, passphrase=PASSPHRASE), 0)
+        try:
+            self.assertEqual(c.status(), pycryptsetup.CRYPT_ACTIVE)
+            self.assertEqual(c.info().name, name)
+        finally:
+            self.assertEqual(c.deactivate(), 0)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,59 @@
+#
+# Opt-in parallel keyslot trial
+#
+# The trial needs more than one CPU, on a single CPU the same calls fall
+# back to libcryptsetup trying the slots one after another.
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+
+class ParallelSlotsTest(ImageTestCase):
+    def setUp(self):
+        ImageTestCase.setUp(self)
+        self.path = self.luks()
+        c = self.open(self.path)
+        for i in range(1, 4):
+            self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"slot-%d" % i), i)
+        c.close()
+
+    def active(self, c):
+        return [i for i, status in enumerate(c.info().keyslots)
+                if status in (pycryptsetup.CRYPT_SLOT_ACTIVE, pycryptsetup.CRYPT_SLOT_ACTIVE_LAST)]
+
+    def test_remove_finds_slot(self):
+        c = pycryptsetup.CryptSetup(device=self.path)
+        self.assertEqual(c.removePassphrase(passphrase=b"slot-3", parallel_slots=True), 0)
+        self.assertEqual(self.active(c), [0, 1, 2])
+        self.assertEqual(c.removePassphrase(passphrase=PASSPHRASE, parallel_slots=True), 0)
+        self.assertEqual(self.active(c), [1, 2])
+        c.close()
+
+    def test_wrong_passphrase(self):
+        c = pycryptsetup.CryptSetup(device=self.path)
+        self.assertLess(c.removePassphrase(passphrase=b"wrong", parallel_slots=True), 0)
+        self.assertEqual(self.active(c), [0, 1, 2, 3])
+        c.close()
+
+    def test_explicit_slot_wins(self):
+        c = pycryptsetup.CryptSetup(device=self.path)
+        self.assertLess(c.removePassphrase(passphrase=b"slot-2", slot=1, parallel_slots=True), 0)
+        self.assertEqual(self.active(c), [0, 1, 2, 3])
+        c.close()
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_activate(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = pycryptsetup.CryptSetup(device=self.path)
+        self.assertEqual(c.activate(name=name, passphrase=b"slot-2", parallel_slots=True), 2)
+        self.assertEqual(c.deactivate(), 0)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
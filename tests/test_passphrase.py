@@ -0,0 +1,71 @@
+#
+# Passphrases as buffers and keyfile operations
+#
+
+import mmap
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+
+class PassphraseTest(ImageTestCase):
+    def setUp(self):
+        ImageTestCase.setUp(self)
+        self.c = self.open(self.luks())
+
+    def tearDown(self):
+        self.c.close()
+        ImageTestCase.tearDown(self)
+
+    def keyfile(self, data):
+        path = os.path.join(self.directory, "key-%d" % len(os.listdir(self.directory)))
+        with open(path, "wb") as f:
+            f.write(data)
+        return path
+
+    def test_buffer_types(self):
+        self.assertEqual(self.c.addKeyByPassphrase(passphrase=bytearray(PASSPHRASE),
+                                                   newPassphrase=memoryview(b"second")), 1)
+        self.assertEqual(self.c.addKeyByPassphrase(passphrase="second", newPassphrase=b"third"), 2)
+
+        with open(self.keyfile(b"third"), "rb") as f:
+            m = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ)
+            self.assertEqual(self.c.removePassphrase(passphrase=m), 0)
+            m.close()
+
+    def test_wrong_type(self):
+        with self.assertRaises(TypeError):
+            self.c.addKeyByPassphrase(passphrase=1234, newPassphrase=b"second")
+
+    def test_keyfile(self):
+        keyfile = self.keyfile(PASSPHRASE)
+        new_keyfile = self.keyfile(os.urandom(64))
+        self.assertEqual(self.c.addKeyByKeyfile(keyfile=keyfile, newKeyfile=new_keyfile), 1)
+        self.assertEqual(self.c.removeKeyfile(keyfile=new_keyfile), 0)
+        self.assertLess(self.c.removeKeyfile(keyfile=new_keyfile), 0)
+
+    def test_keyfile_size_and_offset(self):
+        keyfile = self.keyfile(b"junk" + PASSPHRASE + b"trailer")
+        new_keyfile = self.keyfile(b"0123456789abcdef")
+        self.assertLess(self.c.addKeyByKeyfile(keyfile=keyfile, newKeyfile=new_keyfile), 0)
+        self.assertEqual(self.c.addKeyByKeyfile(keyfile=keyfile, newKeyfile=new_keyfile,
+                                                keyfileOffset=4, keyfileSize=len(PASSPHRASE),
+                                                newKeyfileSize=8), 1)
+        self.assertEqual(self.c.removePassphrase(passphrase=b"01234567"), 0)
+
+    def test_missing_keyfile(self):
+        missing = os.path.join(self.directory, "missing")
+        self.assertLess(self.c.addKeyByKeyfile(keyfile=missing, newKeyfile=missing), 0)
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_activate_by_keyfile(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        self.assertEqual(self.c.activateByKeyfile(name=name, keyfile=self.keyfile(PASSPHRASE)), 0)
+        self.assertEqual(self.c.deactivate(), 0)
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,79 @@
+#
+# Persistent PBKDF calibration cache
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import PASSPHRASE, ImageTestCase
+
+
+class PbkdfCacheTest(ImageTestCase):
+    def setUp(self):
+        ImageTestCase.setUp(self)
+        self.path = os.path.join(self.directory, "pbkdf.cache")
+        pycryptsetup.set_pbkdf_cache(self.path)
+        pycryptsetup.clear_pbkdf_cache()
+
+    def tearDown(self):
+        pycryptsetup.clear_pbkdf_cache()
+        pycryptsetup.set_pbkdf_cache(None)
+        ImageTestCase.tearDown(self)
+
+    def format(self, time_ms):
+        c = pycryptsetup.CryptSetup(device=self.image())
+        c.iterationTime(time_ms)
+        self.assertEqual(c.luksFormat(type=pycryptsetup.CRYPT_LUKS1, pbkdf=pycryptsetup.CRYPT_KDF_PBKDF2), 0)
+        self.assertEqual(c.addKeyByVolumeKey(newPassphrase=PASSPHRASE), 0)
+        c.close()
+
+    def test_miss_then_hit(self):
+        self.format(50)
+        cache = pycryptsetup.pbkdf_cache()
+        self.assertEqual((cache["misses"], cache["hits"]), (1, 0))
+        self.assertEqual(len(cache["entries"]), 1)
+        self.assertEqual(cache["entries"][0]["time_ms"], 50)
+
+        self.format(50)
+        cache = pycryptsetup.pbkdf_cache()
+        self.assertEqual((cache["misses"], cache["hits"]), (1, 1))
+
+    def test_iteration_time_is_part_of_key(self):
+        self.format(50)
+        self.format(80)
+        self.format(50)
+        cache = pycryptsetup.pbkdf_cache()
+        self.assertEqual(sorted(e["time_ms"] for e in cache["entries"]), [50, 80])
+        self.assertEqual((cache["misses"], cache["hits"]), (2, 1))
+
+    def test_persistent(self):
+        self.format(50)
+        self.assertTrue(os.path.exists(self.path))
+
+        pycryptsetup.set_pbkdf_cache(None)
+        pycryptsetup.set_pbkdf_cache(self.path)
+        self.format(50)
+        cache = pycryptsetup.pbkdf_cache()
+        self.assertEqual(len(cache["entries"]), 1)
+        self.assertEqual(cache["hits"], 1)
+
+    def test_corrupt_file_ignored(self):
+        pycryptsetup.set_pbkdf_cache(None)
+        with open(self.path, "wb") as f:
+            f.write(b"garbage\n\0\xff")
+        pycryptsetup.set_pbkdf_cache(self.path)
+        self.assertEqual(pycryptsetup.pbkdf_cache()["entries"], [])
+
+        self.format(50)
+        self.assertEqual(len(pycryptsetup.pbkdf_cache()["entries"]), 1)
+
+    def test_explicit_iterations_bypass(self):
+        self.luks()
+        cache = pycryptsetup.pbkdf_cache()
+        self.assertEqual((cache["misses"], cache["hits"]), (0, 0))
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,73 @@
+#
+# Online resize and LUKS2 reencryption
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+
+class ReencryptTest(ImageTestCase):
+    def test_offline(self):
+        path = self.luks()
+        rates = []
+        c = self.open(path)
+        r = c.reencrypt(passphrase=PASSPHRASE, cipher="aes", cipherMode="xts-plain64", keysize=256,
+                        progress=lambda done, total, mibps: rates.append(mibps), progressInterval=0)
+        self.assertEqual(r, 0)
+        self.assertTrue(rates)
+        self.assertEqual(c.info().keysize, 256)
+        c.close()
+
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertIsNotNone(c.getVolumeKey(passphrase=PASSPHRASE))
+        c.close()
+
+    def test_wrong_passphrase_leaves_no_slot(self):
+        c = self.open(self.luks())
+        keyslots = c.info().keyslots
+        self.assertLess(c.reencrypt(passphrase=b"wrong"), 0)
+        self.assertEqual(c.info().keyslots, keyslots)
+        c.close()
+
+    def test_requires_luks2(self):
+        c = self.open(self.luks(pycryptsetup.CRYPT_LUKS1))
+        with self.assertRaises(ValueError):
+            c.reencrypt(passphrase=PASSPHRASE)
+        c.close()
+
+    def test_progress_must_be_callable(self):
+        c = self.open(self.luks())
+        with self.assertRaises(TypeError):
+            c.reencrypt(passphrase=PASSPHRASE, progress=1)
+        c.close()
+
+
+class ResizeTest(ImageTestCase):
+    def test_not_activated(self):
+        c = self.open(self.luks())
+        with self.assertRaises(RuntimeError):
+            c.resize(0)
+        c.close()
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_resize(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = self.open(self.luks())
+        self.assertEqual(c.activate(name=name, passphrase=PASSPHRASE), 0)
+        try:
+            size = c.info().size
+            self.assertEqual(c.resize(size - 8), 0)
+            self.assertEqual(c.info().size, size - 8)
+            self.assertEqual(c.resize(0), 0)
+            self.assertEqual(c.info().size, size)
+        finally:
+            c.deactivate()
+            c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,71 @@
+#
+# Last-good-keyslot cache for operations called without a slot
+#
+
+import os
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+
+class SlotCacheTest(ImageTestCase):
+    def setUp(self):
+        ImageTestCase.setUp(self)
+        pycryptsetup.set_slot_cache(True)
+        pycryptsetup.clear_slot_cache()
+
+    def tearDown(self):
+        pycryptsetup.set_slot_cache(False)
+        pycryptsetup.clear_slot_cache()
+        ImageTestCase.tearDown(self)
+
+    def test_disabled(self):
+        pycryptsetup.set_slot_cache(False)
+        c = self.open(self.luks())
+        self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"second"), 1)
+        self.assertEqual(c.removePassphrase(passphrase=b"second"), 0)
+        c.close()
+        stats = pycryptsetup.slot_cache_stats()
+        self.assertFalse(stats["enabled"])
+        self.assertEqual((stats["hits"], stats["misses"]), (0, 0))
+
+    def test_removed_slot_forgotten(self):
+        c = self.open(self.luks())
+        self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"second"), 1)
+        self.assertEqual(c.removePassphrase(passphrase=b"second"), 0)
+        c.close()
+        stats = pycryptsetup.slot_cache_stats()
+        self.assertEqual(stats["misses"], 1)
+        self.assertEqual(stats["entries"], 0)
+
+    def test_explicit_slot_bypasses(self):
+        c = self.open(self.luks())
+        self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"second"), 1)
+        self.assertEqual(c.removePassphrase(passphrase=b"second", slot=1), 0)
+        c.close()
+        stats = pycryptsetup.slot_cache_stats()
+        self.assertEqual((stats["hits"], stats["misses"]), (0, 0))
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_hit_and_stale(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = self.open(self.luks())
+        self.assertEqual(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"second"), 1)
+
+        self.assertEqual(c.activate(name=name, passphrase=b"second"), 0)
+        self.assertEqual(c.deactivate(), 0)
+        self.assertEqual(c.activate(name=name, passphrase=b"second"), 0)
+        self.assertEqual(c.deactivate(), 0)
+        self.assertEqual(pycryptsetup.slot_cache_stats()["hits"], 1)
+
+        # slot 1 is cached, the other passphrase falls back to all slots
+        self.assertEqual(c.activate(name=name, passphrase=PASSPHRASE), 0)
+        self.assertEqual(c.deactivate(), 0)
+        self.assertEqual(pycryptsetup.slot_cache_stats()["misses"], 2)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
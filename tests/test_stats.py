@@ -0,0 +1,52 @@
+#
+# Per-call latency and error statistics
+#
+
+import errno
+import unittest
+
+import pycryptsetup
+
+from common import ImageTestCase
+
+
+class StatsTest(ImageTestCase):
+    def setUp(self):
+        ImageTestCase.setUp(self)
+        pycryptsetup.set_stats(True)
+        pycryptsetup.reset_stats()
+
+    def tearDown(self):
+        pycryptsetup.set_stats(False)
+        pycryptsetup.reset_stats()
+        ImageTestCase.tearDown(self)
+
+    def test_calls_counted(self):
+        path = self.luks()
+        stats = pycryptsetup.stats()
+        self.assertEqual(stats["crypt_format"]["count"], 1)
+        self.assertEqual(stats["crypt_keyslot_add_by_volume_key"]["count"], 1)
+        for op in stats.values():
+            self.assertLessEqual(op["p50"], op["p99"])
+            self.assertLessEqual(op["p99"], op["max"])
+            self.assertLessEqual(op["max"], op["total"])
+
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertLess(c.removePassphrase(passphrase=b"wrong"), 0)
+        c.close()
+        errors = pycryptsetup.stats()["crypt_activate_by_passphrase"]["errors"]
+        self.assertEqual(errors, {errno.EPERM: 1})
+
+    def test_disabled(self):
+        pycryptsetup.set_stats(False)
+        self.luks()
+        self.assertEqual(pycryptsetup.stats(), {})
+
+    def test_reset(self):
+        self.luks()
+        pycryptsetup.reset_stats()
+        self.assertNotIn("crypt_format", pycryptsetup.stats())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,152 @@
+#
+# Multi-phase init: module instances in subinterpreters, callbacks and
+# garbage collection of CryptSetup objects
+#
+
+import asyncio
+import gc
+import os
+import threading
+import unittest
+import weakref
+
+import pycryptsetup
+
+from common import PASSPHRASE, ImageTestCase
+
+try:
+    import _interpreters as interpreters
+except ImportError:
+    try:
+        import _xxsubinterpreters as interpreters
+    except ImportError:
+        interpreters = None
+
+
+@unittest.skipUnless(interpreters, "subinterpreters are not available")
+class SubinterpreterTest(ImageTestCase):
+    def run_in_interpreter(self, script):
+        interp = interpreters.create()
+        try:
+            interpreters.run_string(interp, script)
+        finally:
+            interpreters.destroy(interp)
+
+    def test_async_jobs(self):
+        # results go to a file, run_string() reports errors differently across versions
+        path = self.luks()
+        result = os.path.join(self.directory, "result")
+        self.run_in_interpreter("""if 1:
+            import asyncio
+            import pycryptsetup
+
+            async def run():
+                c = pycryptsetup.CryptSetup(device=%r)
+                c.iterationTime(10)
+                r = await c.addKeyByPassphrase_async(passphrase=%r, newPassphrase=b"sub")
+                c.close()
+                return r
+
+            r = asyncio.run(run())
+
+            # left pending, destroying the interpreter has to drain it
+            async def submit():
+                return c.addKeyByPassphrase_async(passphrase=%r, newPassphrase=b"late")
+
+            c = pycryptsetup.CryptSetup(device=%r)
+            c.iterationTime(10)
+            loop = asyncio.new_event_loop()
+            pending = loop.run_until_complete(submit())
+            loop.close()
+
+            with open(%r, "w") as f:
+                f.write(str(r))
+        """ % (path, PASSPHRASE, PASSPHRASE, path, result))
+
+        with open(result) as f:
+            self.assertEqual(f.read(), "1")
+
+        # the module of the main interpreter is unaffected
+        c = pycryptsetup.CryptSetup(device=path)
+        self.assertEqual(c.removePassphrase(passphrase=b"sub"), 0)
+        c.close()
+
+    def test_independent_instances(self):
+        result = os.path.join(self.directory, "result")
+        self.run_in_interpreter("""if 1:
+            import pycryptsetup
+            with open(%r, "w") as f:
+                f.write(str(id(pycryptsetup.CryptSetup)))
+        """ % result)
+
+        with open(result) as f:
+            self.assertNotEqual(int(f.read()), id(pycryptsetup.CryptSetup))
+
+
+class CallbackTest(ImageTestCase):
+    def test_attributes(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        with self.assertRaises(AttributeError):
+            c.yesDialogCB
+        with self.assertRaises(RuntimeError):
+            c.askyes("question")
+        with self.assertRaises(RuntimeError):
+            c.log(pycryptsetup.CRYPT_LOG_NORMAL, "message")
+
+        c.yesDialogCB = lambda msg: 0
+        c.cmdLineLogCB = lambda level, msg: None
+        self.assertEqual(c.askyes("question"), 0)
+        self.assertIsNone(c.log(pycryptsetup.CRYPT_LOG_NORMAL, "message"))
+
+        del c.yesDialogCB
+        with self.assertRaises(AttributeError):
+            c.yesDialogCB
+        c.close()
+
+    def test_replace_while_running(self):
+        path = self.luks()
+        messages = []
+        c = pycryptsetup.CryptSetup(device=path, logFunc=lambda level, msg: messages.append(msg))
+        c.iterationTime(10)
+        # debug output gives every job plenty of messages
+        c.debugLevel(pycryptsetup.CRYPT_DEBUG_ALL)
+        self.addCleanup(c.debugLevel, pycryptsetup.CRYPT_DEBUG_NONE)
+        stop = threading.Event()
+
+        def replace():
+            while not stop.is_set():
+                c.cmdLineLogCB = lambda level, msg: messages.append(msg)
+
+        thread = threading.Thread(target=replace)
+        thread.start()
+        try:
+            async def run():
+                return await asyncio.gather(*[c.removePassphrase_async(passphrase=b"wrong")
+                                              for i in range(8)])
+
+            self.assertTrue(all(r < 0 for r in asyncio.run(run())))
+        finally:
+            stop.set()
+            thread.join()
+        c.close()
+        self.assertTrue(messages)
+
+    def test_cycle_is_collected(self):
+        class Holder(object):
+            def log(self, level, msg):
+                pass
+
+        holder = Holder()
+        c = pycryptsetup.CryptSetup(device=self.luks(), logFunc=holder.log)
+        holder.c = c
+        self.assertTrue(gc.is_tracked(c))
+        self.assertIn(holder.log.__func__, [getattr(r, "__func__", None) for r in gc.get_referents(c)])
+
+        ref = weakref.ref(holder)
+        del c, holder
+        gc.collect()
+        self.assertIsNone(ref())
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,61 @@
+#
+# GIL release around libcryptsetup calls and objects shared between threads
+#
+
+import threading
+import time
+import unittest
+
+import pycryptsetup
+
+from common import PASSPHRASE, ImageTestCase
+
+
+class ThreadTest(ImageTestCase):
+    def test_gil_released(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        c.iterationTime(300)
+        done = threading.Event()
+        result = []
+
+        def add():
+            result.append(c.addKeyByPassphrase(passphrase=PASSPHRASE, newPassphrase=b"second"))
+            done.set()
+
+        t = threading.Thread(target=add)
+        start = time.monotonic()
+        t.start()
+        spins = 0
+        while not done.is_set():
+            spins += 1
+        t.join()
+        c.close()
+
+        # the KDF runs for about 300 ms, this thread kept running meanwhile
+        self.assertEqual(result, [1])
+        self.assertGreater(time.monotonic() - start, 0.1)
+        self.assertGreater(spins, 10000)
+
+    def test_shared_object(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        errors = []
+
+        def reader():
+            try:
+                for i in range(20):
+                    if not c.luksUUID():
+                        errors.append("no uuid")
+            except Exception as e:
+                errors.append(e)
+
+        threads = [threading.Thread(target=reader) for i in range(4)]
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        c.close()
+        self.assertEqual(errors, [])
+
+
+if __name__ == "__main__":
+    unittest.main()
@@ -0,0 +1,83 @@
+#
+# Volume key retrieval, VolumeKey objects and volume-key activation
+#
+
+import os
+import resource
+import unittest
+
+import pycryptsetup
+
+from common import DM_AVAILABLE, PASSPHRASE, ImageTestCase
+
+
+class VolumeKeyTest(ImageTestCase):
+    def test_get(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        key = c.getVolumeKey(passphrase=PASSPHRASE)
+        self.assertEqual(len(key), 64)
+        self.assertEqual(len(bytes(key)), 64)
+        with self.assertRaises(OSError):
+            c.getVolumeKey(passphrase=b"wrong")
+        c.close()
+
+    def test_not_instantiable(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        key = c.getVolumeKey(passphrase=PASSPHRASE)
+        c.close()
+        with self.assertRaises(TypeError):
+            type(key)()
+
+    def test_add_keyslot_with_key(self):
+        c = self.open(self.luks())
+        key = c.getVolumeKey(passphrase=PASSPHRASE)
+        self.assertEqual(c.addKeyByVolumeKey(newPassphrase=b"second", key=key), 1)
+        self.assertEqual(c.addKeyByVolumeKey(newPassphrase=b"third", key=bytes(key)), 2)
+        self.assertLess(c.addKeyByVolumeKey(newPassphrase=b"fourth", key=b"\0" * 64), 0)
+        c.close()
+
+    def test_buffer_and_wipe(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        key = c.getVolumeKey(passphrase=PASSPHRASE)
+        c.close()
+        view = memoryview(key)
+        self.assertTrue(view.readonly)
+        with self.assertRaises(BufferError):
+            key.wipe()
+        view.release()
+        key.wipe()
+        key.wipe()
+        self.assertEqual(len(key), 0)
+        with self.assertRaises(ValueError):
+            bytes(key)
+
+    def test_locked(self):
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        keys = [c.getVolumeKey(passphrase=PASSPHRASE) for i in range(3)]
+        c.close()
+        for key in keys:
+            self.assertIsInstance(key.locked, bool)
+        if os.geteuid() == 0 or resource.getrlimit(resource.RLIMIT_MEMLOCK)[0] == resource.RLIM_INFINITY:
+            self.assertTrue(all(key.locked for key in keys))
+
+        # every key has pages of its own, wiping one leaves the others intact
+        data = bytes(keys[1])
+        keys[0].wipe()
+        self.assertFalse(keys[0].locked)
+        self.assertEqual(bytes(keys[1]), data)
+        with self.assertRaises(AttributeError):
+            keys[1].locked = False
+
+    @unittest.skipUnless(DM_AVAILABLE, "device-mapper is not available")
+    def test_activate(self):
+        name = "pycryptsetup-test-%d" % os.getpid()
+        c = pycryptsetup.CryptSetup(device=self.luks())
+        key = c.getVolumeKey(passphrase=PASSPHRASE)
+        self.assertEqual(c.activateByVolumeKey(name=name, key=key), 0)
+        self.assertEqual(c.deactivate(), 0)
+        self.assertLess(c.activateByVolumeKey(name=name, key=b"\0" * 64), 0)
+        c.close()
+
+
+if __name__ == "__main__":
+    unittest.main()
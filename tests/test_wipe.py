@@ -0,0 +1,49 @@
+#
+# wipe() with progress reporting
+#
+
+import unittest
+
+import pycryptsetup
+
+from common import ImageTestCase
+
+MIB = 1024 * 1024
+
+
+class WipeTest(ImageTestCase):
+    def test_wipe_range(self):
+        path = self.image(4)
+        with open(path, "r+b") as f:
+            f.write(b"\xff" * 4 * MIB)
+
+        calls = []
+        c = pycryptsetup.CryptSetup(device=path)
+        r = c.wipe(device=path, offset=MIB, length=2 * MIB,
+                   blockSize=64 * 1024, flags=pycryptsetup.CRYPT_WIPE_NO_DIRECT_IO,
+                   progress=lambda done, total, mibps: calls.append((done, total)),
+                   progressInterval=0)
+        c.close()
+        self.assertEqual(r, 0)
+        self.assertTrue(calls)
+        # progress counts from the start of the range, not of the device
+        self.assertTrue(all(done <= total == 2 * MIB for done, total in calls))
+        self.assertEqual(calls[-1][0], 2 * MIB)
+
+        with open(path, "rb") as f:
+            data = f.read()
+        self.assertEqual(data[:MIB], b"\xff" * MIB)
+        self.assertEqual(data[MIB:3 * MIB], b"\0" * 2 * MIB)
+        self.assertEqual(data[3 * MIB:], b"\xff" * MIB)
+
+    def test_wipe_cancel(self):
+        path = self.image(4)
+        c = pycryptsetup.CryptSetup(device=path)
+        r = c.wipe(device=path, blockSize=64 * 1024, flags=pycryptsetup.CRYPT_WIPE_NO_DIRECT_IO,
+                   progress=lambda done, total, mibps: True, progressInterval=0)
+        c.close()
+        self.assertLess(r, 0)
+
+
+if __name__ == "__main__":
+    unittest.main()